@@ -36,14 +36,22 @@ SOURCES += \
     src/cyan.cpp \
     src/FXX.cpp \
     src/imageview.cpp \
+    src/tileditem.cpp \
     src/profiledialog.cpp \
-    src/helpdialog.cpp
+    src/helpdialog.cpp \
+    src/openlayerdialog.cpp \
+    src/comparedialog.cpp \
+    src/statspanel.cpp
 HEADERS += \
     src/cyan.h \
     src/FXX.h \
     src/imageview.h \
+    src/tileditem.h \
     src/profiledialog.h \
-    src/helpdialog.h
+    src/helpdialog.h \
+    src/openlayerdialog.h \
+    src/comparedialog.h \
+    src/statspanel.h
 RESOURCES += \
     res/cyan.qrc \
     docs/docs.qrc
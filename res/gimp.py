@@ -8,9 +8,12 @@ import time
 import shutil
 import os.path
 import tempfile
+import struct
 
 cyanversion = "1.3.0"
 cyanbin = "cyan"
+cyanclibin = "cyan-cli"
+cyanintents = [ "perceptual", "relative", "saturation", "absolute" ]
 
 def plugin_maketempfile( image, src, type ):
 
@@ -160,6 +163,67 @@ def plugin_saveresult( image, dest, tempfilename, tempimage ):
 
 #----------------------------------------------------------------------------------
 
+def plugin_bridge_proof( image, src, profile, intent, blackpoint ):
+
+    # stream the visible pixels to cyan-cli and back, no temp files
+    layer = pdb.gimp_layer_new_from_visible( image, image, "Cyan Proof" )
+    width = layer.width
+    height = layer.height
+
+    if layer.bpp > 2:
+        colorspace = 1 # RGB
+    else:
+        colorspace = 3 # GRAY
+    alpha = 0
+    if layer.has_alpha:
+        alpha = 1
+
+    try:
+        iccsize, iccdata = pdb.gimp_image_get_effective_color_profile( image )
+        icc = "".join( chr( c ) for c in iccdata )
+    except:
+        icc = ""
+
+    pdb.gimp_progress_set_text( "Waiting on Cyan ..." )
+    region = layer.get_pixel_rgn( 0, 0, width, height, False, False )
+    request = "CYAN" + struct.pack( "=IIIIIII", 1, width, height, colorspace, alpha, 8, len( icc ) ) + icc + region[0:width, 0:height]
+
+    args = [ cyanclibin, "--bridge", "--proof", "-p", profile, "-r", cyanintents[intent] ]
+    if blackpoint:
+        args.append( "-b" )
+    try:
+        child = subprocess.Popen( args, stdin=subprocess.PIPE, stdout=subprocess.PIPE, stderr=subprocess.PIPE )
+        result, errors = child.communicate( request )
+    except:
+        result = ""
+        errors = "Could not run " + cyanclibin
+
+    if len( result ) < 8 or result[0:4] != "CYAN":
+        gimp.message( "Cyan failed: " + errors )
+        pdb.gimp_item_delete( layer )
+        return
+    status = struct.unpack( "=I", result[4:8] )[0]
+    if status != 0:
+        length = struct.unpack( "=I", result[8:12] )[0]
+        gimp.message( "Cyan failed: " + result[12:12 + length] )
+        pdb.gimp_item_delete( layer )
+        return
+
+    iccsize = struct.unpack( "=I", result[28:32] )[0]
+    pixels = result[32 + iccsize:]
+
+    pdb.gimp_image_undo_group_start( image )
+    image.add_layer( layer, 0 )
+    region = layer.get_pixel_rgn( 0, 0, width, height, True, True )
+    region[0:width, 0:height] = pixels
+    layer.flush()
+    layer.merge_shadow( True )
+    layer.update( 0, 0, width, height )
+    pdb.gimp_image_undo_group_end( image )
+    gimp.displays_flush()
+
+#----------------------------------------------------------------------------------
+
 def plugin_tidyup( fname ):
 
     if os.access( fname, os.F_OK ):
@@ -206,6 +270,23 @@ register(
                 [],
                 plugin_import_psd,
                 )
+register(
+                "cyan-bridge-proof",
+                "Soft proof visible image with Cyan.",
+                "Convert the visible image to a profile and back, added as a new layer.",
+                "Ole-Andre Rodlie (ole.andre.rodlie@gmail.com)",
+                "Copyright 2020 Ole-Andre Rodlie",
+                "2020",
+                "<Image>/Cyan/Soft Proof...",
+                "RGB*, GRAY*", # image types
+                [
+                    (PF_FILE, "profile", "Output profile", ""),
+                    (PF_OPTION, "intent", "Rendering intent", 0, ["Perceptual", "Relative", "Saturation", "Absolute"]),
+                    (PF_TOGGLE, "blackpoint", "Black point compensation", False),
+                ],
+                [],
+                plugin_bridge_proof,
+                )
 main()
   
 #----------------------------------------------------------------------------------
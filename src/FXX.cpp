@@ -33,6 +33,566 @@
 #include "FXX.h"
 //#include <wand/magick_wand.h>
 
+#include <sstream>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <cstring>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <dirent.h>
+#include <utime.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#include <sys/stat.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define ICC_HEADER_LENGTH 128
+#define ICC_TAG_LENGTH 12
+
+static unsigned int readICCUInt32(const unsigned char *p)
+{
+    return (static_cast<unsigned int>(p[0]) << 24) |
+           (static_cast<unsigned int>(p[1]) << 16) |
+           (static_cast<unsigned int>(p[2]) << 8) |
+            static_cast<unsigned int>(p[3]);
+}
+
+static FXX::ColorSpace readICCColorSpace(unsigned int signature)
+{
+    switch (signature) {
+    case 0x52474220: // 'RGB '
+        return FXX::RGBColorSpace;
+    case 0x434D594B: // 'CMYK'
+        return FXX::CMYKColorSpace;
+    case 0x47524159: // 'GRAY'
+        return FXX::GRAYColorSpace;
+    case 0x4C616220: // 'Lab '
+        return FXX::LABColorSpace;
+    case 0x58595A20: // 'XYZ '
+        return FXX::XYZColorSpace;
+    default:;
+    }
+    return FXX::UnknownColorSpace;
+}
+
+static FXX::ProfileClass readICCProfileClass(unsigned int signature)
+{
+    switch (signature) {
+    case 0x73636E72: // 'scnr'
+        return FXX::InputProfileClass;
+    case 0x6D6E7472: // 'mntr'
+        return FXX::DisplayProfileClass;
+    case 0x70727472: // 'prtr'
+        return FXX::OutputProfileClass;
+    case 0x6C696E6B: // 'link'
+        return FXX::LinkProfileClass;
+    case 0x61627374: // 'abst'
+        return FXX::AbstractProfileClass;
+    case 0x73706163: // 'spac'
+        return FXX::ColorSpaceProfileClass;
+    case 0x6E6D636C: // 'nmcl'
+        return FXX::NamedColorProfileClass;
+    default:;
+    }
+    return FXX::UnknownProfileClass;
+}
+
+static void appendUTF8(std::string &output, unsigned int code)
+{
+    if (code < 0x80) {
+        output += static_cast<char>(code);
+    } else if (code < 0x800) {
+        output += static_cast<char>(0xC0 | (code >> 6));
+        output += static_cast<char>(0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+        output += static_cast<char>(0xE0 | (code >> 12));
+        output += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+        output += static_cast<char>(0x80 | (code & 0x3F));
+    } else {
+        output += static_cast<char>(0xF0 | (code >> 18));
+        output += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+        output += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+        output += static_cast<char>(0x80 | (code & 0x3F));
+    }
+}
+
+// read text from a desc, text or mluc tag (en_US preferred, as LCMS)
+static std::string readICCText(const unsigned char *data,
+                               size_t length,
+                               unsigned int offset,
+                               unsigned int size)
+{
+    std::string result;
+    if (offset >= length || size < ICC_TAG_LENGTH || size > length - offset) {
+        return result;
+    }
+    const unsigned char *tag = data + offset;
+    switch (readICCUInt32(tag)) {
+    case 0x64657363: // 'desc'
+    {
+        unsigned int count = readICCUInt32(tag + 8);
+        if (count > size - 12) { count = size - 12; }
+        result.assign(reinterpret_cast<const char*>(tag + 12), count);
+        break;
+    }
+    case 0x74657874: // 'text'
+        result.assign(reinterpret_cast<const char*>(tag + 8), size - 8);
+        break;
+    case 0x6D6C7563: // 'mluc'
+    {
+        if (size < 16) { break; }
+        unsigned int records = readICCUInt32(tag + 8);
+        unsigned int recordSize = readICCUInt32(tag + 12);
+        if (recordSize < 12) { break; }
+        if (records > (size - 16) / recordSize) { records = (size - 16) / recordSize; }
+        int best = -1;
+        for (unsigned int i = 0; i < records; ++i) {
+            const unsigned char *record = tag + 16 + i * recordSize;
+            if (record[0] != 'e' || record[1] != 'n') { continue; }
+            if (best < 0) { best = static_cast<int>(i); }
+            if (record[2] == 'U' && record[3] == 'S') {
+                best = static_cast<int>(i);
+                break;
+            }
+        }
+        if (best < 0 && records > 0) { best = 0; }
+        if (best < 0) { break; }
+        const unsigned char *record = tag + 16 + static_cast<unsigned int>(best) * recordSize;
+        unsigned int textLength = readICCUInt32(record + 4);
+        unsigned int textOffset = readICCUInt32(record + 8);
+        if (textOffset > size || textLength > size - textOffset) { break; }
+        const unsigned char *text = tag + textOffset;
+        for (unsigned int i = 0; i + 1 < textLength; i += 2) {
+            unsigned int code = (static_cast<unsigned int>(text[i]) << 8) | text[i + 1];
+            if (code >= 0xD800 && code < 0xDC00 && i + 3 < textLength) {
+                unsigned int low = (static_cast<unsigned int>(text[i + 2]) << 8) | text[i + 3];
+                if (low >= 0xDC00 && low < 0xE000) {
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    i += 2;
+                }
+            }
+            appendUTF8(result, code);
+        }
+        break;
+    }
+    default:;
+    }
+    size_t end = result.find('\0');
+    if (end != std::string::npos) { result.resize(end); }
+    return result;
+}
+
+FXX::TransformCache::TransformCache(size_t limit)
+    : limit(limit)
+    , created(0)
+{
+}
+
+std::shared_ptr<void> FXX::TransformCache::getTransform(const std::vector<unsigned char> &inputProfile,
+                                                        cmsUInt32Number inputFormat,
+                                                        const std::vector<unsigned char> &outputProfile,
+                                                        cmsUInt32Number outputFormat,
+                                                        FXX::RenderingIntent intent,
+                                                        bool blackpoint)
+{
+    std::ostringstream key;
+    key << std::hex << FXX::hash(inputProfile) << ":" << inputFormat << ":"
+        << FXX::hash(outputProfile) << ":" << outputFormat << ":"
+        << intent << ":" << blackpoint;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        for (auto it = transforms.begin(); it != transforms.end(); ++it) {
+            if (it->first == key.str()) {
+                transforms.splice(transforms.begin(), transforms, it);
+                return transforms.front().second;
+            }
+        }
+        // wait if another worker is already building this transform
+        if (pending.count(key.str())==0) { break; }
+        building.wait(lock);
+    }
+    pending.insert(key.str());
+    lock.unlock();
+
+    // build outside the lock, LCMS may need a while for large LUTs
+    std::shared_ptr<void> transform = FXX::createTransform(inputProfile, inputFormat,
+                                                           outputProfile, outputFormat,
+                                                           intent, blackpoint);
+
+    lock.lock();
+    pending.erase(key.str());
+    if (transform) {
+        transforms.push_front(std::make_pair(key.str(), transform));
+        while (transforms.size() > limit) { transforms.pop_back(); }
+        created++;
+    }
+    building.notify_all();
+    return transform;
+}
+
+size_t FXX::TransformCache::transformsCreated()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return created;
+}
+
+void FXX::TransformCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    transforms.clear();
+}
+
+// layers are only pinged on open, pixels are decoded when a layer is used
+FXX::LayerStore::LayerStore(const std::string &file,
+                            size_t limit)
+    : file(file)
+    , limit(limit)
+{
+    MagickCore::ImageInfo *imageInfo = MagickCore::CloneImageInfo(nullptr);
+    MagickCore::ExceptionInfo *exception = MagickCore::AcquireExceptionInfo();
+    file.copy(imageInfo->filename, std::min(file.size(), sizeof(imageInfo->filename)-1));
+    imageInfo->filename[std::min(file.size(), sizeof(imageInfo->filename)-1)] = '\0';
+    MagickCore::Image *frames = MagickCore::PingImage(imageInfo, exception);
+    size_t index = 0;
+    for (MagickCore::Image *frame = frames; frame; frame = MagickCore::GetNextImageInList(frame)) {
+        FXX::LayerInfo layer;
+        layer.index = index++;
+#if MagickLibVersion >= 0x700
+        const char *label = MagickCore::GetImageProperty(frame, "label", exception);
+#else
+        const char *label = MagickCore::GetImageProperty(frame, "label");
+#endif
+        if (label) { layer.name = label; }
+        const char *blend = MagickCore::CommandOptionToMnemonic(MagickCore::MagickComposeOptions,
+                                                                 static_cast<ssize_t>(frame->compose));
+        if (blend) { layer.blend = blend; }
+        layer.x = static_cast<long>(frame->page.x);
+        layer.y = static_cast<long>(frame->page.y);
+        layer.width = frame->columns;
+        layer.height = frame->rows;
+        info.push_back(layer);
+    }
+    if (frames) { MagickCore::DestroyImageList(frames); }
+    MagickCore::DestroyExceptionInfo(exception);
+    MagickCore::DestroyImageInfo(imageInfo);
+}
+
+size_t FXX::LayerStore::count() const
+{
+    return info.size();
+}
+
+const std::vector<FXX::LayerInfo> &FXX::LayerStore::layers() const
+{
+    return info;
+}
+
+// keep the last used layers resident
+Magick::Image FXX::LayerStore::getLayer(size_t index)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = resident.begin(); it != resident.end(); ++it) {
+            if (it->first == index) {
+                resident.splice(resident.begin(), resident, it);
+                return resident.front().second;
+            }
+        }
+    }
+    Magick::Image layer = decodeLayer(index);
+    if (layer.isValid()) {
+        std::lock_guard<std::mutex> lock(mutex);
+        resident.push_front(std::make_pair(index, layer));
+        while (resident.size() > limit) { resident.pop_back(); }
+    }
+    return layer;
+}
+
+Magick::Image FXX::LayerStore::decodeLayer(size_t index) const
+{
+    Magick::Image layer;
+    if (index >= info.size()) { return layer; }
+    try {
+        layer.subImage(index);
+        layer.subRange(1);
+        layer.read(file);
+    }
+    catch(Magick::Error &error_ ) {
+        std::cout << error_.what() << std::endl;
+        return Magick::Image();
+    }
+    catch(Magick::Warning &warn_ ) {
+        std::cout << warn_.what() << std::endl;
+    }
+    return layer;
+}
+
+// size, offset, blend mode and name of a layer without its pixels
+Magick::Image FXX::LayerStore::pingLayer(size_t index) const
+{
+    Magick::Image layer;
+    if (index >= info.size()) { return layer; }
+    try {
+        layer.subImage(index);
+        layer.subRange(1);
+        layer.ping(file);
+    }
+    catch(Magick::Error &error_ ) {
+        std::cout << error_.what() << std::endl;
+        return Magick::Image();
+    }
+    catch(Magick::Warning &warn_ ) {
+        std::cout << warn_.what() << std::endl;
+    }
+    return layer;
+}
+
+// thumbnails are kept for the lifetime of the store, made from a
+// resident layer when possible and converted to the monitor profile
+std::vector<unsigned char> FXX::LayerStore::getThumb(size_t index,
+                                                     int width,
+                                                     int height,
+                                                     const std::vector<unsigned char> &inputProfile,
+                                                     const std::vector<unsigned char> &monitorProfile,
+                                                     FXX::TransformCache *cache)
+{
+    std::ostringstream key;
+    key << index << ":" << width << "x" << height << ":" << std::hex
+        << FXX::hash(inputProfile) << ":" << FXX::hash(monitorProfile);
+
+    Magick::Image layer;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::map<std::string, std::vector<unsigned char> >::const_iterator thumb = thumbs.find(key.str());
+        if (thumb != thumbs.end()) { return thumb->second; }
+        for (auto it = resident.begin(); it != resident.end(); ++it) {
+            if (it->first == index) { layer = it->second; }
+        }
+    }
+    if (!layer.isValid()) { layer = decodeLayer(index); }
+    if (!layer.isValid()) { return std::vector<unsigned char>(); }
+
+    try {
+        layer.sample(Magick::Geometry(static_cast<size_t>(width), static_cast<size_t>(height)));
+    }
+    catch(Magick::Error &error_ ) {
+        std::cout << error_.what() << std::endl;
+        return std::vector<unsigned char>();
+    }
+    catch(Magick::Warning &warn_ ) {
+        std::cout << warn_.what() << std::endl;
+    }
+    if (inputProfile.size()>0 && monitorProfile.size()>0) {
+        std::string error;
+        if (!transformImage(layer, inputProfile, monitorProfile,
+                            FXX::PerceptualRenderingIntent, false,
+                            cache, &error)) { std::cout << error << std::endl; }
+    }
+    std::vector<unsigned char> result = generateThumb(layer, width, height);
+    if (result.size()>0) {
+        std::lock_guard<std::mutex> lock(mutex);
+        thumbs[key.str()] = result;
+    }
+    return result;
+}
+
+void FXX::LayerStore::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    resident.clear();
+}
+
+// converted results are stored as one file per key, oldest
+// (least recently used) files are removed when the cache grows too large
+FXX::ResultCache::ResultCache(const std::string &folder,
+                              unsigned long long limit)
+    : path(folder.empty()?defaultFolder():folder)
+    , limit(limit)
+    , used(0)
+    , scanned(false)
+{
+    // create missing parent folders
+    for (size_t slash = path.find_first_of("/\\", 1);; slash = path.find_first_of("/\\", slash+1)) {
+        std::string parent = path.substr(0, slash);
+#ifdef _WIN32
+        _mkdir(parent.c_str());
+#else
+        mkdir(parent.c_str(), 0700);
+#endif
+        if (slash == std::string::npos) { break; }
+    }
+}
+
+std::string FXX::ResultCache::makeKey(unsigned long long input,
+                                      const FXX::Image &settings,
+                                      const std::string &format,
+                                      int quality)
+{
+    std::ostringstream key;
+    key << std::hex << input
+        << "-" << FXX::hash(settings.iccInputBuffer)
+        << "-" << FXX::hash(settings.iccOutputBuffer)
+        << "-" << FXX::hash(settings.iccMonitorBuffer)
+        << "-" << FXX::hash(settings.iccRGB)
+        << "-" << FXX::hash(settings.iccCMYK)
+        << "-" << FXX::hash(settings.iccGRAY)
+        << std::dec << "-" << settings.intent
+        << "-" << settings.blackpoint
+        << "-" << settings.depth
+        << "-" << quality << "." << format;
+    return key.str();
+}
+
+// hidden file next to file, unique per process and thread so writers
+// sharing a folder (GUI, service, other nodes) never mix their data
+static std::string tempFile(const std::string &file)
+{
+#ifdef _WIN32
+    unsigned long process = static_cast<unsigned long>(_getpid());
+#else
+    unsigned long process = static_cast<unsigned long>(getpid());
+#endif
+    size_t slash = file.find_last_of("/\\");
+    std::string folder = slash == std::string::npos ? std::string(".") : file.substr(0, slash);
+    std::string name = slash == std::string::npos ? file : file.substr(slash+1);
+    std::ostringstream temp;
+    temp << folder << "/." << name << "." << process << "."
+         << std::hash<std::thread::id>()(std::this_thread::get_id()) << ".part";
+    return temp.str();
+}
+
+// write to a temp file and rename, a failed write never leaves a
+// partial file under the final name
+static bool writeFileAtomic(const std::string &file,
+                            const std::vector<unsigned char> &data)
+{
+    std::string temp = tempFile(file);
+    {
+        std::ofstream stream(temp.c_str(), std::ios::binary | std::ios::trunc);
+        stream.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+        if (!stream) {
+            std::remove(temp.c_str());
+            return false;
+        }
+    }
+#ifdef _WIN32
+    std::remove(file.c_str());
+#endif
+    if (std::rename(temp.c_str(), file.c_str()) != 0) {
+        std::remove(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool FXX::ResultCache::get(const std::string &key,
+                           std::vector<unsigned char> *data)
+{
+    std::string file = path + "/" + key;
+    std::ifstream stream(file.c_str(), std::ios::binary);
+    if (!stream) { return false; }
+    data->assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+    if (stream.bad() || data->size()==0) { return false; }
+    utime(file.c_str(), nullptr);
+    return true;
+}
+
+bool FXX::ResultCache::put(const std::string &key,
+                           const std::vector<unsigned char> &data)
+{
+    if (data.size()==0) { return false; }
+
+    // other processes may share the folder
+    if (!writeFileAtomic(path + "/" + key, data)) { return false; }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    used += data.size();
+    if (!scanned || used > limit) { trim(); }
+    return true;
+}
+
+bool FXX::ResultCache::getFile(const std::string &key,
+                               const std::string &file)
+{
+    std::vector<unsigned char> data;
+    if (!get(key, &data)) { return false; }
+    return writeFileAtomic(file, data);
+}
+
+bool FXX::ResultCache::putFile(const std::string &key,
+                               const std::string &file)
+{
+    std::ifstream stream(file.c_str(), std::ios::binary);
+    if (!stream) { return false; }
+    std::vector<unsigned char> data((std::istreambuf_iterator<char>(stream)),
+                                    std::istreambuf_iterator<char>());
+    return put(key, data);
+}
+
+const std::string &FXX::ResultCache::folder() const
+{
+    return path;
+}
+
+std::string FXX::ResultCache::defaultFolder()
+{
+    std::string folder;
+#ifdef _WIN32
+    const char *cache = std::getenv("LOCALAPPDATA");
+    if (cache) { folder = cache; }
+#else
+    const char *cache = std::getenv("XDG_CACHE_HOME");
+    const char *home = std::getenv("HOME");
+    if (cache && cache[0] != '\0') { folder = cache; }
+    else if (home) { folder = std::string(home) + "/.cache"; }
+#endif
+    if (folder.empty()) { folder = "."; }
+    return folder + "/Cyan/results";
+}
+
+// must be called with the mutex locked
+void FXX::ResultCache::trim()
+{
+    std::vector<std::pair<long long, std::pair<std::string, unsigned long long> > > entries;
+    unsigned long long total = 0;
+    DIR *dir = opendir(path.c_str());
+    if (!dir) { return; }
+    while (struct dirent *entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name.empty() || name.at(0) == '.') { continue; }
+        std::string file = path + "/" + name;
+        struct stat info;
+        if (stat(file.c_str(), &info) != 0) { continue; }
+        unsigned long long size = static_cast<unsigned long long>(info.st_size);
+        entries.push_back(std::make_pair(static_cast<long long>(info.st_mtime),
+                                         std::make_pair(file, size)));
+        total += size;
+    }
+    closedir(dir);
+
+    // drop to 90% so we don't rescan on every store
+    if (total > limit) {
+        std::sort(entries.begin(), entries.end());
+        for (size_t i = 0; i < entries.size() && total > limit/10*9; ++i) {
+            if (std::remove(entries.at(i).second.first.c_str()) == 0) {
+                total -= entries.at(i).second.second;
+            }
+        }
+    }
+    used = total;
+    scanned = true;
+}
+
 FXX::FXX()
 {
     Magick::InitializeMagick(nullptr);
@@ -45,18 +605,17 @@ FXX::Image FXX::readImage(const std::string &file,
 {
     FXX::Image result;
     if (!file.empty()) {
-        std::vector<Magick::Image> layers;
         Magick::Image image;
         Magick::Blob output;
         Magick::Blob preview;
         try {
             if (readLayers) {
-                Magick::readImages(&layers, file.c_str());
-                image = layers[0];
-                //layers.erase(layers.begin());
-            } else {
-                image.read(file.c_str());
+                // only decode the first frame, layers are decoded on demand
+                result.layerStore = std::make_shared<FXX::LayerStore>(file);
+                image.subImage(0);
+                image.subRange(1);
             }
+            image.read(file.c_str());
             if (image.format() == "Adobe Photoshop bitmap") {
                 result.isPSD = true;
             }
@@ -73,14 +632,6 @@ FXX::Image FXX::readImage(const std::string &file,
             // get colorspace
             result.colorspace = readImageColorspaceType(image);
 
-            // get image layers
-            if (layers.size()>0) {
-                /*for (unsigned long i=0;i<layers.size();++i) {
-                    layers[i].magick("MIFF");
-                }*/
-                result.layers = layers;
-            }
-
             // get image channels
             result.channels = readImageChannelCount(image);
 
@@ -321,42 +872,1561 @@ FXX::Image FXX::convertImage(FXX::Image input, bool getInfo)
                 result.iccInputBuffer = input.iccInputBuffer;
             }
 
-            // write image
-            result.filename = input.filename;
-            Magick::Blob output;
-            image.write(&output);
-            unsigned char *imgBuffer = reinterpret_cast<unsigned char*>(const_cast<void*>(output.data()));
-            std::vector<unsigned char> imgData(imgBuffer, imgBuffer + output.length());
-            result.imageBuffer = imgData;
+            // write image
+            result.filename = input.filename;
+            Magick::Blob output;
+            image.write(&output);
+            unsigned char *imgBuffer = reinterpret_cast<unsigned char*>(const_cast<void*>(output.data()));
+            std::vector<unsigned char> imgData(imgBuffer, imgBuffer + output.length());
+            result.imageBuffer = imgData;
+
+            // make preview
+            Magick::Blob preview;
+            if (input.iccMonitorBuffer.size()>0) {
+                // apply monitor color profile (if any)
+                Magick::Blob monitorProfile(input.iccMonitorBuffer.data(),
+                                            input.iccMonitorBuffer.size());
+                image.profile("ICC", monitorProfile);
+            }
+            if (image.depth()>8) { image.depth(8); }
+            image.magick("BMP");
+            image.write(&preview);
+            unsigned char *preBuffer = reinterpret_cast<unsigned char*>(const_cast<void*>(preview.data()));
+            std::vector<unsigned char> preData(preBuffer, preBuffer + preview.length());
+            result.previewBuffer = preData;
+
+            // get image stats
+            if (getInfo) {
+                result.info = identify(result.imageBuffer);
+            }
+        }
+        catch(Magick::Error &error_ ) {
+            result.error.append(error_.what());
+        }
+        catch(Magick::Warning &warn_ ) {
+            result.warning.append(warn_.what());
+        }
+    } else {
+        result.error.append("Missing image or ICC profiles, unable to convert.");
+    }
+    return result;
+}
+
+// create image from 16-bit pixels, keeping properties, metadata and
+// layer attributes from meta and replacing the color profile
+static Magick::Image buildImage(const Magick::Image &meta,
+                                size_t width,
+                                size_t height,
+                                const std::string &map,
+                                const std::vector<unsigned short> &pixels,
+                                const std::vector<unsigned char> &profile)
+{
+    Magick::Image image(width, height, map, Magick::ShortPixel, pixels.data());
+    image.modifyImage();
+    MagickCore::CloneImageProperties(image.image(), meta.constImage());
+    MagickCore::CloneImageArtifacts(image.image(), meta.constImage());
+    MagickCore::CloneImageProfiles(image.image(), meta.constImage());
+    image.page(meta.page());
+    image.compose(meta.compose());
+    image.depth(meta.depth());
+    image.magick(meta.magick());
+
+    image.profile("ICC", Magick::Blob());
+    image.profile("ICM", Magick::Blob());
+    if (profile.size()>0) {
+        Magick::Blob blob(profile.data(), profile.size());
+        image.profile("ICC", blob);
+    }
+    return image;
+}
+
+// transform exported 16-bit source pixels into a new image
+static bool renderImage(const Magick::Image &source,
+                        const std::vector<unsigned short> &pixels,
+                        FXX::ColorSpace inputColorSpace,
+                        bool alpha,
+                        const std::vector<unsigned char> &inputProfile,
+                        const std::vector<unsigned char> &outputProfile,
+                        FXX::RenderingIntent intent,
+                        bool blackpoint,
+                        FXX::TransformCache *cache,
+                        Magick::Image *result,
+                        std::string *error)
+{
+    FXX::ColorSpace outputColorSpace = FXX::getProfileInfo(outputProfile).colorspace;
+    if (FXX::getColorSpaceChannels(outputColorSpace) == 0) {
+        if (error) { error->append("Unsupported color profile."); }
+        return false;
+    }
+
+    size_t width = source.columns();
+    size_t height = source.rows();
+    size_t inputChannels = static_cast<size_t>(FXX::getColorSpaceChannels(inputColorSpace) + (alpha?1:0));
+    size_t outputChannels = static_cast<size_t>(FXX::getColorSpaceChannels(outputColorSpace) + (alpha?1:0));
+
+    std::shared_ptr<void> transform;
+    if (cache) {
+        transform = cache->getTransform(inputProfile, FXX::getPixelFormat(inputColorSpace, alpha),
+                                        outputProfile, FXX::getPixelFormat(outputColorSpace, alpha),
+                                        intent, blackpoint);
+    } else {
+        transform = FXX::createTransform(inputProfile, FXX::getPixelFormat(inputColorSpace, alpha),
+                                         outputProfile, FXX::getPixelFormat(outputColorSpace, alpha),
+                                         intent, blackpoint);
+    }
+    if (!transform) {
+        if (error) { error->append("Unable to create color transform."); }
+        return false;
+    }
+
+    try {
+        std::vector<unsigned short> destination(width * height * outputChannels);
+        auto transformRows = [&](size_t first, size_t last) {
+            for (size_t y = first; y < last; ++y) {
+                cmsDoTransform(transform.get(),
+                               &pixels[y * width * inputChannels],
+                               &destination[y * width * outputChannels],
+                               static_cast<cmsUInt32Number>(width));
+            }
+        };
+        size_t threads = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), height/64));
+        std::vector<std::thread> workers;
+        size_t rows = (height + threads - 1) / threads;
+        for (size_t i = 1; i < threads; ++i) {
+            workers.push_back(std::thread(transformRows, std::min(height, i * rows), std::min(height, (i+1) * rows)));
+        }
+        transformRows(0, std::min(height, rows));
+        for (size_t i = 0; i < workers.size(); ++i) { workers[i].join(); }
+        if (alpha) {
+            for (size_t i = 0; i < width * height; ++i) {
+                destination[i * outputChannels + outputChannels - 1] = pixels[i * inputChannels + inputChannels - 1];
+            }
+        }
+
+        *result = buildImage(source, width, height,
+                             FXX::getPixelMap(outputColorSpace, alpha),
+                             destination, outputProfile);
+    }
+    catch(Magick::Error &error_ ) {
+        if (error) { error->append(error_.what()); }
+        return false;
+    }
+    catch(Magick::Warning &warn_ ) {
+        std::cout << warn_.what() << std::endl;
+    }
+    return true;
+}
+
+// export source pixels once for one or more transforms
+static bool exportImage(const Magick::Image &image,
+                        const std::vector<unsigned char> &inputProfile,
+                        FXX::ColorSpace *colorspace,
+                        bool *alpha,
+                        std::vector<unsigned short> *pixels,
+                        std::string *error)
+{
+    *colorspace = FXX::getProfileInfo(inputProfile).colorspace;
+    if (FXX::getColorSpaceChannels(*colorspace) == 0) {
+        if (error) { error->append("Unsupported color profile."); }
+        return false;
+    }
+    if ((*colorspace == FXX::CMYKColorSpace) !=
+        (FXX::readImageColorspaceType(image) == FXX::CMYKColorSpace))
+    {
+        if (error) { error->append("Input profile does not match image color space."); }
+        return false;
+    }
+
+    try {
+        *alpha = FXX::hasAlpha(image);
+        size_t channels = static_cast<size_t>(FXX::getColorSpaceChannels(*colorspace) + (*alpha?1:0));
+        pixels->resize(image.columns() * image.rows() * channels);
+        Magick::Image source = image;
+        source.write(0, 0, image.columns(), image.rows(),
+                     FXX::getPixelMap(*colorspace, *alpha),
+                     Magick::ShortPixel, pixels->data());
+    }
+    catch(Magick::Error &error_ ) {
+        if (error) { error->append(error_.what()); }
+        return false;
+    }
+    catch(Magick::Warning &warn_ ) {
+        std::cout << warn_.what() << std::endl;
+    }
+    return true;
+}
+
+// input to PCS only when the input side changed, the caller resets
+// pcs when the image itself changes
+static bool updatePCS(const FXX::Image &input,
+                      std::shared_ptr<FXX::PCSImage> pcs,
+                      FXX::TransformCache *cache,
+                      FXX::Image *result)
+{
+    if (pcs->lab.size()>0 &&
+        pcs->profile == input.iccInputBuffer &&
+        pcs->intent == input.intent &&
+        pcs->blackpoint == input.blackpoint) { return true; }
+
+    Magick::Image image;
+    try {
+        Magick::Blob tmp(input.imageBuffer.data(),
+                         input.imageBuffer.size());
+        image.read(tmp);
+    }
+    catch(Magick::Error &error_ ) {
+        result->error.append(error_.what());
+        return false;
+    }
+    catch(Magick::Warning &warn_ ) {
+        result->warning.append(warn_.what());
+    }
+
+    FXX::ColorSpace inputColorSpace;
+    bool alpha;
+    std::vector<unsigned short> pixels;
+    if (!exportImage(image, input.iccInputBuffer, &inputColorSpace, &alpha, &pixels, &result->error)) { return false; }
+    std::shared_ptr<void> transform = cache->getTransform(input.iccInputBuffer,
+                                                          FXX::getPixelFormat(inputColorSpace, alpha),
+                                                          FXX::getLabProfile(),
+                                                          TYPE_Lab_FLT,
+                                                          input.intent,
+                                                          input.blackpoint);
+    if (!transform) {
+        result->error.append("Unable to create color transform.");
+        return false;
+    }
+
+    size_t width = image.columns();
+    size_t height = image.rows();
+    size_t channels = static_cast<size_t>(FXX::getColorSpaceChannels(inputColorSpace) + (alpha?1:0));
+    pcs->lab.resize(width * height * 3);
+    for (size_t y = 0; y < height; ++y) {
+        cmsDoTransform(transform.get(),
+                       &pixels[y * width * channels],
+                       &pcs->lab[y * width * 3],
+                       static_cast<cmsUInt32Number>(width));
+    }
+    pcs->alphaChannel.clear();
+    if (alpha) {
+        pcs->alphaChannel.resize(width * height);
+        for (size_t i = 0; i < width * height; ++i) { pcs->alphaChannel[i] = pixels[i * channels + channels - 1]; }
+    }
+
+    // only keep a 1x1 copy for properties and metadata
+    Magick::Image meta = image;
+    meta.crop(Magick::Geometry(1, 1));
+    meta.page(image.page());
+    pcs->meta = meta;
+    pcs->width = width;
+    pcs->height = height;
+    pcs->alpha = alpha;
+    pcs->profile = input.iccInputBuffer;
+    pcs->intent = input.intent;
+    pcs->blackpoint = input.blackpoint;
+    return true;
+}
+
+FXX::Image FXX::convertImage(FXX::Image input,
+                             std::shared_ptr<FXX::PCSImage> pcs,
+                             FXX::TransformCache *cache,
+                             bool getInfo)
+{
+    if (!pcs || !cache ||
+        input.imageBuffer.size()==0 ||
+        input.iccInputBuffer.size()==0 ||
+        input.iccOutputBuffer.size()==0) { return convertImage(input, getInfo); }
+
+    FXX::Image result;
+    std::string error;
+    const std::vector<unsigned char> &labProfile = getLabProfile();
+    FXX::ColorSpace outputColorSpace = getProfileInfo(input.iccOutputBuffer).colorspace;
+    if (labProfile.size()==0 || getColorSpaceChannels(outputColorSpace)==0) { return convertImage(input, getInfo); }
+
+    if (!updatePCS(input, pcs, cache, &result)) { return result; }
+
+    // PCS to output
+    std::shared_ptr<void> transform = cache->getTransform(labProfile,
+                                                          TYPE_Lab_FLT,
+                                                          input.iccOutputBuffer,
+                                                          getPixelFormat(outputColorSpace),
+                                                          input.intent,
+                                                          input.blackpoint);
+    if (!transform) {
+        result.error.append("Unable to create color transform.");
+        return result;
+    }
+    size_t width = pcs->width;
+    size_t height = pcs->height;
+    size_t colorChannels = static_cast<size_t>(getColorSpaceChannels(outputColorSpace));
+    size_t channels = colorChannels + (pcs->alpha?1:0);
+    std::vector<unsigned short> color(width * height * colorChannels);
+    for (size_t y = 0; y < height; ++y) {
+        cmsDoTransform(transform.get(),
+                       &pcs->lab[y * width * 3],
+                       &color[y * width * colorChannels],
+                       static_cast<cmsUInt32Number>(width));
+    }
+    std::vector<unsigned short> pixels;
+    if (pcs->alpha) {
+        pixels.resize(width * height * channels);
+        for (size_t i = 0; i < width * height; ++i) {
+            std::copy(&color[i * colorChannels], &color[i * colorChannels] + colorChannels, &pixels[i * channels]);
+            pixels[i * channels + colorChannels] = pcs->alphaChannel[i];
+        }
+    } else {
+        pixels.swap(color);
+    }
+
+    try {
+        Magick::Image image = buildImage(pcs->meta, width, height,
+                                         getPixelMap(outputColorSpace, pcs->alpha),
+                                         pixels, input.iccOutputBuffer);
+        if (input.depth>0) { image.depth(input.depth); }
+        result.iccInputBuffer = input.iccOutputBuffer;
+        result.filename = input.filename;
+
+        // write image
+        Magick::Blob output;
+        image.magick("MIFF");
+        image.write(&output);
+        unsigned char *imgBuffer = reinterpret_cast<unsigned char*>(const_cast<void*>(output.data()));
+        result.imageBuffer = std::vector<unsigned char>(imgBuffer, imgBuffer + output.length());
+
+        // make preview, output to monitor (if any)
+        if (input.iccMonitorBuffer.size()>0) {
+            FXX::ColorSpace monitorColorSpace = getProfileInfo(input.iccMonitorBuffer).colorspace;
+            std::shared_ptr<void> monitor = cache->getTransform(input.iccOutputBuffer,
+                                                                getPixelFormat(outputColorSpace, pcs->alpha),
+                                                                input.iccMonitorBuffer,
+                                                                getPixelFormat(monitorColorSpace, pcs->alpha),
+                                                                input.intent,
+                                                                input.blackpoint);
+            if (monitor) {
+                size_t monitorChannels = static_cast<size_t>(getColorSpaceChannels(monitorColorSpace)) + (pcs->alpha?1:0);
+                std::vector<unsigned short> monitorPixels(width * height * monitorChannels);
+                for (size_t y = 0; y < height; ++y) {
+                    cmsDoTransform(monitor.get(),
+                                   &pixels[y * width * channels],
+                                   &monitorPixels[y * width * monitorChannels],
+                                   static_cast<cmsUInt32Number>(width));
+                }
+                if (pcs->alpha) {
+                    for (size_t i = 0; i < width * height; ++i) {
+                        monitorPixels[i * monitorChannels + monitorChannels - 1] = pcs->alphaChannel[i];
+                    }
+                }
+                image = buildImage(pcs->meta, width, height,
+                                   getPixelMap(monitorColorSpace, pcs->alpha),
+                                   monitorPixels, input.iccMonitorBuffer);
+            }
+        }
+        Magick::Blob preview;
+        if (image.depth()>8) { image.depth(8); }
+        image.magick("BMP");
+        image.write(&preview);
+        unsigned char *preBuffer = reinterpret_cast<unsigned char*>(const_cast<void*>(preview.data()));
+        result.previewBuffer = std::vector<unsigned char>(preBuffer, preBuffer + preview.length());
+
+        // get image stats
+        if (getInfo) {
+            result.info = identify(result.imageBuffer);
+        }
+    }
+    catch(Magick::Error &error_ ) {
+        result.error.append(error_.what());
+    }
+    catch(Magick::Warning &warn_ ) {
+        result.warning.append(warn_.what());
+    }
+    return result;
+}
+
+// convert part of the image for display, every step'th pixel of the
+// region is sampled, uses the PCS image if there is one
+FXX::Image FXX::convertRegion(FXX::Image input,
+                              std::shared_ptr<FXX::PCSImage> pcs,
+                              FXX::TransformCache *cache,
+                              size_t x,
+                              size_t y,
+                              size_t width,
+                              size_t height,
+                              size_t step)
+{
+    FXX::Image result;
+    if (input.imageBuffer.size()==0 ||
+        input.iccInputBuffer.size()==0 ||
+        input.iccOutputBuffer.size()==0 ||
+        width==0 || height==0)
+    {
+        result.error.append("Nothing to convert.");
+        return result;
+    }
+    if (step==0) { step = 1; }
+    FXX::ColorSpace outputColorSpace = getProfileInfo(input.iccOutputBuffer).colorspace;
+    if (getColorSpaceChannels(outputColorSpace)==0) {
+        result.error.append("Unsupported color profile.");
+        return result;
+    }
+
+    try {
+        Magick::Image image;
+        const std::vector<unsigned char> &labProfile = getLabProfile();
+        if (pcs && cache && labProfile.size()>0) {
+            if (!updatePCS(input, pcs, cache, &result)) { return result; }
+            if (x>=pcs->width || y>=pcs->height) {
+                result.error.append("Region is outside the image.");
+                return result;
+            }
+            width = std::min(width, pcs->width - x);
+            height = std::min(height, pcs->height - y);
+            size_t columns = (width + step - 1) / step;
+            size_t rows = (height + step - 1) / step;
+            std::shared_ptr<void> transform = cache->getTransform(labProfile,
+                                                                  TYPE_Lab_FLT,
+                                                                  input.iccOutputBuffer,
+                                                                  getPixelFormat(outputColorSpace),
+                                                                  input.intent,
+                                                                  input.blackpoint);
+            if (!transform) {
+                result.error.append("Unable to create color transform.");
+                return result;
+            }
+            size_t colorChannels = static_cast<size_t>(getColorSpaceChannels(outputColorSpace));
+            size_t channels = colorChannels + (pcs->alpha?1:0);
+            std::vector<float> lab(columns * 3);
+            std::vector<unsigned short> color(columns * colorChannels);
+            std::vector<unsigned short> pixels(columns * rows * channels);
+            for (size_t row = 0; row < rows; ++row) {
+                size_t line = (y + row * step) * pcs->width + x;
+                for (size_t column = 0; column < columns; ++column) {
+                    const float *sample = &pcs->lab[(line + column * step) * 3];
+                    std::copy(sample, sample + 3, &lab[column * 3]);
+                }
+                cmsDoTransform(transform.get(),
+                               lab.data(),
+                               color.data(),
+                               static_cast<cmsUInt32Number>(columns));
+                for (size_t column = 0; column < columns; ++column) {
+                    unsigned short *pixel = &pixels[(row * columns + column) * channels];
+                    std::copy(&color[column * colorChannels], &color[column * colorChannels] + colorChannels, pixel);
+                    if (pcs->alpha) { pixel[colorChannels] = pcs->alphaChannel[line + column * step]; }
+                }
+            }
+            image = buildImage(pcs->meta, columns, rows,
+                               getPixelMap(outputColorSpace, pcs->alpha),
+                               pixels, input.iccOutputBuffer);
+        } else {
+            // no PCS, crop and sample the source before converting
+            Magick::Blob tmp(input.imageBuffer.data(),
+                             input.imageBuffer.size());
+            image.read(tmp);
+            if (x>=image.columns() || y>=image.rows()) {
+                result.error.append("Region is outside the image.");
+                return result;
+            }
+            width = std::min(width, image.columns() - x);
+            height = std::min(height, image.rows() - y);
+            image.crop(Magick::Geometry(width, height, static_cast<ssize_t>(x), static_cast<ssize_t>(y)));
+            image.page(Magick::Geometry(0, 0, 0, 0));
+            if (step>1) {
+                Magick::Geometry size((width + step - 1) / step, (height + step - 1) / step);
+                size.aspect(true);
+                image.sample(size);
+            }
+            if (!transformImage(image,
+                                input.iccInputBuffer,
+                                input.iccOutputBuffer,
+                                input.intent,
+                                input.blackpoint,
+                                cache,
+                                &result.error)) { return result; }
+        }
+
+        // output to monitor (if any)
+        if (input.iccMonitorBuffer.size()>0 &&
+            !transformImage(image,
+                            input.iccOutputBuffer,
+                            input.iccMonitorBuffer,
+                            input.intent,
+                            input.blackpoint,
+                            cache,
+                            &result.error)) { return result; }
+
+        Magick::Blob preview;
+        if (image.depth()>8) { image.depth(8); }
+        image.magick("BMP");
+        image.write(&preview);
+        unsigned char *preBuffer = reinterpret_cast<unsigned char*>(const_cast<void*>(preview.data()));
+        result.previewBuffer = std::vector<unsigned char>(preBuffer, preBuffer + preview.length());
+        result.width = image.columns();
+        result.height = image.rows();
+    }
+    catch(Magick::Error &error_ ) {
+        result.error.append(error_.what());
+    }
+    catch(Magick::Warning &warn_ ) {
+        result.warning.append(warn_.what());
+    }
+    return result;
+}
+
+bool FXX::transformImage(Magick::Image &image,
+                         const std::vector<unsigned char> &inputProfile,
+                         const std::vector<unsigned char> &outputProfile,
+                         FXX::RenderingIntent intent,
+                         bool blackpoint,
+                         FXX::TransformCache *cache,
+                         std::string *error)
+{
+    FXX::ColorSpace inputColorSpace;
+    bool alpha;
+    std::vector<unsigned short> pixels;
+    if (!exportImage(image, inputProfile, &inputColorSpace, &alpha, &pixels, error)) { return false; }
+
+    Magick::Image converted;
+    if (!renderImage(image, pixels, inputColorSpace, alpha,
+                     inputProfile, outputProfile,
+                     intent, blackpoint, cache,
+                     &converted, error)) { return false; }
+    image = converted;
+    return true;
+}
+
+bool FXX::transformPixels(const void *input,
+                          void *output,
+                          size_t width,
+                          size_t height,
+                          size_t depth,
+                          bool alpha,
+                          const std::vector<unsigned char> &inputProfile,
+                          const std::vector<unsigned char> &outputProfile,
+                          const std::vector<unsigned char> &proofProfile,
+                          FXX::RenderingIntent intent,
+                          bool blackpoint,
+                          FXX::TransformCache *cache,
+                          std::string *error)
+{
+    bool proof = proofProfile.size()>0;
+    FXX::ColorSpace inputColorSpace = getProfileInfo(inputProfile).colorspace;
+    FXX::ColorSpace outputColorSpace = getProfileInfo(outputProfile).colorspace;
+    FXX::ColorSpace proofColorSpace = proof?getProfileInfo(proofProfile).colorspace:outputColorSpace;
+    if (getColorSpaceChannels(inputColorSpace) == 0 ||
+        getColorSpaceChannels(outputColorSpace) == 0 ||
+        getColorSpaceChannels(proofColorSpace) == 0 ||
+        (depth != 8 && depth != 16))
+    {
+        if (error) { error->append("Unsupported color profile or depth."); }
+        return false;
+    }
+
+    // the proof leg always goes through 16-bit and relative colorimetric
+    std::vector<std::shared_ptr<void> > transforms;
+    cmsUInt32Number inputFormat = getPixelFormat(inputColorSpace, false, depth);
+    cmsUInt32Number outputFormat = getPixelFormat(outputColorSpace, false, proof?16:depth);
+    if (cache) {
+        transforms.push_back(cache->getTransform(inputProfile, inputFormat,
+                                                 outputProfile, outputFormat,
+                                                 intent, blackpoint));
+        if (proof) {
+            transforms.push_back(cache->getTransform(outputProfile, outputFormat,
+                                                     proofProfile, getPixelFormat(proofColorSpace, false, depth),
+                                                     FXX::RelativeRenderingIntent, blackpoint));
+        }
+    } else {
+        transforms.push_back(createTransform(inputProfile, inputFormat,
+                                             outputProfile, outputFormat,
+                                             intent, blackpoint));
+        if (proof) {
+            transforms.push_back(createTransform(outputProfile, outputFormat,
+                                                 proofProfile, getPixelFormat(proofColorSpace, false, depth),
+                                                 FXX::RelativeRenderingIntent, blackpoint));
+        }
+    }
+    for (size_t i = 0; i < transforms.size(); ++i) {
+        if (!transforms.at(i)) {
+            if (error) { error->append("Unable to create color transform."); }
+            return false;
+        }
+    }
+
+    size_t bytes = depth/8;
+    size_t inputChannels = static_cast<size_t>(getColorSpaceChannels(inputColorSpace)) + (alpha?1:0);
+    size_t outputChannels = static_cast<size_t>(getColorSpaceChannels(proofColorSpace)) + (alpha?1:0);
+    size_t inputStride = width * inputChannels * bytes;
+    size_t outputStride = width * outputChannels * bytes;
+    const unsigned char *source = static_cast<const unsigned char*>(input);
+    unsigned char *destination = static_cast<unsigned char*>(output);
+
+    // lcms transforms are safe to share between threads, split on rows
+    auto transformRows = [&](size_t first, size_t last) {
+        std::vector<unsigned char> pixels;
+        std::vector<unsigned short> proofPixels;
+        if (alpha) { pixels.resize(width * static_cast<size_t>(getColorSpaceChannels(inputColorSpace)) * bytes); }
+        if (proof) { proofPixels.resize(width * static_cast<size_t>(getColorSpaceChannels(outputColorSpace))); }
+        std::vector<unsigned char> result;
+        if (alpha) { result.resize(width * static_cast<size_t>(getColorSpaceChannels(proofColorSpace)) * bytes); }
+        for (size_t y = first; y < last; ++y) {
+            const unsigned char *row = source + y * inputStride;
+            unsigned char *outputRow = destination + y * outputStride;
+            if (alpha) {
+                // pack color channels, lcms does not copy extra channels
+                size_t color = (inputChannels - 1) * bytes;
+                for (size_t x = 0; x < width; ++x) {
+                    std::memcpy(&pixels[x * color], row + x * inputChannels * bytes, color);
+                }
+                row = pixels.data();
+            }
+            unsigned char *target = alpha?result.data():outputRow;
+            if (proof) {
+                cmsDoTransform(transforms.at(0).get(), row, proofPixels.data(), static_cast<cmsUInt32Number>(width));
+                cmsDoTransform(transforms.at(1).get(), proofPixels.data(), target, static_cast<cmsUInt32Number>(width));
+            } else {
+                cmsDoTransform(transforms.at(0).get(), row, target, static_cast<cmsUInt32Number>(width));
+            }
+            if (alpha) {
+                size_t color = (outputChannels - 1) * bytes;
+                const unsigned char *inputRow = source + y * inputStride;
+                for (size_t x = 0; x < width; ++x) {
+                    std::memcpy(outputRow + x * outputChannels * bytes, &result[x * color], color);
+                    std::memcpy(outputRow + x * outputChannels * bytes + color,
+                                inputRow + (x * inputChannels + inputChannels - 1) * bytes, bytes);
+                }
+            }
+        }
+    };
+
+    size_t threads = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), height/64));
+    std::vector<std::thread> workers;
+    size_t rows = (height + threads - 1) / threads;
+    for (size_t i = 1; i < threads; ++i) {
+        workers.push_back(std::thread(transformRows, std::min(height, i * rows), std::min(height, (i+1) * rows)));
+    }
+    transformRows(0, std::min(height, rows));
+    for (size_t i = 0; i < workers.size(); ++i) { workers[i].join(); }
+
+    return true;
+}
+
+FXX::Image FXX::convertFile(const std::string &input,
+                            const std::string &output,
+                            const FXX::Image &settings,
+                            FXX::TransformCache *cache,
+                            int quality)
+{
+    FXX::Target target;
+    target.filename = output;
+    target.profile = settings.iccOutputBuffer;
+    target.intent = settings.intent;
+    target.blackpoint = settings.blackpoint;
+    target.depth = settings.depth;
+    target.quality = quality;
+    target.inkLimit = settings.inkLimit;
+    target.deltaELimit = settings.deltaELimit;
+    return convertFile(input, std::vector<FXX::Target>(1, target), settings, cache).at(0);
+}
+
+std::vector<FXX::Image> FXX::convertFile(const std::string &input,
+                                         const std::vector<FXX::Target> &targets,
+                                         const FXX::Image &settings,
+                                         FXX::TransformCache *cache)
+{
+    std::vector<FXX::Image> results(targets.size());
+    for (size_t i = 0; i < targets.size(); ++i) { results[i].filename = targets.at(i).filename; }
+    auto failed = [&results](const std::string &error) {
+        for (size_t i = 0; i < results.size(); ++i) { results[i].error.append(error); }
+        return results;
+    };
+
+    for (size_t i = 0; i < targets.size(); ++i) {
+        if (input.empty() || targets.at(i).filename.empty() || targets.at(i).profile.size()==0) {
+            return failed("Missing input, output or output profile, unable to convert.");
+        }
+    }
+
+    // decode and export source pixels once for all targets
+    Magick::Image image;
+    std::string warning;
+    try {
+        image.read(input);
+    }
+    catch(Magick::Error &error_ ) {
+        return failed(error_.what());
+    }
+    catch(Magick::Warning &warn_ ) {
+        warning = warn_.what();
+    }
+
+    // input override, embedded or fallback profile
+    std::vector<unsigned char> inputProfile = settings.iccInputBuffer;
+    if (inputProfile.size()==0) {
+        inputProfile = readImageColorProfile(image, settings);
+    }
+    if (inputProfile.size()==0) { return failed("No input profile!"); }
+
+    FXX::ColorSpace inputColorSpace;
+    bool alpha;
+    std::vector<unsigned short> pixels;
+    std::string error;
+    if (!exportImage(image, inputProfile, &inputColorSpace, &alpha, &pixels, &error)) { return failed(error); }
+
+    auto convertTarget = [&](size_t index) {
+        const FXX::Target &target = targets.at(index);
+        FXX::Image &result = results[index];
+        result.warning = warning;
+        Magick::Image converted;
+        if (!renderImage(image, pixels, inputColorSpace, alpha,
+                         inputProfile, target.profile,
+                         target.intent, target.blackpoint, cache,
+                         &converted, &result.error)) { return; }
+        try {
+            if (target.depth>0) { converted.depth(target.depth); }
+            converted.quality(static_cast<size_t>(target.quality));
+            result.width = converted.columns();
+            result.height = converted.rows();
+            result.depth = converted.depth();
+            result.channels = readImageChannelCount(converted);
+            result.colorspace = readImageColorspaceType(converted);
+            result.iccInputBuffer = target.profile;
+            result.inkLimit = target.inkLimit;
+            if (target.inkLimit>0.0 && result.colorspace == FXX::CMYKColorSpace) {
+                result.tac = getTAC(converted, target.inkLimit);
+                result.warning.append(getTACWarning(result.tac));
+            }
+            // round trip check, fails the output if 5% of the pixels are
+            // further than the limit from the source
+            result.deltaELimit = target.deltaELimit;
+            if (target.deltaELimit>0.0) {
+                FXX::ColorSpace outputColorSpace;
+                bool outputAlpha;
+                std::vector<unsigned short> outputPixels;
+                if (exportImage(converted, target.profile, &outputColorSpace, &outputAlpha, &outputPixels, &result.error)) {
+                    result.deltaE = getDeltaE(pixels,
+                                              static_cast<size_t>(getColorSpaceChannels(inputColorSpace) + (alpha?1:0)),
+                                              inputColorSpace,
+                                              inputProfile,
+                                              outputPixels,
+                                              static_cast<size_t>(getColorSpaceChannels(outputColorSpace) + (outputAlpha?1:0)),
+                                              outputColorSpace,
+                                              target.profile,
+                                              result.width,
+                                              result.height,
+                                              target.deltaELimit,
+                                              cache);
+                    if (result.deltaE.pixels==0) {
+                        result.error.append("Unable to compare output with source.");
+                    } else if (result.deltaE.p95 > target.deltaELimit) {
+                        std::ostringstream message;
+                        message << "Round trip Delta E 2000 p95 " << result.deltaE.p95
+                                << " exceeds limit " << target.deltaELimit
+                                << " (mean " << result.deltaE.mean << ", max " << result.deltaE.max << ").";
+                        result.error.append(message.str());
+                    }
+                }
+            }
+
+            // only outputs that pass the checks end up under their name,
+            // written to a temp file and renamed so none is ever partial
+            if (!result.error.empty()) { return; }
+            std::string temp = tempFile(target.filename);
+            size_t dot = target.filename.find_last_of('.');
+            size_t slash = target.filename.find_last_of("/\\");
+            std::string format;
+            if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+                format = target.filename.substr(dot+1) + ":";
+            }
+            try {
+                converted.write(format + temp);
+            }
+            catch(Magick::Error &error_ ) {
+                std::remove(temp.c_str());
+                throw;
+            }
+            catch(Magick::Warning &warn_ ) {
+                result.warning.append(warn_.what());
+            }
+            result.format = converted.format();
+#ifdef _WIN32
+            std::remove(target.filename.c_str());
+#endif
+            if (std::rename(temp.c_str(), target.filename.c_str()) != 0) {
+                std::remove(temp.c_str());
+                result.error.append("Unable to write " + target.filename);
+            }
+        }
+        catch(Magick::Error &error_ ) {
+            result.error.append(error_.what());
+        }
+        catch(Magick::Warning &warn_ ) {
+            result.warning.append(warn_.what());
+        }
+    };
+
+    // one thread per extra target, the source pixels are shared
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < targets.size(); ++i) { threads.push_back(std::thread(convertTarget, i)); }
+    if (targets.size()>0) { convertTarget(0); }
+    for (size_t i = 0; i < threads.size(); ++i) { threads[i].join(); }
+
+    return results;
+}
+
+// previews of the same image with different output settings for side
+// by side viewing, a target without a profile shows the source
+std::vector<FXX::Image> FXX::convertVariants(const FXX::Image &input,
+                                             const std::vector<FXX::Target> &variants,
+                                             FXX::TransformCache *cache)
+{
+    std::vector<FXX::Image> results(variants.size());
+    auto failed = [&results](const std::string &error) {
+        for (size_t i = 0; i < results.size(); ++i) { results[i].error.append(error); }
+        return results;
+    };
+    if (input.imageBuffer.size()==0 || input.iccInputBuffer.size()==0) {
+        return failed("Missing image or input profile, unable to convert.");
+    }
+
+    // decode and export source pixels once for all variants
+    Magick::Image image;
+    std::string warning;
+    try {
+        Magick::Blob tmp(input.imageBuffer.data(),
+                         input.imageBuffer.size());
+        image.read(tmp);
+    }
+    catch(Magick::Error &error_ ) {
+        return failed(error_.what());
+    }
+    catch(Magick::Warning &warn_ ) {
+        warning = warn_.what();
+    }
+
+    FXX::ColorSpace inputColorSpace;
+    bool alpha;
+    std::vector<unsigned short> pixels;
+    std::string error;
+    if (!exportImage(image, input.iccInputBuffer, &inputColorSpace, &alpha, &pixels, &error)) { return failed(error); }
+
+    auto convertVariant = [&](size_t index) {
+        const FXX::Target &variant = variants.at(index);
+        FXX::Image &result = results[index];
+        result.warning = warning;
+        result.intent = variant.intent;
+        result.blackpoint = variant.blackpoint;
+        result.iccInputBuffer = variant.profile;
+
+        // source goes straight to the monitor
+        Magick::Image converted = image;
+        const std::vector<unsigned char> &monitorProfile = input.iccMonitorBuffer;
+        if (variant.profile.size()==0) {
+            if (monitorProfile.size()>0 &&
+                !renderImage(image, pixels, inputColorSpace, alpha,
+                             input.iccInputBuffer, monitorProfile,
+                             variant.intent, variant.blackpoint, cache,
+                             &converted, &result.error)) { return; }
+        } else {
+            if (!renderImage(image, pixels, inputColorSpace, alpha,
+                             input.iccInputBuffer, variant.profile,
+                             variant.intent, variant.blackpoint, cache,
+                             &converted, &result.error)) { return; }
+            if (monitorProfile.size()>0 &&
+                !transformImage(converted, variant.profile, monitorProfile,
+                                variant.intent, variant.blackpoint,
+                                cache, &result.error)) { return; }
+        }
+
+        try {
+            Magick::Blob preview;
+            if (converted.depth()>8) { converted.depth(8); }
+            converted.magick("BMP");
+            converted.write(&preview);
+            const unsigned char *preBuffer = reinterpret_cast<const unsigned char*>(preview.data());
+            result.previewBuffer = std::vector<unsigned char>(preBuffer, preBuffer + preview.length());
+            result.width = converted.columns();
+            result.height = converted.rows();
+        }
+        catch(Magick::Error &error_ ) {
+            result.error.append(error_.what());
+        }
+        catch(Magick::Warning &warn_ ) {
+            result.warning.append(warn_.what());
+        }
+    };
+
+    // one thread per extra variant, the source pixels are shared
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < variants.size(); ++i) { threads.push_back(std::thread(convertVariant, i)); }
+    if (variants.size()>0) { convertVariant(0); }
+    for (size_t i = 0; i < threads.size(); ++i) { threads[i].join(); }
+
+    return results;
+}
+
+// decoded pixels kept around for reading single values and stats, lab
+// transforms are made once per plane, planes are shared between copies
+// and only reloaded when the buffer or profile changes
+bool FXX::PixelProbe::setSource(const std::vector<unsigned char> &buffer,
+                                const std::vector<unsigned char> &profile,
+                                std::string *error)
+{
+    return loadPlane(&sourcePlane, buffer, profile, error);
+}
+
+bool FXX::PixelProbe::setOutput(const std::vector<unsigned char> &buffer,
+                                const std::vector<unsigned char> &profile,
+                                std::string *error)
+{
+    return loadPlane(&outputPlane, buffer, profile, error);
+}
+
+size_t FXX::PixelProbe::width() const
+{
+    return sourcePlane ? sourcePlane->width : 0;
+}
+
+size_t FXX::PixelProbe::height() const
+{
+    return sourcePlane ? sourcePlane->height : 0;
+}
+
+bool FXX::PixelProbe::hasOutput() const
+{
+    return outputPlane != nullptr;
+}
+
+FXX::PixelValue FXX::PixelProbe::source(size_t x,
+                                        size_t y) const
+{
+    return readPlane(sourcePlane, x, y);
+}
+
+FXX::PixelValue FXX::PixelProbe::output(size_t x,
+                                        size_t y) const
+{
+    return readPlane(outputPlane, x, y);
+}
+
+FXX::ImageStats FXX::PixelProbe::sourceStats() const
+{
+    return sourcePlane ? sourcePlane->stats : FXX::ImageStats();
+}
+
+FXX::ImageStats FXX::PixelProbe::outputStats() const
+{
+    return outputPlane ? outputPlane->stats : FXX::ImageStats();
+}
+
+// ink coverage of CMYK output, with heatmap for display
+void FXX::PixelProbe::setInkLimit(double limit)
+{
+    inkReport = FXX::TACReport();
+    if (!outputPlane || outputPlane->colorspace != FXX::CMYKColorSpace || limit<=0.0) { return; }
+    inkReport = getTAC(outputPlane->pixels,
+                       outputPlane->width,
+                       outputPlane->height,
+                       outputPlane->channels,
+                       limit,
+                       TAC_HEATMAP_SIZE);
+}
+
+const FXX::TACReport &FXX::PixelProbe::tac() const
+{
+    return inkReport;
+}
+
+// round trip difference between source and output
+void FXX::PixelProbe::compareOutput(bool enabled,
+                                    FXX::TransformCache *cache)
+{
+    deltaEReport = FXX::DeltaEReport();
+    if (!enabled || !sourcePlane || !outputPlane ||
+        sourcePlane->width != outputPlane->width ||
+        sourcePlane->height != outputPlane->height) { return; }
+    deltaEReport = getDeltaE(sourcePlane->pixels,
+                             sourcePlane->channels,
+                             sourcePlane->colorspace,
+                             sourcePlane->profile,
+                             outputPlane->pixels,
+                             outputPlane->channels,
+                             outputPlane->colorspace,
+                             outputPlane->profile,
+                             sourcePlane->width,
+                             sourcePlane->height,
+                             0.0,
+                             cache,
+                             DELTAE_HEATMAP_SIZE);
+}
+
+const FXX::DeltaEReport &FXX::PixelProbe::deltaE() const
+{
+    return deltaEReport;
+}
+
+bool FXX::PixelProbe::loadPlane(std::shared_ptr<const FXX::PixelProbe::Plane> *plane,
+                                const std::vector<unsigned char> &buffer,
+                                const std::vector<unsigned char> &profile,
+                                std::string *error)
+{
+    if (buffer.size()==0 || profile.size()==0) {
+        plane->reset();
+        if (error) { error->append("Missing image or profile."); }
+        return false;
+    }
+    unsigned long long key = hash(profile.data(), profile.size(), hash(buffer));
+    if (*plane && (*plane)->key == key) { return true; }
+    plane->reset();
+
+    Magick::Image image;
+    try {
+        Magick::Blob tmp(buffer.data(), buffer.size());
+        image.read(tmp);
+    }
+    catch(Magick::Error &error_ ) {
+        if (error) { error->append(error_.what()); }
+        return false;
+    }
+    catch(Magick::Warning &warn_ ) {
+        std::cout << warn_.what() << std::endl;
+    }
+
+    std::shared_ptr<FXX::PixelProbe::Plane> result = std::make_shared<FXX::PixelProbe::Plane>();
+    bool alpha;
+    if (!exportImage(image, profile, &result->colorspace, &alpha, &result->pixels, error)) { return false; }
+
+    // readouts are measurements, so relative colorimetric without BPC
+    result->lab = createTransform(profile,
+                                  getPixelFormat(result->colorspace, alpha),
+                                  getLabProfile(),
+                                  TYPE_Lab_DBL,
+                                  FXX::RelativeRenderingIntent,
+                                  false);
+    if (!result->lab) {
+        if (error) { error->append("Unable to create color transform."); }
+        return false;
+    }
+
+    result->key = key;
+    result->profile = profile;
+    result->width = image.columns();
+    result->height = image.rows();
+    result->channels = static_cast<size_t>(getColorSpaceChannels(result->colorspace) + (alpha?1:0));
+    result->stats = getImageStats(result->pixels, result->channels, result->colorspace);
+    *plane = result;
+    return true;
+}
+
+FXX::PixelValue FXX::PixelProbe::readPlane(const std::shared_ptr<const FXX::PixelProbe::Plane> &plane,
+                                           size_t x,
+                                           size_t y)
+{
+    FXX::PixelValue value;
+    if (!plane || x>=plane->width || y>=plane->height) { return value; }
+    const unsigned short *pixel = &plane->pixels[(y * plane->width + x) * plane->channels];
+    for (int i = 0; i < getColorSpaceChannels(plane->colorspace); ++i) {
+        value.channels.push_back(pixel[i] / 65535.0);
+    }
+    cmsCIELab lab;
+    cmsDoTransform(plane->lab.get(), pixel, &lab, 1);
+    value.colorspace = plane->colorspace;
+    value.L = lab.L;
+    value.a = lab.a;
+    value.b = lab.b;
+    value.valid = true;
+    return value;
+}
+
+// histogram (256 bins), min, max, mean and clipping per color channel,
+// alpha is skipped. Rows are split in bands, one per thread, each with
+// its own counters that are merged at the end
+FXX::ImageStats FXX::getImageStats(const std::vector<unsigned short> &pixels,
+                                   size_t channels,
+                                   FXX::ColorSpace colorspace)
+{
+    FXX::ImageStats stats;
+    stats.colorspace = colorspace;
+    size_t colorChannels = static_cast<size_t>(getColorSpaceChannels(colorspace));
+    if (channels==0 || colorChannels==0 || colorChannels>channels) { return stats; }
+    size_t count = pixels.size() / channels;
+    stats.pixels = count;
+    stats.channels.resize(colorChannels);
+    if (count==0) { return stats; }
+
+    struct Band
+    {
+        std::vector<unsigned long long> histogram;
+        std::vector<unsigned short> min;
+        std::vector<unsigned short> max;
+        std::vector<unsigned long long> sum;
+        std::vector<unsigned long long> low;
+        std::vector<unsigned long long> high;
+    };
+    size_t workers = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), count/65536));
+    std::vector<Band> bands(workers);
+    auto measure = [&](size_t index) {
+        Band &band = bands[index];
+        band.histogram.assign(colorChannels * 256, 0);
+        band.min.assign(colorChannels, 65535);
+        band.max.assign(colorChannels, 0);
+        band.sum.assign(colorChannels, 0);
+        band.low.assign(colorChannels, 0);
+        band.high.assign(colorChannels, 0);
+        size_t start = count * index / workers;
+        size_t end = count * (index + 1) / workers;
+        for (size_t c = 0; c < colorChannels; ++c) {
+            unsigned long long *histogram = &band.histogram[c * 256];
+            unsigned short min = 65535;
+            unsigned short max = 0;
+            unsigned long long sum = 0;
+            unsigned long long low = 0;
+            unsigned long long high = 0;
+            const unsigned short *pixel = &pixels[start * channels + c];
+            for (size_t i = start; i < end; ++i, pixel += channels) {
+                unsigned short value = *pixel;
+                histogram[value >> 8]++;
+                min = std::min(min, value);
+                max = std::max(max, value);
+                sum += value;
+                low += value == 0;
+                high += value == 65535;
+            }
+            band.min[c] = min;
+            band.max[c] = max;
+            band.sum[c] = sum;
+            band.low[c] = low;
+            band.high[c] = high;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < workers; ++i) { threads.push_back(std::thread(measure, i)); }
+    measure(0);
+    for (size_t i = 0; i < threads.size(); ++i) { threads[i].join(); }
+
+    for (size_t c = 0; c < colorChannels; ++c) {
+        FXX::ChannelStats &channel = stats.channels[c];
+        channel.histogram.assign(256, 0);
+        unsigned short min = 65535;
+        unsigned short max = 0;
+        unsigned long long sum = 0;
+        for (size_t i = 0; i < workers; ++i) {
+            const Band &band = bands[i];
+            for (size_t bin = 0; bin < 256; ++bin) { channel.histogram[bin] += band.histogram[c * 256 + bin]; }
+            min = std::min(min, band.min[c]);
+            max = std::max(max, band.max[c]);
+            sum += band.sum[c];
+            channel.clippedLow += band.low[c];
+            channel.clippedHigh += band.high[c];
+        }
+        channel.min = min / 65535.0;
+        channel.max = max / 65535.0;
+        channel.mean = static_cast<double>(sum) / count / 65535.0;
+    }
+    return stats;
+}
+
+// total area coverage of CMYK pixels in percent (0-400), with max, mean,
+// percentiles and the number of pixels over limit. Rows are split in
+// bands, one per thread. If heatmapSize is set, a map no larger than
+// heatmapSize is made where each cell holds how far its worst pixel is
+// over limit (0 is under, 1-255 is over); bands always cover whole
+// cell rows so no cell is shared between threads
+FXX::TACReport FXX::getTAC(const std::vector<unsigned short> &pixels,
+                           size_t width,
+                           size_t height,
+                           size_t channels,
+                           double limit,
+                           size_t heatmapSize)
+{
+    FXX::TACReport report;
+    report.limit = limit;
+    if (channels<4 || width==0 || height==0 || pixels.size()<width * height * channels) { return report; }
+    report.pixels = width * height;
+
+    size_t cell = 1;
+    if (heatmapSize>0) {
+        while ((width + cell - 1) / cell > heatmapSize ||
+               (height + cell - 1) / cell > heatmapSize) { cell *= 2; }
+        report.heatmapWidth = (width + cell - 1) / cell;
+        report.heatmapHeight = (height + cell - 1) / cell;
+        report.heatmapCell = cell;
+        report.heatmap.assign(report.heatmapWidth * report.heatmapHeight, 0);
+    }
+
+    // sum of four 16-bit channels, 262140 is 400%
+    const unsigned int full = 4 * 65535;
+    unsigned int limitSum = static_cast<unsigned int>(std::max(0.0, std::min(400.0, limit)) * full / 400.0 + 0.5);
+    struct Band
+    {
+        std::vector<unsigned long long> histogram;
+        unsigned int max = 0;
+        unsigned long long sum = 0;
+        unsigned long long over = 0;
+    };
+    size_t cellRows = (height + cell - 1) / cell;
+    size_t workers = std::max<size_t>(1, std::min<size_t>(std::min<size_t>(std::thread::hardware_concurrency(), cellRows),
+                                                          report.pixels/65536));
+    std::vector<Band> bands(workers);
+    auto measure = [&](size_t index) {
+        Band &band = bands[index];
+        band.histogram.assign(4096, 0);
+        size_t start = std::min(height, cellRows * index / workers * cell);
+        size_t end = std::min(height, cellRows * (index + 1) / workers * cell);
+        std::vector<unsigned int> row(width);
+        for (size_t y = start; y < end; ++y) {
+            const unsigned short *pixel = &pixels[y * width * channels];
+            for (size_t x = 0; x < width; ++x, pixel += channels) {
+                row[x] = static_cast<unsigned int>(pixel[0]) + pixel[1] + pixel[2] + pixel[3];
+            }
+            unsigned char *heat = report.heatmap.size()>0 ? &report.heatmap[(y / cell) * report.heatmapWidth] : nullptr;
+            for (size_t x = 0; x < width; ++x) {
+                unsigned int total = row[x];
+                band.histogram[total >> 6]++;
+                band.max = std::max(band.max, total);
+                band.sum += total;
+                if (total <= limitSum) { continue; }
+                band.over++;
+                if (!heat) { continue; }
+                unsigned char level = static_cast<unsigned char>(1 + static_cast<unsigned long long>(total - limitSum) * 254 / std::max(1u, full - limitSum));
+                heat[x / cell] = std::max(heat[x / cell], level);
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < workers; ++i) { threads.push_back(std::thread(measure, i)); }
+    measure(0);
+    for (size_t i = 0; i < threads.size(); ++i) { threads[i].join(); }
+
+    std::vector<unsigned long long> histogram(4096, 0);
+    unsigned int max = 0;
+    unsigned long long sum = 0;
+    for (size_t i = 0; i < workers; ++i) {
+        for (size_t bin = 0; bin < histogram.size(); ++bin) { histogram[bin] += bands[i].histogram[bin]; }
+        max = std::max(max, bands[i].max);
+        sum += bands[i].sum;
+        report.over += bands[i].over;
+    }
+    report.max = max * 400.0 / full;
+    report.mean = static_cast<double>(sum) / report.pixels * 400.0 / full;
+
+    // percentiles from the histogram, bins are 64 steps (~0.1%) wide
+    auto percentile = [&](double fraction) {
+        unsigned long long wanted = static_cast<unsigned long long>(std::ceil(fraction * report.pixels));
+        unsigned long long count = 0;
+        for (size_t bin = 0; bin < histogram.size(); ++bin) {
+            count += histogram[bin];
+            if (count >= wanted) { return std::min(report.max, ((bin << 6) + 63) * 400.0 / full); }
+        }
+        return report.max;
+    };
+    report.p95 = percentile(0.95);
+    report.p99 = percentile(0.99);
+    return report;
+}
+
+FXX::TACReport FXX::getTAC(Magick::Image image,
+                           double limit,
+                           size_t heatmapSize)
+{
+    FXX::TACReport report;
+    report.limit = limit;
+    if (readImageColorspaceType(image) != FXX::CMYKColorSpace) { return report; }
+    try {
+        std::vector<unsigned short> pixels(image.columns() * image.rows() * 4);
+        image.write(0, 0, image.columns(), image.rows(),
+                    "CMYK", Magick::ShortPixel, pixels.data());
+        report = getTAC(pixels, image.columns(), image.rows(), 4, limit, heatmapSize);
+    }
+    catch(Magick::Error &error_ ) {
+        std::cout << error_.what() << std::endl;
+    }
+    catch(Magick::Warning &warn_ ) {
+        std::cout << warn_.what() << std::endl;
+    }
+    return report;
+}
+
+// warning for pixels over the ink limit, empty if none are
+std::string FXX::getTACWarning(const FXX::TACReport &report)
+{
+    if (report.over<1) { return std::string(); }
+    std::ostringstream message;
+    message << "Total ink exceeds " << report.limit << "% on "
+            << report.over << " pixels (max " << report.max << "%).";
+    return message.str();
+}
 
-            // make preview
-            Magick::Blob preview;
-            if (input.iccMonitorBuffer.size()>0) {
-                // apply monitor color profile (if any)
-                Magick::Blob monitorProfile(input.iccMonitorBuffer.data(),
-                                            input.iccMonitorBuffer.size());
-                image.profile("ICC", monitorProfile);
-            }
-            if (image.depth()>8) { image.depth(8); }
-            image.magick("BMP");
-            image.write(&preview);
-            unsigned char *preBuffer = reinterpret_cast<unsigned char*>(const_cast<void*>(preview.data()));
-            std::vector<unsigned char> preData(preBuffer, preBuffer + preview.length());
-            result.previewBuffer = preData;
+// colour difference (CIEDE2000) between two images of the same size,
+// each in its own profile, like the source and the converted output.
+// Both go to Lab relative colorimetric without BPC, a round trip
+// through the output profile. Rows are split in bands, one per thread,
+// mean and max are exact, p95 comes from a histogram in 0.01 steps.
+// If heatmapSize is set, each map cell holds the worst difference in
+// 0.1 steps (255 is 25.5 or more), bands cover whole cell rows
+FXX::DeltaEReport FXX::getDeltaE(const std::vector<unsigned short> &source,
+                                 size_t sourceChannels,
+                                 FXX::ColorSpace sourceColorSpace,
+                                 const std::vector<unsigned char> &sourceProfile,
+                                 const std::vector<unsigned short> &output,
+                                 size_t outputChannels,
+                                 FXX::ColorSpace outputColorSpace,
+                                 const std::vector<unsigned char> &outputProfile,
+                                 size_t width,
+                                 size_t height,
+                                 double limit,
+                                 FXX::TransformCache *cache,
+                                 size_t heatmapSize)
+{
+    FXX::DeltaEReport report;
+    report.limit = limit;
+    size_t sourceColor = static_cast<size_t>(getColorSpaceChannels(sourceColorSpace));
+    size_t outputColor = static_cast<size_t>(getColorSpaceChannels(outputColorSpace));
+    if (width==0 || height==0 ||
+        sourceColor==0 || sourceChannels<sourceColor ||
+        outputColor==0 || outputChannels<outputColor ||
+        source.size()<width * height * sourceChannels ||
+        output.size()<width * height * outputChannels) { return report; }
 
-            // get image stats
-            if (getInfo) {
-                result.info = identify(result.imageBuffer);
+    const std::vector<unsigned char> &labProfile = getLabProfile();
+    cmsUInt32Number sourceFormat = getPixelFormat(sourceColorSpace, sourceChannels>sourceColor);
+    cmsUInt32Number outputFormat = getPixelFormat(outputColorSpace, outputChannels>outputColor);
+    std::shared_ptr<void> sourceLab = cache ?
+        cache->getTransform(sourceProfile, sourceFormat, labProfile, TYPE_Lab_DBL, FXX::RelativeRenderingIntent, false) :
+        createTransform(sourceProfile, sourceFormat, labProfile, TYPE_Lab_DBL, FXX::RelativeRenderingIntent, false);
+    std::shared_ptr<void> outputLab = cache ?
+        cache->getTransform(outputProfile, outputFormat, labProfile, TYPE_Lab_DBL, FXX::RelativeRenderingIntent, false) :
+        createTransform(outputProfile, outputFormat, labProfile, TYPE_Lab_DBL, FXX::RelativeRenderingIntent, false);
+    if (!sourceLab || !outputLab) { return report; }
+    report.pixels = width * height;
+
+    size_t cell = 1;
+    if (heatmapSize>0) {
+        while ((width + cell - 1) / cell > heatmapSize ||
+               (height + cell - 1) / cell > heatmapSize) { cell *= 2; }
+        report.heatmapWidth = (width + cell - 1) / cell;
+        report.heatmapHeight = (height + cell - 1) / cell;
+        report.heatmapCell = cell;
+        report.heatmap.assign(report.heatmapWidth * report.heatmapHeight, 0);
+    }
+
+    struct Band
+    {
+        std::vector<unsigned long long> histogram;
+        double max = 0.0;
+        double sum = 0.0;
+        unsigned long long over = 0;
+    };
+    size_t cellRows = (height + cell - 1) / cell;
+    size_t workers = std::max<size_t>(1, std::min<size_t>(std::min<size_t>(std::thread::hardware_concurrency(), cellRows),
+                                                          report.pixels/16384));
+    std::vector<Band> bands(workers);
+    auto measure = [&](size_t index) {
+        Band &band = bands[index];
+        band.histogram.assign(10000, 0);
+        size_t start = std::min(height, cellRows * index / workers * cell);
+        size_t end = std::min(height, cellRows * (index + 1) / workers * cell);
+        std::vector<cmsCIELab> lab1(width);
+        std::vector<cmsCIELab> lab2(width);
+        for (size_t y = start; y < end; ++y) {
+            cmsDoTransform(sourceLab.get(), &source[y * width * sourceChannels], lab1.data(), static_cast<cmsUInt32Number>(width));
+            cmsDoTransform(outputLab.get(), &output[y * width * outputChannels], lab2.data(), static_cast<cmsUInt32Number>(width));
+            unsigned char *heat = report.heatmap.size()>0 ? &report.heatmap[(y / cell) * report.heatmapWidth] : nullptr;
+            for (size_t x = 0; x < width; ++x) {
+                double value = cmsCIE2000DeltaE(&lab1[x], &lab2[x], 1.0, 1.0, 1.0);
+                band.histogram[std::min<size_t>(9999, static_cast<size_t>(value * 100.0))]++;
+                band.max = std::max(band.max, value);
+                band.sum += value;
+                if (limit>0.0 && value > limit) { band.over++; }
+                if (!heat) { continue; }
+                unsigned char level = static_cast<unsigned char>(std::min(255.0, std::ceil(value * 10.0)));
+                heat[x / cell] = std::max(heat[x / cell], level);
             }
         }
-        catch(Magick::Error &error_ ) {
-            result.error.append(error_.what());
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < workers; ++i) { threads.push_back(std::thread(measure, i)); }
+    measure(0);
+    for (size_t i = 0; i < threads.size(); ++i) { threads[i].join(); }
+
+    std::vector<unsigned long long> histogram(10000, 0);
+    double sum = 0.0;
+    for (size_t i = 0; i < workers; ++i) {
+        for (size_t bin = 0; bin < histogram.size(); ++bin) { histogram[bin] += bands[i].histogram[bin]; }
+        report.max = std::max(report.max, bands[i].max);
+        sum += bands[i].sum;
+        report.over += bands[i].over;
+    }
+    report.mean = sum / report.pixels;
+
+    unsigned long long wanted = static_cast<unsigned long long>(std::ceil(0.95 * report.pixels));
+    unsigned long long count = 0;
+    report.p95 = report.max;
+    for (size_t bin = 0; bin < histogram.size(); ++bin) {
+        count += histogram[bin];
+        if (count >= wanted) {
+            report.p95 = std::min(report.max, (bin + 1) / 100.0);
+            break;
         }
-        catch(Magick::Warning &warn_ ) {
-            result.warning.append(warn_.what());
+    }
+    return report;
+}
+
+std::shared_ptr<void> FXX::createTransform(const std::vector<unsigned char> &inputProfile,
+                                           cmsUInt32Number inputFormat,
+                                           const std::vector<unsigned char> &outputProfile,
+                                           cmsUInt32Number outputFormat,
+                                           FXX::RenderingIntent intent,
+                                           bool blackpoint)
+{
+    std::shared_ptr<void> result;
+    if (inputProfile.size()==0 || outputProfile.size()==0) { return result; }
+
+    cmsUInt32Number lcmsIntent;
+    switch (intent) {
+    case FXX::SaturationRenderingIntent:
+        lcmsIntent = INTENT_SATURATION;
+        break;
+    case FXX::AbsoluteRenderingIntent:
+        lcmsIntent = INTENT_ABSOLUTE_COLORIMETRIC;
+        break;
+    case FXX::RelativeRenderingIntent:
+        lcmsIntent = INTENT_RELATIVE_COLORIMETRIC;
+        break;
+    default:
+        lcmsIntent = INTENT_PERCEPTUAL;
+    }
+    cmsUInt32Number flags = blackpoint ? cmsFLAGS_BLACKPOINTCOMPENSATION : 0;
+
+    cmsHPROFILE input = cmsOpenProfileFromMem(inputProfile.data(),
+                                              static_cast<cmsUInt32Number>(inputProfile.size()));
+    cmsHPROFILE output = cmsOpenProfileFromMem(outputProfile.data(),
+                                               static_cast<cmsUInt32Number>(outputProfile.size()));
+    if (input && output) {
+        cmsHTRANSFORM transform = cmsCreateTransform(input, inputFormat,
+                                                     output, outputFormat,
+                                                     lcmsIntent, flags);
+        if (transform) { result = std::shared_ptr<void>(transform, cmsDeleteTransform); }
+    }
+    if (input) { cmsCloseProfile(input); }
+    if (output) { cmsCloseProfile(output); }
+    return result;
+}
+
+cmsUInt32Number FXX::getPixelFormat(FXX::ColorSpace colorspace,
+                                    bool alpha,
+                                    size_t depth)
+{
+    cmsUInt32Number format;
+    switch (colorspace) {
+    case FXX::RGBColorSpace:
+        format = COLORSPACE_SH(PT_RGB);
+        break;
+    case FXX::CMYKColorSpace:
+        format = COLORSPACE_SH(PT_CMYK);
+        break;
+    case FXX::GRAYColorSpace:
+        format = COLORSPACE_SH(PT_GRAY);
+        break;
+    default:
+        return 0;
+    }
+    return format |
+           CHANNELS_SH(static_cast<cmsUInt32Number>(getColorSpaceChannels(colorspace))) |
+           EXTRA_SH(alpha?1:0) |
+           BYTES_SH(depth==8?1:2);
+}
+
+const std::vector<unsigned char> &FXX::getLabProfile()
+{
+    static const std::vector<unsigned char> profile = []() {
+        std::vector<unsigned char> buffer;
+        cmsHPROFILE lab = cmsCreateLab4Profile(nullptr);
+        if (!lab) { return buffer; }
+        cmsUInt32Number length = 0;
+        if (cmsSaveProfileToMem(lab, nullptr, &length) && length>0) {
+            buffer.resize(length);
+            if (!cmsSaveProfileToMem(lab, buffer.data(), &length)) { buffer.clear(); }
         }
-    } else {
-        result.error.append("Missing image or ICC profiles, unable to convert.");
+        cmsCloseProfile(lab);
+        return buffer;
+    }();
+    return profile;
+}
+
+std::string FXX::getPixelMap(FXX::ColorSpace colorspace,
+                             bool alpha)
+{
+    std::string map;
+    switch (colorspace) {
+    case FXX::RGBColorSpace:
+        map = "RGB";
+        break;
+    case FXX::CMYKColorSpace:
+        map = "CMYK";
+        break;
+    case FXX::GRAYColorSpace:
+        map = "I";
+        break;
+    default:
+        return map;
+    }
+    if (alpha) { map.append("A"); }
+    return map;
+}
+
+int FXX::getColorSpaceChannels(FXX::ColorSpace colorspace)
+{
+    switch (colorspace) {
+    case FXX::RGBColorSpace:
+        return 3;
+    case FXX::CMYKColorSpace:
+        return 4;
+    case FXX::GRAYColorSpace:
+        return 1;
+    default:;
+    }
+    return 0;
+}
+
+bool FXX::hasAlpha(Magick::Image image)
+{
+#if MagickLibVersion >= 0x700
+    return image.alpha();
+#else
+    return image.matte();
+#endif
+}
+
+unsigned long long FXX::hash(const unsigned char *data,
+                             size_t length,
+                             unsigned long long seed)
+{
+    // FNV-1a
+    unsigned long long result = seed;
+    for (size_t i = 0; i < length; ++i) {
+        result ^= data[i];
+        result *= 1099511628211ULL;
+    }
+    return result;
+}
+
+unsigned long long FXX::hash(const std::vector<unsigned char> &buffer)
+{
+    return hash(buffer.data(), buffer.size());
+}
+
+unsigned long long FXX::hashFile(const std::string &file)
+{
+    std::ifstream stream(file.c_str(), std::ios::binary);
+    if (!stream) { return 0; }
+    std::vector<unsigned char> buffer(1048576);
+    unsigned long long result = 14695981039346656037ULL;
+    while (stream) {
+        stream.read(reinterpret_cast<char*>(buffer.data()), static_cast<std::streamsize>(buffer.size()));
+        size_t length = static_cast<size_t>(stream.gcount());
+        if (length<1) { break; }
+        result = hash(buffer.data(), length, result);
     }
     return result;
 }
@@ -545,11 +2615,26 @@ std::string FXX::getProfileTag(cmsHPROFILE profile,
     return result;
 }
 
+std::string FXX::getProfileTag(const FXX::ProfileInfo &info,
+                               FXX::ICCTag tag)
+{
+    switch(tag) {
+    case FXX::ICCManufacturer:
+        return info.manufacturer;
+    case FXX::ICCModel:
+        return info.model;
+    case FXX::ICCCopyright:
+        return info.copyright;
+    default:;
+    }
+    return info.description;
+}
+
 std::string FXX::getProfileTag(std::string file,
                                FXX::ICCTag tag)
 {
     if (!file.empty()) {
-        return getProfileTag(cmsOpenProfileFromFile(file.c_str(), "r"), tag);
+        return getProfileTag(getProfileInfo(file), tag);
     }
     return "";
 }
@@ -558,8 +2643,7 @@ std::string FXX::getProfileTag(std::vector<unsigned char> buffer,
                                FXX::ICCTag tag)
 {
     if (buffer.size()>0) {
-        return getProfileTag(cmsOpenProfileFromMem(buffer.data(),
-                                                   static_cast<cmsUInt32Number>(buffer.size())),tag);
+        return getProfileTag(getProfileInfo(buffer), tag);
     }
     return "";
 }
@@ -567,8 +2651,7 @@ std::string FXX::getProfileTag(std::vector<unsigned char> buffer,
 FXX::ColorSpace FXX::getProfileColorspace(std::vector<unsigned char> buffer)
 {
     if (buffer.size()>0) {
-        return getProfileColorspace(cmsOpenProfileFromMem(buffer.data(),
-                                                          static_cast<cmsUInt32Number>(buffer.size())));
+        return getProfileInfo(buffer).colorspace;
     }
     return FXX::UnknownColorSpace;
 }
@@ -576,7 +2659,7 @@ FXX::ColorSpace FXX::getProfileColorspace(std::vector<unsigned char> buffer)
 FXX::ColorSpace FXX::getProfileColorspace(std::string file)
 {
     if (!file.empty()) {
-        return getProfileColorspace(cmsOpenProfileFromFile(file.c_str(), "r"));
+        return getProfileInfo(file).colorspace;
     }
     return FXX::UnknownColorSpace;
 }
@@ -597,6 +2680,120 @@ FXX::ColorSpace FXX::getProfileColorspace(cmsHPROFILE profile)
     return result;
 }
 
+FXX::ProfileInfo FXX::getProfileInfo(const std::string &file)
+{
+    FXX::ProfileInfo result;
+    if (file.empty()) { return result; }
+
+    // read the header, the tag table and the text tags only, a mapped
+    // profile that shrinks while it is parsed would raise SIGBUS
+    std::ifstream in(file.c_str(), std::ios::binary);
+    if (!in) { return result; }
+    in.seekg(0, std::ios::end);
+    std::streamoff length = in.tellg();
+    in.seekg(0, std::ios::beg);
+    if (length < ICC_HEADER_LENGTH + 4) { return result; }
+    std::vector<unsigned char> header(ICC_HEADER_LENGTH + 4);
+    if (!in.read(reinterpret_cast<char*>(header.data()), static_cast<std::streamsize>(header.size()))) {
+        return result;
+    }
+    if (readICCUInt32(header.data() + 36) != 0x61637370) { return result; } // 'acsp'
+    result = getProfileInfo(header.data(), header.size());
+
+    size_t size = readICCUInt32(header.data());
+    if (size > static_cast<size_t>(length) || size < ICC_HEADER_LENGTH + 4) { size = static_cast<size_t>(length); }
+    size_t count = readICCUInt32(header.data() + ICC_HEADER_LENGTH);
+    if (count > (size - ICC_HEADER_LENGTH - 4) / ICC_TAG_LENGTH) {
+        count = (size - ICC_HEADER_LENGTH - 4) / ICC_TAG_LENGTH;
+    }
+    std::vector<unsigned char> tags(count * ICC_TAG_LENGTH);
+    if (count > 0 && !in.read(reinterpret_cast<char*>(tags.data()), static_cast<std::streamsize>(tags.size()))) {
+        return result;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        const unsigned char *tag = tags.data() + i * ICC_TAG_LENGTH;
+        unsigned int signature = readICCUInt32(tag);
+        std::string *text = nullptr;
+        switch (signature) {
+        case 0x64657363: // 'desc'
+            text = &result.description;
+            break;
+        case 0x63707274: // 'cprt'
+            text = &result.copyright;
+            break;
+        case 0x646D6E64: // 'dmnd'
+            text = &result.manufacturer;
+            break;
+        case 0x646D6464: // 'dmdd'
+            text = &result.model;
+            break;
+        default:;
+        }
+        if (!text) { continue; }
+        unsigned int offset = readICCUInt32(tag + 4);
+        unsigned int tagSize = readICCUInt32(tag + 8);
+        if (offset >= size || tagSize < ICC_TAG_LENGTH || tagSize > size - offset) { continue; }
+        std::vector<unsigned char> data(tagSize);
+        in.clear();
+        in.seekg(offset, std::ios::beg);
+        if (!in.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(data.size()))) { continue; }
+        *text = readICCText(data.data(), data.size(), 0, tagSize);
+    }
+
+    result.filename = file;
+    return result;
+}
+
+FXX::ProfileInfo FXX::getProfileInfo(const std::vector<unsigned char> &buffer)
+{
+    if (buffer.size() == 0) { return FXX::ProfileInfo(); }
+    return getProfileInfo(buffer.data(), buffer.size());
+}
+
+FXX::ProfileInfo FXX::getProfileInfo(const unsigned char *data,
+                                     size_t length)
+{
+    FXX::ProfileInfo result;
+    if (!data || length < ICC_HEADER_LENGTH + 4) { return result; }
+    if (readICCUInt32(data + 36) != 0x61637370) { return result; } // 'acsp'
+
+    size_t size = readICCUInt32(data);
+    if (size > length || size < ICC_HEADER_LENGTH + 4) { size = length; }
+
+    // header
+    result.version = readICCUInt32(data + 8);
+    result.profileClass = readICCProfileClass(readICCUInt32(data + 12));
+    result.colorspace = readICCColorSpace(readICCUInt32(data + 16));
+    result.pcs = readICCColorSpace(readICCUInt32(data + 20));
+
+    // tag table
+    size_t count = readICCUInt32(data + ICC_HEADER_LENGTH);
+    if (count > (size - ICC_HEADER_LENGTH - 4) / ICC_TAG_LENGTH) {
+        count = (size - ICC_HEADER_LENGTH - 4) / ICC_TAG_LENGTH;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        const unsigned char *tag = data + ICC_HEADER_LENGTH + 4 + i * ICC_TAG_LENGTH;
+        unsigned int offset = readICCUInt32(tag + 4);
+        unsigned int tagSize = readICCUInt32(tag + 8);
+        switch (readICCUInt32(tag)) {
+        case 0x64657363: // 'desc'
+            result.description = readICCText(data, size, offset, tagSize);
+            break;
+        case 0x63707274: // 'cprt'
+            result.copyright = readICCText(data, size, offset, tagSize);
+            break;
+        case 0x646D6E64: // 'dmnd'
+            result.manufacturer = readICCText(data, size, offset, tagSize);
+            break;
+        case 0x646D6464: // 'dmdd'
+            result.model = readICCText(data, size, offset, tagSize);
+            break;
+        default:;
+        }
+    }
+    return result;
+}
+
 std::string FXX::identify(std::vector<unsigned char> buffer)
 {
     std::string result;
@@ -727,81 +2924,550 @@ bool FXX::saveImage(FXX::Image data, int quality)
     return true;
 }
 
-bool FXX::writePSD(FXX::Image data,
-                  std::string filename)
+// PackBits, as used by PSD/PSB for RLE compressed scanlines
+static void psdPackBits(const unsigned char *data,
+                        size_t length,
+                        std::vector<unsigned char> *output)
 {
-    std::cout << "PSD? " << data.layers.size() << " " << data.isPSD << std::endl;
-    if (data.layers.size()<=0 || !data.isPSD) {
-        std::cout << "Not a PSD?" << std::endl;
+    size_t i = 0;
+    while (i < length) {
+        size_t run = 1;
+        while (i+run < length && run < 128 && data[i+run] == data[i]) { run++; }
+        if (run >= 3) {
+            output->push_back(static_cast<unsigned char>(257-run));
+            output->push_back(data[i]);
+            i += run;
+            continue;
+        }
+        size_t start = i;
+        while (i < length && i-start < 128) {
+            if (i+2 < length && data[i] == data[i+1] && data[i] == data[i+2]) { break; }
+            i++;
+        }
+        output->push_back(static_cast<unsigned char>(i-start-1));
+        output->insert(output->end(), data+start, data+i);
+    }
+}
+
+// big-endian writer, lengths are 4 bytes in PSD and 8 bytes in PSB.
+// Writes to a temp file, renamed by commit(), an export that fails
+// never leaves a partial file or destroys an existing one
+class PSDWriter
+{
+public:
+    PSDWriter(const std::string &filename,
+              bool psb)
+        : filename(filename)
+        , temp(tempFile(filename))
+        , stream(temp.c_str(), std::ios::binary | std::ios::trunc)
+        , psb(psb)
+        , committed(false)
+    {
+    }
+    ~PSDWriter()
+    {
+        if (committed) { return; }
+        stream.close();
+        std::remove(temp.c_str());
+    }
+    PSDWriter(const PSDWriter&) = delete;
+    PSDWriter &operator=(const PSDWriter&) = delete;
+    void write8(unsigned char value) { stream.put(static_cast<char>(value)); }
+    void write16(unsigned int value)
+    {
+        write8(static_cast<unsigned char>(value >> 8));
+        write8(static_cast<unsigned char>(value));
+    }
+    void write32(unsigned long long value)
+    {
+        write16(static_cast<unsigned int>((value >> 16) & 0xffff));
+        write16(static_cast<unsigned int>(value & 0xffff));
+    }
+    void write64(unsigned long long value)
+    {
+        write32(value >> 32);
+        write32(value & 0xffffffff);
+    }
+    void writeLength(unsigned long long value)
+    {
+        if (psb) { write64(value); }
+        else { write32(value); }
+    }
+    void writeCount(unsigned long long value)
+    {
+        if (psb) { write32(value); }
+        else { write16(static_cast<unsigned int>(value)); }
+    }
+    void writeData(const std::string &data) { stream.write(data.data(), static_cast<std::streamsize>(data.size())); }
+    void writeData(const std::vector<unsigned char> &data)
+    {
+        stream.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+    }
+    unsigned long long position() { return static_cast<unsigned long long>(stream.tellp()); }
+    void patchLength(unsigned long long position,
+                     unsigned long long value)
+    {
+        std::streampos end = stream.tellp();
+        stream.seekp(static_cast<std::streamoff>(position));
+        writeLength(value);
+        stream.seekp(end);
+    }
+    bool good() { return stream.good(); }
+    bool commit()
+    {
+        stream.close();
+        if (stream.fail()) { return false; }
+#ifdef _WIN32
+        std::remove(filename.c_str());
+#endif
+        if (std::rename(temp.c_str(), filename.c_str()) != 0) { return false; }
+        committed = true;
+        return true;
+    }
+
+    std::string filename;
+    std::string temp;
+    std::ofstream stream;
+    bool psb;
+    bool committed;
+};
+
+static std::string psdBlendMode(Magick::CompositeOperator compose)
+{
+    switch (compose) {
+    case Magick::MultiplyCompositeOp: return "mul ";
+    case Magick::ScreenCompositeOp: return "scrn";
+    case Magick::OverlayCompositeOp: return "over";
+    case Magick::DarkenCompositeOp: return "dark";
+    case Magick::LightenCompositeOp: return "lite";
+    case Magick::ColorDodgeCompositeOp: return "div ";
+    case Magick::ColorBurnCompositeOp: return "idiv";
+    case Magick::HardLightCompositeOp: return "hLit";
+    case Magick::SoftLightCompositeOp: return "sLit";
+    case Magick::DifferenceCompositeOp: return "diff";
+    case Magick::ExclusionCompositeOp: return "smud";
+    case Magick::HueCompositeOp: return "hue ";
+    case Magick::SaturateCompositeOp: return "sat ";
+    case Magick::ColorizeCompositeOp: return "colr";
+    case Magick::LuminizeCompositeOp: return "lum ";
+    case Magick::DissolveCompositeOp: return "diss";
+    case Magick::LinearBurnCompositeOp: return "lbrn";
+    case Magick::LinearDodgeCompositeOp: return "lddg";
+    default:;
+    }
+    return "norm";
+}
+
+// UTF-16 code units from a UTF-8 layer name, for the 'luni' block
+static std::vector<unsigned int> psdUnicodeName(const std::string &name)
+{
+    std::vector<unsigned int> result;
+    for (size_t i = 0; i < name.size();) {
+        unsigned char c = static_cast<unsigned char>(name.at(i));
+        unsigned int code = c;
+        size_t extra = 0;
+        if (c >= 0xf0) { code = c & 0x07; extra = 3; }
+        else if (c >= 0xe0) { code = c & 0x0f; extra = 2; }
+        else if (c >= 0xc0) { code = c & 0x1f; extra = 1; }
+        i++;
+        for (size_t e = 0; e < extra && i < name.size(); ++e, ++i) {
+            code = (code << 6) | (static_cast<unsigned char>(name.at(i)) & 0x3f);
+        }
+        if (code >= 0x10000) {
+            code -= 0x10000;
+            result.push_back(0xd800 + (code >> 10));
+            result.push_back(0xdc00 + (code & 0x3ff));
+        } else {
+            result.push_back(code);
+        }
+    }
+    return result;
+}
+
+// layer opacity as stored by the PSD reader (in quantum units)
+static unsigned int psdLayerOpacity(const Magick::Image &image)
+{
+    std::string value = image.artifact("psd:layer.opacity");
+    if (value.empty()) { return 255; }
+    double opacity = std::atof(value.c_str())*255.0/QuantumRange;
+    if (opacity < 0.0) { return 0; }
+    if (opacity > 255.0) { return 255; }
+    return static_cast<unsigned int>(opacity + 0.5);
+}
+
+// planar, big-endian channels of an image (color channels then alpha),
+// each row packed on its own; rows are compressed in parallel.
+// The PSD reader multiplies layer opacity into alpha, so alpha is
+// divided by it again to not apply the opacity twice on reading.
+static bool psdPackImage(Magick::Image &image,
+                         FXX::ColorSpace colorspace,
+                         bool alpha,
+                         unsigned int opacity,
+                         size_t bytes,
+                         std::vector<std::vector<unsigned char> > *rows,
+                         std::string *error)
+{
+    size_t width = image.columns();
+    size_t height = image.rows();
+    size_t colors = static_cast<size_t>(FXX::getColorSpaceChannels(colorspace));
+    size_t channels = colors + (alpha?1:0);
+    rows->clear();
+    rows->resize(channels * height);
+    if (width<1 || height<1) { return true; }
+
+    std::vector<unsigned char> pixels(width * height * channels * bytes);
+    try {
+        image.write(0, 0, width, height,
+                    FXX::getPixelMap(colorspace, alpha),
+                    bytes==1?Magick::CharPixel:Magick::ShortPixel,
+                    pixels.data());
+    }
+    catch(Magick::Error &error_ ) {
+        if (error) { error->append(error_.what()); }
         return false;
     }
-    for (unsigned long i=0;i<data.layers.size();++i) {
-        try {
+    catch(Magick::Warning &warn_ ) {
+        std::cout << warn_.what() << std::endl;
+    }
 
-            // set PSD attributes
-            data.layers[i].defineValue("psd", "additional-info", "all");
-            data.layers[i].defineValue("psd", "preserve-opacity-mask", "true");
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        std::vector<unsigned char> scanline(width * bytes);
+        for (size_t i = next++; i < rows->size(); i = next++) {
+            size_t channel = i / height;
+            size_t y = i % height;
+            // CMYK is stored inverted in PSD
+            bool invert = colorspace == FXX::CMYKColorSpace && channel < colors;
+            bool revert = channel == colors && opacity > 0 && opacity < 255;
+            for (size_t x = 0; x < width; ++x) {
+                size_t offset = (y * width + x) * channels + channel;
+                if (bytes==1) {
+                    unsigned char value = pixels[offset];
+                    if (revert) { value = static_cast<unsigned char>(std::min(255u, (value*255u + opacity/2)/opacity)); }
+                    scanline[x] = invert?static_cast<unsigned char>(255-value):value;
+                } else {
+                    unsigned short value = reinterpret_cast<const unsigned short*>(pixels.data())[offset];
+                    if (revert) { value = static_cast<unsigned short>(std::min(65535u, (value*255u + opacity/2)/opacity)); }
+                    if (invert) { value = static_cast<unsigned short>(65535-value); }
+                    scanline[x*2] = static_cast<unsigned char>(value >> 8);
+                    scanline[x*2+1] = static_cast<unsigned char>(value & 0xff);
+                }
+            }
+            psdPackBits(scanline.data(), scanline.size(), &rows->at(i));
+        }
+    };
+    size_t workers = std::max(1u, std::thread::hardware_concurrency());
+    if (workers > rows->size()) { workers = rows->size(); }
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < workers; ++i) { threads.push_back(std::thread(worker)); }
+    worker();
+    for (size_t i = 0; i < threads.size(); ++i) { threads[i].join(); }
+    return true;
+}
+
+bool FXX::writeNativePSD(std::vector<Magick::Image> &layers,
+                         const std::string &filename,
+                         const std::vector<unsigned char> &profile,
+                         size_t depth,
+                         std::string *error,
+                         const FXX::LayerCallback &prepare)
+{
+    if (layers.size()<1) {
+        if (error) { error->append("Nothing to write."); }
+        return false;
+    }
+    FXX::ColorSpace colorspace = getProfileInfo(profile).colorspace;
+    unsigned int mode = 0;
+    switch (colorspace) {
+    case FXX::GRAYColorSpace:
+        mode = 1;
+        break;
+    case FXX::RGBColorSpace:
+        mode = 3;
+        break;
+    case FXX::CMYKColorSpace:
+        mode = 4;
+        break;
+    default:
+        if (error) { error->append("Unsupported color space for PSD."); }
+        return false;
+    }
+    size_t bytes = depth>8?2:1;
+    size_t colors = static_cast<size_t>(getColorSpaceChannels(colorspace));
+
+    // use PSB for large documents
+    bool psb = filename.size()>4 && (filename.substr(filename.size()-4) == ".psb" ||
+                                     filename.substr(filename.size()-4) == ".PSB");
+    unsigned long long raw = 0;
+    for (size_t i = 0; i < layers.size(); ++i) {
+        if (layers[i].columns()>30000 || layers[i].rows()>30000) { psb = true; }
+        raw += static_cast<unsigned long long>(layers[i].columns()) * layers[i].rows() * (colors+1) * bytes;
+    }
+    if (raw > 2000000000ULL) { psb = true; }
+
+    // layers may only be pinged, prepare() decodes and converts each
+    // one when its pixels are written, records only need the attributes
+    std::vector<bool> alphas(layers.size());
+    std::vector<unsigned int> opacities(layers.size());
+    for (size_t i = 0; i < layers.size(); ++i) {
+        alphas[i] = hasAlpha(layers[i]);
+        opacities[i] = psdLayerOpacity(layers[i]);
+    }
+
+    Magick::Image &composite = layers[0];
+    bool compositeAlpha = alphas[0];
+    PSDWriter psd(filename, psb);
+    if (!psd.good()) {
+        if (error) { error->append("Unable to write " + filename); }
+        return false;
+    }
 
-            // have ICC profiles?
-            if (data.iccOutputBuffer.size()==0 || data.iccInputBuffer.size()==0) {
-                std::cout << "Missing ICC profiles" << std::endl;
-                return false;
+    // header
+    psd.writeData("8BPS");
+    psd.write16(psb?2:1);
+    psd.write32(0);
+    psd.write16(0);
+    psd.write16(static_cast<unsigned int>(colors + (compositeAlpha?1:0)));
+    psd.write32(composite.rows());
+    psd.write32(composite.columns());
+    psd.write16(static_cast<unsigned int>(bytes*8));
+    psd.write16(mode);
+
+    // color mode data
+    psd.write32(0);
+
+    // image resources, only the ICC profile
+    if (profile.size()>0) {
+        size_t padded = profile.size() + profile.size()%2;
+        psd.write32(12 + padded);
+        psd.writeData("8BIM");
+        psd.write16(1039);
+        psd.write16(0);
+        psd.write32(profile.size());
+        psd.writeData(profile);
+        if (padded != profile.size()) { psd.write8(0); }
+    } else {
+        psd.write32(0);
+    }
+
+    // layer and mask information
+    unsigned long long sectionStart = psd.position();
+    psd.writeLength(0);
+    if (layers.size()>1) {
+        unsigned long long infoStart = psd.position();
+        psd.writeLength(0);
+        int count = static_cast<int>(layers.size()-1);
+        psd.write16(static_cast<unsigned int>(static_cast<unsigned short>(compositeAlpha?-count:count)));
+
+        // records, channel lengths are filled in when the data is written
+        std::vector<std::vector<unsigned long long> > lengthFields(layers.size());
+        for (size_t i = 1; i < layers.size(); ++i) {
+            Magick::Image &layer = layers[i];
+            bool alpha = alphas[i];
+            long x = static_cast<long>(layer.page().xOff());
+            long y = static_cast<long>(layer.page().yOff());
+            psd.write32(static_cast<unsigned int>(static_cast<int>(y)));
+            psd.write32(static_cast<unsigned int>(static_cast<int>(x)));
+            psd.write32(static_cast<unsigned int>(static_cast<int>(y + static_cast<long>(layer.rows()))));
+            psd.write32(static_cast<unsigned int>(static_cast<int>(x + static_cast<long>(layer.columns()))));
+            psd.write16(static_cast<unsigned int>(colors + (alpha?1:0)));
+            for (size_t c = 0; c < colors + (alpha?1:0); ++c) {
+                psd.write16(c<colors?static_cast<unsigned int>(c):0xffff);
+                lengthFields[i].push_back(psd.position());
+                psd.writeLength(0);
             }
+            psd.writeData("8BIM");
+            psd.writeData(psdBlendMode(layer.compose()));
+            psd.write8(static_cast<unsigned char>(opacities[i]));
+            psd.write8(0);
+            psd.write8(layer.compose() == Magick::NoCompositeOp?0x02:0x00);
+            psd.write8(0);
 
-            // strip existing profiles
-            data.layers[i].profile("ICC", Magick::Blob());
-            data.layers[i].profile("ICM", Magick::Blob());
+            std::string name = layer.label();
+            std::string ascii;
+            for (size_t n = 0; n < name.size() && ascii.size() < 255; ++n) {
+                ascii.push_back(static_cast<unsigned char>(name.at(n))<0x80?name.at(n):'_');
+            }
+            size_t namePadded = ((ascii.size()+1+3)/4)*4;
+            std::vector<unsigned int> unicode = psdUnicodeName(name);
+            size_t unicodeLength = 4 + unicode.size()*2;
+            size_t unicodePadded = ((unicodeLength+3)/4)*4;
+            psd.write32(4 + 4 + namePadded + 12 + unicodePadded);
+            psd.write32(0);
+            psd.write32(0);
+            psd.write8(static_cast<unsigned char>(ascii.size()));
+            psd.writeData(ascii);
+            for (size_t n = ascii.size()+1; n < namePadded; ++n) { psd.write8(0); }
+            psd.writeData("8BIMluni");
+            psd.write32(unicodePadded);
+            psd.write32(unicode.size());
+            for (size_t n = 0; n < unicode.size(); ++n) { psd.write16(unicode.at(n)); }
+            for (size_t n = unicodeLength; n < unicodePadded; ++n) { psd.write8(0); }
+        }
 
-            // set rendering intent and blackpoint
-            if (data.intent != FXX::UndefinedRenderingIntent) {
-                switch (data.intent) {
-                case FXX::SaturationRenderingIntent:
-                    data.layers[i].renderingIntent(Magick::SaturationIntent);
-                    break;
-                case FXX::PerceptualRenderingIntent:
-                    data.layers[i].renderingIntent(Magick::PerceptualIntent);
-                    break;
-                case FXX::AbsoluteRenderingIntent:
-                    data.layers[i].renderingIntent(Magick::AbsoluteIntent);
-                    break;
-                case FXX::RelativeRenderingIntent:
-                    data.layers[i].renderingIntent(Magick::RelativeIntent);
-                    break;
-                default:;
-                }
+        // channel data, one layer in memory at a time
+        for (size_t i = 1; i < layers.size(); ++i) {
+            Magick::Image &layer = layers[i];
+            if (prepare && !prepare(i, &layer, error)) { return false; }
+            std::vector<std::vector<unsigned char> > rows;
+            if (!psdPackImage(layer, colorspace, alphas[i], opacities[i], bytes, &rows, error)) { return false; }
+            size_t height = layer.columns()>0?layer.rows():0;
+            for (size_t c = 0; c < lengthFields[i].size(); ++c) {
+                unsigned long long start = psd.position();
+                psd.write16(height>0?1:0);
+                for (size_t y = 0; y < height; ++y) { psd.writeCount(rows.at(c*height+y).size()); }
+                for (size_t y = 0; y < height; ++y) { psd.writeData(rows.at(c*height+y)); }
+                psd.patchLength(lengthFields[i].at(c), psd.position() - start);
             }
-            data.layers[i].blackPointCompensation(data.blackpoint);
+            // release pixels of converted layers as soon as they are written
+            layer = Magick::Image();
+        }
+        if ((psd.position() - infoStart)%2) { psd.write8(0); }
+        psd.patchLength(infoStart, psd.position() - infoStart - (psb?8:4));
 
-            // apply source color profile
-            Magick::Blob sourceProfile(data.iccInputBuffer.data(),
-                                       data.iccInputBuffer.size());
-            data.layers[i].profile("ICC", sourceProfile);
+        // global layer mask
+        psd.write32(0);
+        psd.patchLength(sectionStart, psd.position() - sectionStart - (psb?8:4));
+    }
+
+    // merged image data
+    if (prepare && !prepare(0, &composite, error)) { return false; }
+    std::vector<std::vector<unsigned char> > rows;
+    if (!psdPackImage(composite, colorspace, compositeAlpha, 255, bytes, &rows, error)) { return false; }
+    psd.write16(1);
+    for (size_t i = 0; i < rows.size(); ++i) { psd.writeCount(rows.at(i).size()); }
+    for (size_t i = 0; i < rows.size(); ++i) { psd.writeData(rows.at(i)); }
+
+    if (!psd.good() || !psd.commit()) {
+        if (error) { error->append("Unable to write " + filename); }
+        return false;
+    }
+    return true;
+}
+
+bool FXX::writePSD(FXX::Image data,
+                   std::string filename,
+                   FXX::TransformCache *cache)
+{
+    // decode layers not already in memory while converting
+    if (data.layers.size()==0 && data.layerStore) { data.layers.resize(data.layerStore->count()); }
+    std::cout << "PSD? " << data.layers.size() << " " << data.isPSD << std::endl;
+    if (data.layers.size()<=0 || !data.isPSD) {
+        std::cout << "Not a PSD?" << std::endl;
+        return false;
+    }
+
+    // have ICC profiles?
+    if (data.iccOutputBuffer.size()==0 || data.iccInputBuffer.size()==0) {
+        std::cout << "Missing ICC profiles" << std::endl;
+        return false;
+    }
+
+    // all layers share the same transform(s)
+    FXX::TransformCache layerCache;
+    if (!cache) { cache = &layerCache; }
 
-            // apply destination color profile
-            Magick::Blob destinationProfile(data.iccOutputBuffer.data(),
-                                            data.iccOutputBuffer.size());
-            data.layers[i].profile("ICC", destinationProfile);
+    Magick::RenderingIntent intent = Magick::UndefinedIntent;
+    switch (data.intent) {
+    case FXX::SaturationRenderingIntent:
+        intent = Magick::SaturationIntent;
+        break;
+    case FXX::PerceptualRenderingIntent:
+        intent = Magick::PerceptualIntent;
+        break;
+    case FXX::AbsoluteRenderingIntent:
+        intent = Magick::AbsoluteIntent;
+        break;
+    case FXX::RelativeRenderingIntent:
+        intent = Magick::RelativeIntent;
+        break;
+    default:;
+    }
+
+    // layers not in memory are only pinged here, each layer is decoded
+    // and converted right before it is written and dropped after, the
+    // conversion itself runs in parallel within the layer
+    std::vector<bool> stored(data.layers.size(), false);
+    for (size_t i = 0; i < data.layers.size(); ++i) {
+        if (data.layers[i].isValid() || !data.layerStore) { continue; }
+        data.layers[i] = data.layerStore->pingLayer(i);
+        stored[i] = true;
+    }
+    FXX::LayerCallback prepare = [&](size_t i, Magick::Image *layer, std::string *error) {
+        try {
+            if (stored.at(i)) { *layer = data.layerStore->decodeLayer(i); }
+            if (!transformImage(*layer,
+                                data.iccInputBuffer,
+                                data.iccOutputBuffer,
+                                data.intent,
+                                data.blackpoint,
+                                cache,
+                                error)) { return false; }
+            // set PSD attributes
+            layer->defineValue("psd", "additional-info", "all");
+            layer->defineValue("psd", "preserve-opacity-mask", "true");
+            if (intent != Magick::UndefinedIntent) { layer->renderingIntent(intent); }
+            layer->blackPointCompensation(data.blackpoint);
         }
         catch(Magick::Error &error_ ) {
-            std::cout << "save PSD error!" << error_.what() << std::endl;
+            if (error) { error->append(error_.what()); }
             return false;
         }
         catch(Magick::Warning &warn_ ) {
             std::cout << "save PSD warning! " << warn_.what() << std::endl;
         }
+        return true;
+    };
+
+    // stream 8/16-bit gray, RGB and CMYK ourselves, anything else goes through ImageMagick
+    size_t depth = data.depth>0?data.depth:data.layers[0].depth();
+    FXX::ColorSpace colorspace = getProfileInfo(data.iccOutputBuffer).colorspace;
+    if (depth <= 16 &&
+        (colorspace == FXX::RGBColorSpace ||
+         colorspace == FXX::CMYKColorSpace ||
+         colorspace == FXX::GRAYColorSpace)) {
+        std::string error;
+        if (!writeNativePSD(data.layers, filename, data.iccOutputBuffer, depth, &error, prepare)) {
+            std::cout << "save PSD error!" << error << std::endl;
+            return false;
+        }
+        return true;
     }
+
+    // ImageMagick needs all layers at once
+    for (size_t i = 0; i < data.layers.size(); ++i) {
+        std::string error;
+        if (!prepare(i, &data.layers[i], &error)) {
+            std::cout << "save PSD error!" << error << std::endl;
+            return false;
+        }
+    }
+
+    // through a temp file as well, the format comes from the final name
+    std::string temp = tempFile(filename);
+    bool psb = filename.size()>4 && (filename.substr(filename.size()-4) == ".psb" ||
+                                     filename.substr(filename.size()-4) == ".PSB");
     try {
         Magick::writeImages(data.layers.begin(),
                             data.layers.end(),
-                            filename);
+                            (psb?"PSB:":"PSD:") + temp);
     }
     catch(Magick::Error &error_ ) {
         std::cout << "save PSD error!" << error_.what() << std::endl;
+        std::remove(temp.c_str());
         return false;
     }
     catch(Magick::Warning &warn_ ) {
         std::cout << "save PSD warning! " << warn_.what() << std::endl;
     }
+#ifdef _WIN32
+    std::remove(filename.c_str());
+#endif
+    if (std::rename(temp.c_str(), filename.c_str()) != 0) {
+        std::cout << "save PSD error! Unable to write " << filename << std::endl;
+        std::remove(temp.c_str());
+        return false;
+    }
     return true;
 }
 
@@ -35,9 +35,21 @@
 
 #include <iostream>
 #include <vector>
+#include <list>
+#include <mutex>
+#include <condition_variable>
+#include <set>
+#include <map>
+#include <memory>
+#include <functional>
 #include <Magick++.h>
 #include <lcms2.h>
 
+#define RESULT_CACHE_SIZE 4294967296ULL
+#define LAYER_STORE_SIZE 4
+#define TAC_HEATMAP_SIZE 2048
+#define DELTAE_HEATMAP_SIZE 2048
+
 class FXX
 {
 public:
@@ -45,7 +57,9 @@ public:
         UnknownColorSpace,
         RGBColorSpace,
         CMYKColorSpace,
-        GRAYColorSpace
+        GRAYColorSpace,
+        LABColorSpace,
+        XYZColorSpace
     };
 
     enum ICCTag {
@@ -63,6 +77,61 @@ public:
         RelativeRenderingIntent
     };
 
+    enum ProfileClass {
+        UnknownProfileClass,
+        InputProfileClass,
+        DisplayProfileClass,
+        OutputProfileClass,
+        LinkProfileClass,
+        AbstractProfileClass,
+        ColorSpaceProfileClass,
+        NamedColorProfileClass
+    };
+
+    class LayerStore;
+
+    struct ProfileInfo
+    {
+        std::string filename;
+        std::string description;
+        std::string copyright;
+        std::string manufacturer;
+        std::string model;
+        unsigned int version = 0;
+        FXX::ColorSpace colorspace = FXX::UnknownColorSpace;
+        FXX::ColorSpace pcs = FXX::UnknownColorSpace;
+        FXX::ProfileClass profileClass = FXX::UnknownProfileClass;
+    };
+
+    struct TACReport
+    {
+        double limit = 0.0;
+        double max = 0.0;
+        double mean = 0.0;
+        double p95 = 0.0;
+        double p99 = 0.0;
+        unsigned long long over = 0;
+        size_t pixels = 0;
+        size_t heatmapWidth = 0;
+        size_t heatmapHeight = 0;
+        size_t heatmapCell = 1;
+        std::vector<unsigned char> heatmap;
+    };
+
+    struct DeltaEReport
+    {
+        double limit = 0.0;
+        double max = 0.0;
+        double mean = 0.0;
+        double p95 = 0.0;
+        unsigned long long over = 0;
+        size_t pixels = 0;
+        size_t heatmapWidth = 0;
+        size_t heatmapHeight = 0;
+        size_t heatmapCell = 1;
+        std::vector<unsigned char> heatmap;
+    };
+
     struct Image
     {
         std::vector<unsigned char> imageBuffer;
@@ -79,6 +148,7 @@ public:
         size_t depth = 0;
         int channels = 0;
         std::vector<Magick::Image> layers;
+        std::shared_ptr<FXX::LayerStore> layerStore;
         FXX::ColorSpace colorspace = FXX::UnknownColorSpace;
         FXX::RenderingIntent intent = FXX::UndefinedRenderingIntent;
         std::string comment;
@@ -93,6 +163,201 @@ public:
         bool hasEXIF = false;
         bool hasIPTC = false;
         bool isPSD = false;
+        double inkLimit = 0.0;
+        FXX::TACReport tac;
+        double deltaELimit = 0.0;
+        FXX::DeltaEReport deltaE;
+    };
+
+    struct Target
+    {
+        std::string filename;
+        std::vector<unsigned char> profile;
+        FXX::RenderingIntent intent = FXX::UndefinedRenderingIntent;
+        bool blackpoint = false;
+        size_t depth = 0;
+        int quality = 100;
+        double inkLimit = 0.0;
+        double deltaELimit = 0.0;
+    };
+
+    struct PCSImage
+    {
+        Magick::Image meta;
+        size_t width = 0;
+        size_t height = 0;
+        bool alpha = false;
+        std::vector<float> lab;
+        std::vector<unsigned short> alphaChannel;
+        std::vector<unsigned char> profile;
+        FXX::RenderingIntent intent = FXX::UndefinedRenderingIntent;
+        bool blackpoint = false;
+    };
+
+    class TransformCache
+    {
+    public:
+        TransformCache(size_t limit = 16);
+        std::shared_ptr<void> getTransform(const std::vector<unsigned char> &inputProfile,
+                                           cmsUInt32Number inputFormat,
+                                           const std::vector<unsigned char> &outputProfile,
+                                           cmsUInt32Number outputFormat,
+                                           FXX::RenderingIntent intent,
+                                           bool blackpoint);
+        void clear();
+        size_t transformsCreated();
+
+    private:
+        std::mutex mutex;
+        std::condition_variable building;
+        std::set<std::string> pending;
+        size_t limit;
+        size_t created;
+        std::list<std::pair<std::string, std::shared_ptr<void> > > transforms;
+    };
+
+    struct LayerInfo
+    {
+        size_t index = 0;
+        std::string name;
+        std::string blend;
+        long x = 0;
+        long y = 0;
+        size_t width = 0;
+        size_t height = 0;
+    };
+
+    class LayerStore
+    {
+    public:
+        LayerStore(const std::string &file,
+                   size_t limit = LAYER_STORE_SIZE);
+        size_t count() const;
+        const std::vector<FXX::LayerInfo> &layers() const;
+        Magick::Image getLayer(size_t index);
+        Magick::Image decodeLayer(size_t index) const;
+        Magick::Image pingLayer(size_t index) const;
+        std::vector<unsigned char> getThumb(size_t index,
+                                            int width = 75,
+                                            int height = 75,
+                                            const std::vector<unsigned char> &inputProfile = std::vector<unsigned char>(),
+                                            const std::vector<unsigned char> &monitorProfile = std::vector<unsigned char>(),
+                                            FXX::TransformCache *cache = nullptr);
+        void clear();
+
+    private:
+        std::string file;
+        std::vector<FXX::LayerInfo> info;
+        size_t limit;
+        std::mutex mutex;
+        std::list<std::pair<size_t, Magick::Image> > resident;
+        std::map<std::string, std::vector<unsigned char> > thumbs;
+    };
+
+    class ResultCache
+    {
+    public:
+        ResultCache(const std::string &folder = std::string(),
+                    unsigned long long limit = RESULT_CACHE_SIZE);
+        static std::string makeKey(unsigned long long input,
+                                   const FXX::Image &settings,
+                                   const std::string &format,
+                                   int quality = 100);
+        bool get(const std::string &key,
+                 std::vector<unsigned char> *data);
+        bool put(const std::string &key,
+                 const std::vector<unsigned char> &data);
+        bool getFile(const std::string &key,
+                     const std::string &file);
+        bool putFile(const std::string &key,
+                     const std::string &file);
+        const std::string &folder() const;
+        static std::string defaultFolder();
+
+    private:
+        std::mutex mutex;
+        std::string path;
+        unsigned long long limit;
+        unsigned long long used;
+        bool scanned;
+        void trim();
+    };
+
+    struct PixelValue
+    {
+        FXX::ColorSpace colorspace = FXX::UnknownColorSpace;
+        std::vector<double> channels;
+        double L = 0.0;
+        double a = 0.0;
+        double b = 0.0;
+        bool valid = false;
+    };
+
+    struct ChannelStats
+    {
+        std::vector<unsigned long long> histogram;
+        double min = 0.0;
+        double max = 0.0;
+        double mean = 0.0;
+        unsigned long long clippedLow = 0;
+        unsigned long long clippedHigh = 0;
+    };
+
+    struct ImageStats
+    {
+        FXX::ColorSpace colorspace = FXX::UnknownColorSpace;
+        size_t pixels = 0;
+        std::vector<FXX::ChannelStats> channels;
+    };
+
+    class PixelProbe
+    {
+    public:
+        bool setSource(const std::vector<unsigned char> &buffer,
+                       const std::vector<unsigned char> &profile,
+                       std::string *error = nullptr);
+        bool setOutput(const std::vector<unsigned char> &buffer,
+                       const std::vector<unsigned char> &profile,
+                       std::string *error = nullptr);
+        size_t width() const;
+        size_t height() const;
+        bool hasOutput() const;
+        FXX::PixelValue source(size_t x,
+                               size_t y) const;
+        FXX::PixelValue output(size_t x,
+                               size_t y) const;
+        FXX::ImageStats sourceStats() const;
+        FXX::ImageStats outputStats() const;
+        void setInkLimit(double limit);
+        const FXX::TACReport &tac() const;
+        void compareOutput(bool enabled,
+                           FXX::TransformCache *cache = nullptr);
+        const FXX::DeltaEReport &deltaE() const;
+
+    private:
+        struct Plane
+        {
+            unsigned long long key = 0;
+            std::vector<unsigned short> pixels;
+            size_t width = 0;
+            size_t height = 0;
+            size_t channels = 0;
+            FXX::ColorSpace colorspace = FXX::UnknownColorSpace;
+            std::vector<unsigned char> profile;
+            std::shared_ptr<void> lab;
+            FXX::ImageStats stats;
+        };
+        std::shared_ptr<const Plane> sourcePlane;
+        std::shared_ptr<const Plane> outputPlane;
+        FXX::TACReport inkReport;
+        FXX::DeltaEReport deltaEReport;
+        static bool loadPlane(std::shared_ptr<const FXX::PixelProbe::Plane> *plane,
+                              const std::vector<unsigned char> &buffer,
+                              const std::vector<unsigned char> &profile,
+                              std::string *error);
+        static FXX::PixelValue readPlane(const std::shared_ptr<const FXX::PixelProbe::Plane> &plane,
+                                         size_t x,
+                                         size_t y);
     };
 
     FXX();
@@ -111,6 +376,99 @@ public:
 
     static FXX::Image convertImage(FXX::Image input,
                                    bool getInfo = true);
+    static FXX::Image convertImage(FXX::Image input,
+                                   std::shared_ptr<FXX::PCSImage> pcs,
+                                   FXX::TransformCache *cache,
+                                   bool getInfo = true);
+    static FXX::Image convertRegion(FXX::Image input,
+                                    std::shared_ptr<FXX::PCSImage> pcs,
+                                    FXX::TransformCache *cache,
+                                    size_t x,
+                                    size_t y,
+                                    size_t width,
+                                    size_t height,
+                                    size_t step = 1);
+
+    static bool transformImage(Magick::Image &image,
+                               const std::vector<unsigned char> &inputProfile,
+                               const std::vector<unsigned char> &outputProfile,
+                               FXX::RenderingIntent intent,
+                               bool blackpoint,
+                               FXX::TransformCache *cache,
+                               std::string *error = nullptr);
+    static bool transformPixels(const void *input,
+                                void *output,
+                                size_t width,
+                                size_t height,
+                                size_t depth,
+                                bool alpha,
+                                const std::vector<unsigned char> &inputProfile,
+                                const std::vector<unsigned char> &outputProfile,
+                                const std::vector<unsigned char> &proofProfile,
+                                FXX::RenderingIntent intent,
+                                bool blackpoint,
+                                FXX::TransformCache *cache,
+                                std::string *error = nullptr);
+    static FXX::Image convertFile(const std::string &input,
+                                  const std::string &output,
+                                  const FXX::Image &settings,
+                                  FXX::TransformCache *cache,
+                                  int quality = 100);
+    static std::vector<FXX::Image> convertFile(const std::string &input,
+                                               const std::vector<FXX::Target> &targets,
+                                               const FXX::Image &settings,
+                                               FXX::TransformCache *cache);
+    static std::vector<FXX::Image> convertVariants(const FXX::Image &input,
+                                                   const std::vector<FXX::Target> &variants,
+                                                   FXX::TransformCache *cache);
+
+    static std::shared_ptr<void> createTransform(const std::vector<unsigned char> &inputProfile,
+                                                 cmsUInt32Number inputFormat,
+                                                 const std::vector<unsigned char> &outputProfile,
+                                                 cmsUInt32Number outputFormat,
+                                                 FXX::RenderingIntent intent,
+                                                 bool blackpoint);
+    static cmsUInt32Number getPixelFormat(FXX::ColorSpace colorspace,
+                                          bool alpha = false,
+                                          size_t depth = 16);
+    static const std::vector<unsigned char> &getLabProfile();
+    static std::string getPixelMap(FXX::ColorSpace colorspace,
+                                   bool alpha = false);
+    static int getColorSpaceChannels(FXX::ColorSpace colorspace);
+    static bool hasAlpha(Magick::Image image);
+
+    static unsigned long long hash(const unsigned char *data,
+                                   size_t length,
+                                   unsigned long long seed = 14695981039346656037ULL);
+    static unsigned long long hash(const std::vector<unsigned char> &buffer);
+    static unsigned long long hashFile(const std::string &file);
+
+    static FXX::ImageStats getImageStats(const std::vector<unsigned short> &pixels,
+                                         size_t channels,
+                                         FXX::ColorSpace colorspace);
+    static FXX::TACReport getTAC(const std::vector<unsigned short> &pixels,
+                                 size_t width,
+                                 size_t height,
+                                 size_t channels,
+                                 double limit,
+                                 size_t heatmapSize = 0);
+    static FXX::TACReport getTAC(Magick::Image image,
+                                 double limit,
+                                 size_t heatmapSize = 0);
+    static std::string getTACWarning(const FXX::TACReport &report);
+    static FXX::DeltaEReport getDeltaE(const std::vector<unsigned short> &source,
+                                       size_t sourceChannels,
+                                       FXX::ColorSpace sourceColorSpace,
+                                       const std::vector<unsigned char> &sourceProfile,
+                                       const std::vector<unsigned short> &output,
+                                       size_t outputChannels,
+                                       FXX::ColorSpace outputColorSpace,
+                                       const std::vector<unsigned char> &outputProfile,
+                                       size_t width,
+                                       size_t height,
+                                       double limit,
+                                       FXX::TransformCache *cache = nullptr,
+                                       size_t heatmapSize = 0);
 
     static FXX::ColorSpace readImageColorspaceType(Magick::Image image);
     static int readImageChannelCount(Magick::Image image);
@@ -123,6 +481,8 @@ public:
 
     std::string getProfileTag(cmsHPROFILE profile,
                               FXX::ICCTag tag = FXX::ICCDescription);
+    std::string getProfileTag(const FXX::ProfileInfo &info,
+                              FXX::ICCTag tag = FXX::ICCDescription);
     std::string getProfileTag(std::string file,
                               FXX::ICCTag tag = FXX::ICCDescription);
     std::string getProfileTag(std::vector<unsigned char> buffer,
@@ -132,6 +492,11 @@ public:
     FXX::ColorSpace getProfileColorspace(std::string file);
     FXX::ColorSpace getProfileColorspace(cmsHPROFILE profile);
 
+    static FXX::ProfileInfo getProfileInfo(const std::string &file);
+    static FXX::ProfileInfo getProfileInfo(const std::vector<unsigned char> &buffer);
+    static FXX::ProfileInfo getProfileInfo(const unsigned char *data,
+                                           size_t length);
+
     static std::string identify(std::vector<unsigned char> buffer);
     static std::string identify(Magick::Image image);
     static std::string identify(std::string file);
@@ -143,7 +508,15 @@ public:
     bool saveImage(FXX::Image data, int quality = 100);
 
     static bool writePSD(FXX::Image data,
-                         std::string filename);
+                         std::string filename,
+                         FXX::TransformCache *cache = nullptr);
+    typedef std::function<bool(size_t index, Magick::Image *layer, std::string *error)> LayerCallback;
+    static bool writeNativePSD(std::vector<Magick::Image> &layers,
+                               const std::string &filename,
+                               const std::vector<unsigned char> &profile,
+                               size_t depth,
+                               std::string *error = nullptr,
+                               const FXX::LayerCallback &prepare = nullptr);
 
     bool hasJPEG();
     bool hasPNG();
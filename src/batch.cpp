@@ -0,0 +1,497 @@
+/*
+# Copyright Ole-André Rodlie, INRIA.
+#
+# ole.andre.rodlie@gmail.com
+#
+# This software is governed by the CeCILL license under French law and
+# abiding by the rules of distribution of free software. You can use,
+# modify and / or redistribute the software under the terms of the CeCILL
+# license as circulated by CEA, CNRS and INRIA at the following URL
+# "https://www.cecill.info".
+#
+# As a counterpart to the access to the source code and rights to
+# modify and redistribute granted by the license, users are provided only
+# with a limited warranty and the software's author, the holder of the
+# economic rights and the subsequent licensors have only limited
+# liability.
+#
+# In this respect, the user's attention is drawn to the associated risks
+# with loading, using, modifying and / or developing or reproducing the
+# software by the user in light of its specific status of free software,
+# that can mean that it is complicated to manipulate, and that also
+# so that it is for developers and experienced
+# professionals having in-depth computer knowledge. Users are therefore
+# encouraged to test and test the software's suitability
+# Requirements in the conditions of their systems
+# data to be ensured and, more generally, to use and operate
+# same conditions as regards security.
+#
+# The fact that you are presently reading this means that you have had
+# knowledge of the CeCILL license and that you accept its terms.
+*/
+
+#include "batch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <thread>
+#include <cstring>
+#include <sys/stat.h>
+
+std::mutex Batch::memoryMutex;
+std::condition_variable Batch::memoryCondition;
+unsigned long long Batch::memoryLimit = 0;
+unsigned long long Batch::memoryReserved = 0;
+unsigned long long Batch::memoryTicket = 0;
+unsigned long long Batch::memoryServing = 0;
+std::shared_ptr<FXX::ResultCache> Batch::results;
+
+// same file, also through relative paths and links
+static bool sameFile(const std::string &file1,
+                     const std::string &file2)
+{
+    if (file1 == file2) { return true; }
+#ifdef _WIN32
+    char path1[_MAX_PATH];
+    char path2[_MAX_PATH];
+    if (!_fullpath(path1, file1.c_str(), _MAX_PATH) ||
+        !_fullpath(path2, file2.c_str(), _MAX_PATH)) { return false; }
+    return _stricmp(path1, path2) == 0;
+#else
+    struct stat info1;
+    struct stat info2;
+    if (stat(file1.c_str(), &info1) != 0 || stat(file2.c_str(), &info2) != 0) { return false; }
+    return info1.st_dev == info2.st_dev && info1.st_ino == info2.st_ino;
+#endif
+}
+
+Batch::Batch(size_t transforms)
+    : cache(transforms)
+{
+}
+
+std::vector<Batch::Result> Batch::run(const std::vector<Batch::Job> &jobs,
+                                      unsigned int workers,
+                                      Batch::Callback callback)
+{
+    std::vector<Batch::Result> results(jobs.size());
+    if (jobs.size()==0) { return results; }
+    if (workers<1) { workers = defaultWorkers(); }
+    if (workers>jobs.size()) { workers = static_cast<unsigned int>(jobs.size()); }
+
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i = next++; i < jobs.size(); i = next++) {
+            results[i] = convert(jobs[i]);
+            results[i].index = i;
+            if (callback) {
+                std::lock_guard<std::mutex> lock(callbackMutex);
+                callback(results[i]);
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < workers; ++i) { threads.push_back(std::thread(worker)); }
+    worker();
+    for (size_t i = 0; i < threads.size(); ++i) { threads[i].join(); }
+
+    return results;
+}
+
+Batch::Result Batch::convert(const Batch::Job &job)
+{
+    Batch::Result result;
+    result.job = job;
+    if (!job.settings) {
+        result.image.error = "Missing conversion settings.";
+        return result;
+    }
+    bool overwrite = job.targets.size()==0 && sameFile(job.input, job.output);
+    for (size_t i = 0; i < job.targets.size(); ++i) {
+        if (sameFile(job.targets.at(i).filename, job.input)) { overwrite = true; }
+    }
+    if (overwrite) {
+        result.image.error = "Refusing to overwrite input file.";
+        return result;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    // same input bytes and settings as an earlier conversion?
+    std::shared_ptr<FXX::ResultCache> resultCache = results;
+    std::vector<std::string> keys;
+    if (resultCache) {
+        if (result.job.inputHash == 0) { result.job.inputHash = FXX::hashFile(job.input); }
+        keys = cacheKeys(job, result.job.inputHash);
+        if (keys.size()>0 && readCache(resultCache.get(), job, keys, &result)) {
+            result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            result.success = true;
+            return result;
+        }
+    }
+
+    {
+        // released when done, also if the conversion throws
+        Batch::MemoryReservation reservation(memoryBudget()>0?estimateMemory(job):0);
+        if (job.targets.size()>0) {
+            result.outputs = FXX::convertFile(job.input,
+                                              job.targets,
+                                              *job.settings,
+                                              &cache);
+            result.image = result.outputs.at(0);
+            result.image.error.clear();
+            for (size_t i = 0; i < result.outputs.size(); ++i) {
+                if (result.outputs.at(i).error.empty()) { continue; }
+                if (!result.image.error.empty()) { result.image.error.append("\n"); }
+                result.image.error.append(result.outputs.at(i).filename + ": " + result.outputs.at(i).error);
+            }
+        } else {
+            result.image = FXX::convertFile(job.input,
+                                            job.output,
+                                            *job.settings,
+                                            &cache,
+                                            job.quality);
+        }
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        result.success = result.image.error.empty();
+    }
+
+    if (result.success && keys.size()>0) {
+        for (size_t i = 0; i < keys.size(); ++i) {
+            resultCache->putFile(keys.at(i), job.targets.size()>0?job.targets.at(i).filename:job.output);
+        }
+    }
+    return result;
+}
+
+FXX::TransformCache *Batch::transformCache()
+{
+    return &cache;
+}
+
+unsigned int Batch::defaultWorkers()
+{
+    unsigned int cores = std::thread::hardware_concurrency();
+    return cores>0?cores:1;
+}
+
+void Batch::setMemoryBudget(unsigned long long bytes)
+{
+    std::lock_guard<std::mutex> lock(memoryMutex);
+    memoryLimit = bytes;
+    memoryCondition.notify_all();
+}
+
+unsigned long long Batch::memoryBudget()
+{
+    std::lock_guard<std::mutex> lock(memoryMutex);
+    return memoryLimit;
+}
+
+void Batch::setResultCache(std::shared_ptr<FXX::ResultCache> cache)
+{
+    results = cache;
+}
+
+// one key per output, empty if the input can't be read
+std::vector<std::string> Batch::cacheKeys(const Batch::Job &job,
+                                          unsigned long long input)
+{
+    std::vector<std::string> keys;
+    if (input == 0) { return keys; }
+    if (job.targets.size()==0) {
+        keys.push_back(FXX::ResultCache::makeKey(input, *job.settings, fileSuffix(job.output), job.quality));
+        return keys;
+    }
+    for (size_t i = 0; i < job.targets.size(); ++i) {
+        const FXX::Target &target = job.targets.at(i);
+        FXX::Image settings = *job.settings;
+        settings.iccOutputBuffer = target.profile;
+        settings.intent = target.intent;
+        settings.blackpoint = target.blackpoint;
+        settings.depth = target.depth;
+        keys.push_back(FXX::ResultCache::makeKey(input, settings, fileSuffix(target.filename), target.quality));
+    }
+    return keys;
+}
+
+// only a hit if every output is cached
+bool Batch::readCache(FXX::ResultCache *cache,
+                      const Batch::Job &job,
+                      const std::vector<std::string> &keys,
+                      Batch::Result *result)
+{
+    std::vector<FXX::Image> outputs;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        FXX::Image output;
+        output.filename = job.targets.size()>0?job.targets.at(i).filename:job.output;
+        output.inkLimit = job.targets.size()>0?job.targets.at(i).inkLimit:job.settings->inkLimit;
+        // the round trip check needs the source, convert again
+        if ((job.targets.size()>0?job.targets.at(i).deltaELimit:job.settings->deltaELimit)>0.0) { return false; }
+        if (!cache->getFile(keys.at(i), output.filename)) { return false; }
+        try {
+            // ink coverage is not cached, it needs the pixels
+            Magick::Image image;
+            if (output.inkLimit>0.0) { image.read(output.filename); }
+            else { image.ping(output.filename); }
+            output.width = image.columns();
+            output.height = image.rows();
+            output.depth = image.depth();
+            if (output.inkLimit>0.0) { output.tac = FXX::getTAC(image, output.inkLimit); }
+        }
+        catch(Magick::Error &error_ ) { output.error = error_.what(); }
+        catch(Magick::Warning &warn_ ) { output.warning = warn_.what(); }
+        if (!output.error.empty()) { return false; }
+        output.warning.append(FXX::getTACWarning(output.tac));
+        outputs.push_back(output);
+    }
+    result->image = outputs.at(0);
+    if (job.targets.size()>0) { result->outputs = outputs; }
+    return true;
+}
+
+// rough peak usage of a job, from the image header only:
+// decoded image + 16-bit work buffer + rendered buffer and image per output
+unsigned long long Batch::estimateMemory(const Batch::Job &job)
+{
+    try {
+        Magick::Image image;
+        image.ping(job.input);
+        unsigned long long pixels = static_cast<unsigned long long>(image.columns()) * image.rows();
+        bool alpha = FXX::hasAlpha(image);
+        unsigned long long channels = static_cast<unsigned long long>(FXX::getColorSpaceChannels(FXX::readImageColorspaceType(image)));
+        if (channels<1) { channels = 4; }
+        if (alpha) { channels++; }
+        unsigned long long depth = std::max(static_cast<unsigned long long>(image.depth()/8),
+                                            static_cast<unsigned long long>(sizeof(Magick::Quantum)));
+        unsigned long long outputs = job.targets.size()>0?job.targets.size():1;
+        unsigned long long outputChannels = alpha?5:4;
+        return pixels*channels*(depth+2) + outputs*pixels*outputChannels*(sizeof(Magick::Quantum)+2);
+    }
+    catch(Magick::Error &error_ ) { std::cout << error_.what() << std::endl; }
+    catch(Magick::Warning &warn_ ) { std::cout << warn_.what() << std::endl; }
+    return 0;
+}
+
+// jobs are admitted in arrival order, a job larger than the budget
+// still runs, but only when nothing else is running
+void Batch::acquireMemory(unsigned long long bytes)
+{
+    if (bytes<1) { return; }
+    std::unique_lock<std::mutex> lock(memoryMutex);
+    unsigned long long ticket = memoryTicket++;
+    memoryCondition.wait(lock, [ticket, bytes]() {
+        return ticket == memoryServing &&
+               (memoryLimit<1 || memoryReserved<1 || memoryReserved+bytes <= memoryLimit);
+    });
+    memoryServing++;
+    memoryReserved += bytes;
+    memoryCondition.notify_all();
+}
+
+void Batch::releaseMemory(unsigned long long bytes)
+{
+    if (bytes<1) { return; }
+    std::lock_guard<std::mutex> lock(memoryMutex);
+    memoryReserved -= bytes;
+    memoryCondition.notify_all();
+}
+
+Batch::MemoryReservation::MemoryReservation(unsigned long long bytes)
+    : bytes(bytes)
+{
+    acquireMemory(bytes);
+}
+
+Batch::MemoryReservation::~MemoryReservation()
+{
+    releaseMemory(bytes);
+}
+
+bool Batch::readPreset(const std::string &name,
+                       Batch::Preset *preset,
+                       std::string *error)
+{
+    std::string file = presetFile(name);
+    std::ifstream stream(file.c_str());
+    if (!stream) {
+        error->append("Unable to open preset " + file);
+        return false;
+    }
+    std::string line;
+    while (std::getline(stream, line)) {
+        size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line.at(start) == '#') { continue; }
+        size_t equal = line.find('=');
+        if (equal == std::string::npos) {
+            error->append("Invalid preset line: " + line);
+            return false;
+        }
+        std::string key = line.substr(start, equal-start);
+        std::string value = line.substr(equal+1);
+        key.erase(key.find_last_not_of(" \t")+1);
+        value.erase(0, value.find_first_not_of(" \t"));
+        value.erase(value.find_last_not_of(" \t\r")+1);
+        if (!setPresetOption(key, value, preset, error)) { return false; }
+    }
+    return true;
+}
+
+bool Batch::setPresetOption(const std::string &key,
+                            const std::string &value,
+                            Batch::Preset *preset,
+                            std::string *error,
+                            Batch::ProfileMap *profiles)
+{
+    std::vector<unsigned char> *profile = nullptr;
+    if (key == "input-profile") { profile = &preset->settings.iccInputBuffer; }
+    else if (key == "output-profile") { profile = &preset->settings.iccOutputBuffer; }
+    else if (key == "rgb") { profile = &preset->settings.iccRGB; }
+    else if (key == "cmyk") { profile = &preset->settings.iccCMYK; }
+    else if (key == "gray") { profile = &preset->settings.iccGRAY; }
+
+    if (profile) {
+        // reuse profiles already read, if given a cache
+        Batch::ProfileMap::const_iterator cached;
+        if (profiles && (cached = profiles->find(value)) != profiles->end()) {
+            *profile = cached->second;
+            return true;
+        }
+        *profile = readFile(value);
+        if (profile->size()==0 ||
+            FXX::getProfileInfo(*profile).colorspace == FXX::UnknownColorSpace) {
+            error->append("Invalid color profile: " + value);
+            return false;
+        }
+        if (profiles) { (*profiles)[value] = *profile; }
+    } else if (key == "intent") {
+        preset->settings.intent = readIntent(value);
+        if (preset->settings.intent == FXX::UndefinedRenderingIntent) {
+            error->append("Unknown rendering intent: " + value);
+            return false;
+        }
+    } else if (key == "black-point") {
+        preset->settings.blackpoint = (value.empty() || value == "1" || value == "true");
+    } else if (key == "depth") {
+        preset->settings.depth = static_cast<size_t>(std::atoi(value.c_str()));
+        if (preset->settings.depth != 8 &&
+            preset->settings.depth != 16 &&
+            preset->settings.depth != 32) {
+            error->append("Unsupported depth: " + value);
+            return false;
+        }
+    } else if (key == "quality") {
+        preset->quality = std::max(0, std::min(100, std::atoi(value.c_str())));
+    } else if (key == "ink-limit") {
+        preset->settings.inkLimit = std::atof(value.c_str());
+        if (preset->settings.inkLimit <= 0.0 || preset->settings.inkLimit > 400.0) {
+            error->append("Invalid ink limit: " + value);
+            return false;
+        }
+    } else if (key == "delta-e") {
+        preset->settings.deltaELimit = std::atof(value.c_str());
+        if (preset->settings.deltaELimit <= 0.0) {
+            error->append("Invalid Delta E limit: " + value);
+            return false;
+        }
+    } else if (key == "format") {
+        preset->format = value;
+    } else {
+        error->append("Unknown option: " + key);
+        return false;
+    }
+    return true;
+}
+
+std::string Batch::presetFile(const std::string &name)
+{
+    if (name.find_first_of("/\\") != std::string::npos) { return name; }
+    const char *home = std::getenv("HOME");
+#ifdef _WIN32
+    if (!home) { home = std::getenv("USERPROFILE"); }
+#endif
+    std::string folder = home?std::string(home):std::string(".");
+    return folder + "/.config/Cyan/presets/" + name + ".conf";
+}
+
+FXX::RenderingIntent Batch::readIntent(const std::string &intent)
+{
+    if (intent == "perceptual") { return FXX::PerceptualRenderingIntent; }
+    else if (intent == "relative") { return FXX::RelativeRenderingIntent; }
+    else if (intent == "saturation") { return FXX::SaturationRenderingIntent; }
+    else if (intent == "absolute") { return FXX::AbsoluteRenderingIntent; }
+    return FXX::UndefinedRenderingIntent;
+}
+
+std::vector<unsigned char> Batch::readFile(const std::string &file)
+{
+    std::vector<unsigned char> result;
+    std::ifstream stream(file.c_str(), std::ios::binary);
+    if (stream) {
+        result.assign(std::istreambuf_iterator<char>(stream),
+                      std::istreambuf_iterator<char>());
+    }
+    return result;
+}
+
+std::string Batch::baseName(const std::string &file)
+{
+    std::string result = file;
+    size_t slash = result.find_last_of("/\\");
+    if (slash != std::string::npos) { result = result.substr(slash+1); }
+    size_t dot = result.find_last_of('.');
+    if (dot != std::string::npos && dot > 0) { result = result.substr(0, dot); }
+    return result;
+}
+
+std::string Batch::fileSuffix(const std::string &file)
+{
+    size_t slash = file.find_last_of("/\\");
+    size_t dot = file.find_last_of('.');
+    if (dot == std::string::npos ||
+        (slash != std::string::npos && dot < slash)) { return std::string(); }
+    return file.substr(dot+1);
+}
+
+bool Batch::readTarget(const std::string &spec,
+                       const Batch::Preset &preset,
+                       FXX::Target *target,
+                       std::string *suffix,
+                       std::string *format,
+                       std::string *error)
+{
+    // profile[,key=value,...]
+    Batch::Preset targetPreset = preset;
+    std::string profile = spec.substr(0, spec.find(','));
+    if (!setPresetOption("output-profile", profile, &targetPreset, error)) { return false; }
+    *suffix = "_" + baseName(profile);
+
+    size_t start = profile.size();
+    while (start < spec.size()) {
+        size_t end = spec.find(',', start+1);
+        if (end == std::string::npos) { end = spec.size(); }
+        std::string option = spec.substr(start+1, end-start-1);
+        start = end;
+        if (option.empty()) { continue; }
+        size_t equal = option.find('=');
+        std::string key = option.substr(0, equal);
+        std::string value = equal == std::string::npos?std::string():option.substr(equal+1);
+        if (key == "suffix") { *suffix = value; }
+        else if (!setPresetOption(key, value, &targetPreset, error)) { return false; }
+    }
+
+    target->profile = targetPreset.settings.iccOutputBuffer;
+    target->intent = targetPreset.settings.intent;
+    target->blackpoint = targetPreset.settings.blackpoint;
+    target->depth = targetPreset.settings.depth;
+    target->quality = targetPreset.quality;
+    target->inkLimit = targetPreset.settings.inkLimit;
+    target->deltaELimit = targetPreset.settings.deltaELimit;
+    *format = targetPreset.format;
+    return true;
+}
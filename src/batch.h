@@ -0,0 +1,156 @@
+/*
+# Copyright Ole-André Rodlie, INRIA.
+#
+# ole.andre.rodlie@gmail.com
+#
+# This software is governed by the CeCILL license under French law and
+# abiding by the rules of distribution of free software. You can use,
+# modify and / or redistribute the software under the terms of the CeCILL
+# license as circulated by CEA, CNRS and INRIA at the following URL
+# "https://www.cecill.info".
+#
+# As a counterpart to the access to the source code and rights to
+# modify and redistribute granted by the license, users are provided only
+# with a limited warranty and the software's author, the holder of the
+# economic rights and the subsequent licensors have only limited
+# liability.
+#
+# In this respect, the user's attention is drawn to the associated risks
+# with loading, using, modifying and / or developing or reproducing the
+# software by the user in light of its specific status of free software,
+# that can mean that it is complicated to manipulate, and that also
+# so that it is for developers and experienced
+# professionals having in-depth computer knowledge. Users are therefore
+# encouraged to test and test the software's suitability
+# Requirements in the conditions of their systems
+# data to be ensured and, more generally, to use and operate
+# same conditions as regards security.
+#
+# The fact that you are presently reading this means that you have had
+# knowledge of the CeCILL license and that you accept its terms.
+*/
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
+#include "FXX.h"
+
+#ifndef RESOURCE_BYTE
+#define RESOURCE_BYTE 1050000000
+#endif
+
+class Batch
+{
+public:
+    struct Job
+    {
+        std::string input;
+        std::string output;
+        std::shared_ptr<const FXX::Image> settings;
+        std::vector<FXX::Target> targets;
+        int quality = 100;
+        unsigned long long inputHash = 0; // FXX::hashFile of input, 0 if not known yet
+    };
+
+    struct Result
+    {
+        Batch::Job job;
+        FXX::Image image;
+        std::vector<FXX::Image> outputs;
+        size_t index = 0;
+        double seconds = 0;
+        bool success = false;
+    };
+
+    struct Preset
+    {
+        FXX::Image settings;
+        std::string format = "tif";
+        int quality = 100;
+    };
+
+    typedef std::function<void(const Batch::Result &result)> Callback;
+    typedef std::map<std::string, std::vector<unsigned char> > ProfileMap;
+
+    Batch(size_t transforms = 16);
+
+    std::vector<Batch::Result> run(const std::vector<Batch::Job> &jobs,
+                                   unsigned int workers = 0,
+                                   Batch::Callback callback = nullptr);
+    Batch::Result convert(const Batch::Job &job);
+
+    FXX::TransformCache *transformCache();
+
+    static unsigned int defaultWorkers();
+    static void setMemoryBudget(unsigned long long bytes);
+    static unsigned long long memoryBudget();
+    static unsigned long long estimateMemory(const Batch::Job &job);
+    static void setResultCache(std::shared_ptr<FXX::ResultCache> cache);
+    static bool readPreset(const std::string &name,
+                           Batch::Preset *preset,
+                           std::string *error);
+    static bool setPresetOption(const std::string &key,
+                                const std::string &value,
+                                Batch::Preset *preset,
+                                std::string *error,
+                                Batch::ProfileMap *profiles = nullptr);
+    static std::string presetFile(const std::string &name);
+    static FXX::RenderingIntent readIntent(const std::string &intent);
+    static std::vector<unsigned char> readFile(const std::string &file);
+    static std::string baseName(const std::string &file);
+    static std::string fileSuffix(const std::string &file);
+    static bool readTarget(const std::string &spec,
+                           const Batch::Preset &preset,
+                           FXX::Target *target,
+                           std::string *suffix,
+                           std::string *format,
+                           std::string *error);
+
+private:
+    FXX::TransformCache cache;
+    std::mutex callbackMutex;
+
+    // memory admission is shared by every batch in the process,
+    // just like the magick resource limits
+    static std::mutex memoryMutex;
+    static std::condition_variable memoryCondition;
+    static unsigned long long memoryLimit;
+    static unsigned long long memoryReserved;
+    static unsigned long long memoryTicket;
+    static unsigned long long memoryServing;
+
+    static void acquireMemory(unsigned long long bytes);
+    static void releaseMemory(unsigned long long bytes);
+
+    // holds a reservation until it goes out of scope, also on exceptions
+    class MemoryReservation
+    {
+    public:
+        explicit MemoryReservation(unsigned long long bytes);
+        ~MemoryReservation();
+
+    private:
+        unsigned long long bytes;
+        MemoryReservation(const MemoryReservation&) = delete;
+        MemoryReservation &operator=(const MemoryReservation&) = delete;
+    };
+
+    static std::shared_ptr<FXX::ResultCache> results;
+
+    static bool readCache(FXX::ResultCache *cache,
+                          const Batch::Job &job,
+                          const std::vector<std::string> &keys,
+                          Batch::Result *result);
+    static std::vector<std::string> cacheKeys(const Batch::Job &job,
+                                              unsigned long long input);
+};
+
+#endif // BATCH_H
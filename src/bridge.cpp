@@ -0,0 +1,187 @@
+/*
+# Copyright Ole-André Rodlie, INRIA.
+#
+# ole.andre.rodlie@gmail.com
+#
+# This software is governed by the CeCILL license under French law and
+# abiding by the rules of distribution of free software. You can use,
+# modify and / or redistribute the software under the terms of the CeCILL
+# license as circulated by CEA, CNRS and INRIA at the following URL
+# "https://www.cecill.info".
+#
+# As a counterpart to the access to the source code and rights to
+# modify and redistribute granted by the license, users are provided only
+# with a limited warranty and the software's author, the holder of the
+# economic rights and the subsequent licensors have only limited
+# liability.
+#
+# In this respect, the user's attention is drawn to the associated risks
+# with loading, using, modifying and / or developing or reproducing the
+# software by the user in light of its specific status of free software,
+# that can mean that it is complicated to manipulate, and that also
+# so that it is for developers and experienced
+# professionals having in-depth computer knowledge. Users are therefore
+# encouraged to test and test the software's suitability
+# Requirements in the conditions of their systems
+# data to be ensured and, more generally, to use and operate
+# same conditions as regards security.
+#
+# The fact that you are presently reading this means that you have had
+# knowledge of the CeCILL license and that you accept its terms.
+*/
+
+#include "bridge.h"
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+Bridge::Bridge(const Batch::Preset &preset,
+               bool proof)
+    : preset(preset)
+    , proof(proof)
+{
+}
+
+int Bridge::exec(std::FILE *input,
+                 std::FILE *output)
+{
+#ifdef _WIN32
+    _setmode(_fileno(input), _O_BINARY);
+    _setmode(_fileno(output), _O_BINARY);
+#endif
+
+    // handle requests until the other end closes the pipe
+    int failed = 0;
+    bool success = true;
+    while (handleRequest(input, output, &success)) {
+        if (!success) { failed++; }
+        std::fflush(output);
+    }
+    return failed>0?1:0;
+}
+
+bool Bridge::handleRequest(std::FILE *input,
+                           std::FILE *output,
+                           bool *success)
+{
+    *success = false;
+    char magic[4];
+    if (std::fread(magic, 1, sizeof(magic), input) != sizeof(magic)) { return false; }
+    if (std::memcmp(magic, BRIDGE_MAGIC, sizeof(magic)) != 0) {
+        writeError(output, "Invalid bridge request.");
+        return false;
+    }
+
+    unsigned int version, width, height, colorspace, alpha, depth, profileLength;
+    if (!readUInt32(input, &version) ||
+        !readUInt32(input, &width) ||
+        !readUInt32(input, &height) ||
+        !readUInt32(input, &colorspace) ||
+        !readUInt32(input, &alpha) ||
+        !readUInt32(input, &depth) ||
+        !readUInt32(input, &profileLength)) { return false; }
+
+    FXX::ColorSpace inputColorSpace = static_cast<FXX::ColorSpace>(colorspace);
+    int channels = FXX::getColorSpaceChannels(inputColorSpace);
+    if (version != BRIDGE_VERSION || channels == 0 ||
+        width<1 || height<1 || width>BRIDGE_MAX_SIZE || height>BRIDGE_MAX_SIZE ||
+        (depth != 8 && depth != 16) || profileLength>BRIDGE_MAX_PROFILE) {
+        // unable to know how much to skip, so stop here
+        writeError(output, "Unsupported bridge request.");
+        return false;
+    }
+
+    std::vector<unsigned char> embeddedProfile(profileLength);
+    if (profileLength>0 &&
+        std::fread(embeddedProfile.data(), 1, profileLength, input) != profileLength) { return false; }
+
+    size_t inputSize = static_cast<size_t>(width) * height * (static_cast<size_t>(channels) + (alpha?1:0)) * (depth/8);
+    std::vector<unsigned char> pixels(inputSize);
+    if (std::fread(pixels.data(), 1, inputSize, input) != inputSize) { return false; }
+
+    // input override, embedded or fallback profile
+    std::vector<unsigned char> inputProfile = preset.settings.iccInputBuffer;
+    if (inputProfile.size()==0) { inputProfile = embeddedProfile; }
+    if (inputProfile.size()==0) {
+        switch (inputColorSpace) {
+        case FXX::RGBColorSpace:
+            inputProfile = preset.settings.iccRGB;
+            break;
+        case FXX::CMYKColorSpace:
+            inputProfile = preset.settings.iccCMYK;
+            break;
+        case FXX::GRAYColorSpace:
+            inputProfile = preset.settings.iccGRAY;
+            break;
+        default:;
+        }
+    }
+    if (inputProfile.size()==0) { return writeError(output, "No input profile!"); }
+    if (FXX::getProfileInfo(inputProfile).colorspace != inputColorSpace) {
+        return writeError(output, "Input profile does not match pixel color space.");
+    }
+    if (preset.settings.iccOutputBuffer.size()==0) { return writeError(output, "Missing output profile."); }
+
+    const std::vector<unsigned char> &resultProfile = proof?inputProfile:preset.settings.iccOutputBuffer;
+    FXX::ColorSpace resultColorSpace = FXX::getProfileInfo(resultProfile).colorspace;
+    size_t resultSize = static_cast<size_t>(width) * height *
+                        (static_cast<size_t>(FXX::getColorSpaceChannels(resultColorSpace)) + (alpha?1:0)) * (depth/8);
+    std::vector<unsigned char> result(resultSize);
+
+    std::string error;
+    if (!FXX::transformPixels(pixels.data(), result.data(),
+                              width, height, depth, alpha != 0,
+                              inputProfile,
+                              preset.settings.iccOutputBuffer,
+                              proof?inputProfile:std::vector<unsigned char>(),
+                              preset.settings.intent,
+                              preset.settings.blackpoint,
+                              &cache, &error)) { return writeError(output, error); }
+    std::vector<unsigned char>().swap(pixels);
+
+    std::fwrite(BRIDGE_MAGIC, 1, 4, output);
+    if (!writeUInt32(output, 0) ||
+        !writeUInt32(output, width) ||
+        !writeUInt32(output, height) ||
+        !writeUInt32(output, static_cast<unsigned int>(resultColorSpace)) ||
+        !writeUInt32(output, alpha?1:0) ||
+        !writeUInt32(output, depth) ||
+        !writeUInt32(output, static_cast<unsigned int>(resultProfile.size()))) { return false; }
+    if (std::fwrite(resultProfile.data(), 1, resultProfile.size(), output) != resultProfile.size() ||
+        std::fwrite(result.data(), 1, result.size(), output) != result.size()) { return false; }
+
+    *success = true;
+    return true;
+}
+
+bool Bridge::writeError(std::FILE *output,
+                        const std::string &message)
+{
+    std::cerr << message << std::endl;
+    std::fwrite(BRIDGE_MAGIC, 1, 4, output);
+    if (!writeUInt32(output, 1) ||
+        !writeUInt32(output, static_cast<unsigned int>(message.size()))) { return false; }
+    return std::fwrite(message.data(), 1, message.size(), output) == message.size();
+}
+
+bool Bridge::readUInt32(std::FILE *input,
+                        unsigned int *value)
+{
+    uint32_t data;
+    if (std::fread(&data, sizeof(data), 1, input) != 1) { return false; }
+    *value = data;
+    return true;
+}
+
+bool Bridge::writeUInt32(std::FILE *output,
+                         unsigned int value)
+{
+    uint32_t data = value;
+    return std::fwrite(&data, sizeof(data), 1, output) == 1;
+}
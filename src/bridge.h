@@ -0,0 +1,88 @@
+/*
+# Copyright Ole-André Rodlie, INRIA.
+#
+# ole.andre.rodlie@gmail.com
+#
+# This software is governed by the CeCILL license under French law and
+# abiding by the rules of distribution of free software. You can use,
+# modify and / or redistribute the software under the terms of the CeCILL
+# license as circulated by CEA, CNRS and INRIA at the following URL
+# "https://www.cecill.info".
+#
+# As a counterpart to the access to the source code and rights to
+# modify and redistribute granted by the license, users are provided only
+# with a limited warranty and the software's author, the holder of the
+# economic rights and the subsequent licensors have only limited
+# liability.
+#
+# In this respect, the user's attention is drawn to the associated risks
+# with loading, using, modifying and / or developing or reproducing the
+# software by the user in light of its specific status of free software,
+# that can mean that it is complicated to manipulate, and that also
+# so that it is for developers and experienced
+# professionals having in-depth computer knowledge. Users are therefore
+# encouraged to test and test the software's suitability
+# Requirements in the conditions of their systems
+# data to be ensured and, more generally, to use and operate
+# same conditions as regards security.
+#
+# The fact that you are presently reading this means that you have had
+# knowledge of the CeCILL license and that you accept its terms.
+*/
+
+#ifndef BRIDGE_H
+#define BRIDGE_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "batch.h"
+
+#define BRIDGE_MAGIC "CYAN"
+#define BRIDGE_VERSION 1
+#define BRIDGE_MAX_SIZE 65535
+#define BRIDGE_MAX_PROFILE 67108864
+
+/*
+ * Binary pixel bridge used by the GIMP plug-in.
+ *
+ * Request:  "CYAN", version, width, height, colorspace, alpha, depth,
+ *           profile length, profile, pixels
+ * Response: "CYAN", status (0 = ok), then either width, height,
+ *           colorspace, alpha, depth, profile length, profile, pixels
+ *           or message length, message
+ *
+ * Integers are unsigned 32-bit and, like 16-bit samples, use the
+ * byte order of the host. Pixels are interleaved, alpha last.
+ * Width and height are at most BRIDGE_MAX_SIZE, the profile at most
+ * BRIDGE_MAX_PROFILE bytes.
+ */
+
+class Bridge
+{
+public:
+    Bridge(const Batch::Preset &preset,
+           bool proof = false);
+
+    int exec(std::FILE *input = stdin,
+             std::FILE *output = stdout);
+
+private:
+    Batch::Preset preset;
+    bool proof;
+    FXX::TransformCache cache;
+
+    bool handleRequest(std::FILE *input,
+                       std::FILE *output,
+                       bool *success);
+    bool writeError(std::FILE *output,
+                    const std::string &message);
+
+    static bool readUInt32(std::FILE *input,
+                           unsigned int *value);
+    static bool writeUInt32(std::FILE *output,
+                            unsigned int value);
+};
+
+#endif // BRIDGE_H
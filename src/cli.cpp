@@ -0,0 +1,408 @@
+/*
+# Copyright Ole-André Rodlie, INRIA.
+#
+# ole.andre.rodlie@gmail.com
+#
+# This software is governed by the CeCILL license under French law and
+# abiding by the rules of distribution of free software. You can use,
+# modify and / or redistribute the software under the terms of the CeCILL
+# license as circulated by CEA, CNRS and INRIA at the following URL
+# "https://www.cecill.info".
+#
+# As a counterpart to the access to the source code and rights to
+# modify and redistribute granted by the license, users are provided only
+# with a limited warranty and the software's author, the holder of the
+# economic rights and the subsequent licensors have only limited
+# liability.
+#
+# In this respect, the user's attention is drawn to the associated risks
+# with loading, using, modifying and / or developing or reproducing the
+# software by the user in light of its specific status of free software,
+# that can mean that it is complicated to manipulate, and that also
+# so that it is for developers and experienced
+# professionals having in-depth computer knowledge. Users are therefore
+# encouraged to test and test the software's suitability
+# Requirements in the conditions of their systems
+# data to be ensured and, more generally, to use and operate
+# same conditions as regards security.
+#
+# The fact that you are presently reading this means that you have had
+# knowledge of the CeCILL license and that you accept its terms.
+*/
+
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "batch.h"
+#include "bridge.h"
+#include "hotfolder.h"
+#include "manifest.h"
+#include "journal.h"
+#ifndef _WIN32
+#include "service.h"
+#endif
+#include "FXX.h"
+
+#ifndef CYAN_VERSION
+#define CYAN_VERSION "unknown"
+#endif
+
+static void printAnalysis(const FXX::Image &image)
+{
+    if (image.tac.pixels>0) {
+        std::cout << "  TAC max " << image.tac.max << "%, p99 " << image.tac.p99
+                  << "%, " << image.tac.over << " pixels over " << image.tac.limit << "%" << std::endl;
+    }
+    if (image.deltaE.pixels>0) {
+        std::cout << "  Delta E 2000 mean " << image.deltaE.mean << ", p95 " << image.deltaE.p95
+                  << ", max " << image.deltaE.max << ", " << image.deltaE.over << " pixels over " << image.deltaE.limit << std::endl;
+    }
+}
+
+static void usage()
+{
+    std::cout << "Cyan " << CYAN_VERSION << " command line converter" << std::endl << std::endl;
+    std::cout << "Usage: cyan-cli [options] file [file ...]" << std::endl;
+    std::cout << "       cyan-cli --watch <dir> --output <dir> --error <dir> [options]" << std::endl;
+    std::cout << "       cyan-cli --manifest <json> [--report <file>] [options]" << std::endl << std::endl;
+    std::cout << "  -i, --input-profile <icc>   Input profile (overrides embedded)" << std::endl;
+    std::cout << "  -p, --output-profile <icc>  Output profile (required)" << std::endl;
+    std::cout << "      --rgb <icc>             Fallback RGB input profile" << std::endl;
+    std::cout << "      --cmyk <icc>            Fallback CMYK input profile" << std::endl;
+    std::cout << "      --gray <icc>            Fallback GRAY input profile" << std::endl;
+    std::cout << "  -r, --intent <intent>       perceptual, relative, saturation or absolute" << std::endl;
+    std::cout << "  -b, --black-point           Enable black point compensation" << std::endl;
+    std::cout << "  -d, --depth <bits>          Output bit depth (8, 16 or 32)" << std::endl;
+    std::cout << "  -q, --quality <0-100>       Output quality (default 100)" << std::endl;
+    std::cout << "      --ink-limit <percent>   Report total ink coverage of CMYK output" << std::endl;
+    std::cout << "      --delta-e <limit>       Fail if 5% of pixels are further than limit" << std::endl;
+    std::cout << "                              from the source (round trip Delta E 2000)" << std::endl;
+    std::cout << "  -t, --target <icc>[,key=value,...]" << std::endl;
+    std::cout << "                              Add output (repeatable), decodes input once" << std::endl;
+    std::cout << "                              keys: intent, black-point, depth, quality," << std::endl;
+    std::cout << "                              ink-limit, delta-e, format and suffix (default _<profile>)" << std::endl;
+    std::cout << "  -o, --output <dir>          Output folder (default same as input)" << std::endl;
+    std::cout << "  -f, --format <suffix>       Output format (default tif)" << std::endl;
+    std::cout << "  -j, --jobs <n>              Parallel workers (default number of cores)" << std::endl;
+    std::cout << "  -m, --memory <GiB>          Memory budget, jobs only start if they fit" << std::endl;
+    std::cout << "      --cache <dir>           Reuse earlier results, folder can be shared" << std::endl;
+    std::cout << "      --cache-size <GiB>      Cache size (default " << RESULT_CACHE_SIZE/RESOURCE_BYTE << ")" << std::endl;
+    std::cout << "  -P, --preset <name|file>    Load options from preset" << std::endl;
+    std::cout << "                              (~/.config/Cyan/presets/<name>.conf)" << std::endl;
+    std::cout << "  -w, --watch <dir>           Convert files dropped into folder" << std::endl;
+    std::cout << "  -e, --error <dir>           Folder for files that failed (with --watch)" << std::endl;
+    std::cout << "      --interval <ms>         Watch poll interval (default " << HOTFOLDER_INTERVAL << ")" << std::endl;
+    std::cout << "  -M, --manifest <json>       Run jobs from manifest" << std::endl;
+    std::cout << "      --report <file>         Write manifest results as JSON lines (default stdout)" << std::endl;
+    std::cout << "      --journal <file>        Record finished jobs, skip them when run again" << std::endl;
+    std::cout << "      --bridge                Convert raw pixels from stdin to stdout" << std::endl;
+    std::cout << "      --proof                 Convert back to input profile (with --bridge)" << std::endl;
+#ifndef _WIN32
+    std::cout << "      --serve                 Run as resident service on a local socket" << std::endl;
+    std::cout << "      --connect               Send files to a running service" << std::endl;
+    std::cout << "      --socket <path>         Service socket (default " << Service::defaultSocket() << ")" << std::endl;
+#endif
+    std::cout << "  -h, --help                  Show this help" << std::endl;
+}
+
+static void handleSignal(int)
+{
+    HotFolder::stop();
+#ifndef _WIN32
+    Service::stop();
+#endif
+}
+
+int main(int argc, char *argv[])
+{
+    Magick::InitializeMagick(argv[0]);
+
+    Batch::Preset preset;
+    std::vector<std::string> files;
+    std::string outputFolder;
+    std::string watchFolder;
+    std::string errorFolder;
+    std::string manifestFile;
+    std::string reportFile;
+    std::string journalFile;
+    std::string cacheFolder;
+    unsigned long long cacheSize = RESULT_CACHE_SIZE;
+    std::string socketPath;
+    bool serve = false;
+    bool bridge = false;
+    bool proof = false;
+    bool connect = false;
+    std::vector<std::pair<std::string, std::string> > options;
+    std::vector<std::string> targetSpecs;
+    unsigned int workers = Batch::defaultWorkers();
+    int interval = HOTFOLDER_INTERVAL;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i+1 < argc;
+        std::string key;
+        if (arg == "-h" || arg == "--help") {
+            usage();
+            return 0;
+        } else if (arg == "-b" || arg == "--black-point") {
+            preset.settings.blackpoint = true;
+            options.push_back(std::make_pair("black-point", "true"));
+        } else if (arg == "--bridge") {
+            bridge = true;
+        } else if (arg == "--proof") {
+            proof = true;
+        } else if (arg == "--serve") {
+            serve = true;
+        } else if (arg == "--connect") {
+            connect = true;
+        } else if (arg.size()>1 && arg.at(0) == '-' && !hasValue) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return 1;
+        } else if (arg == "-i" || arg == "--input-profile") {
+            key = "input-profile";
+        } else if (arg == "-p" || arg == "--output-profile") {
+            key = "output-profile";
+        } else if (arg == "--rgb" || arg == "--cmyk" || arg == "--gray") {
+            key = arg.substr(2);
+        } else if (arg == "-r" || arg == "--intent") {
+            key = "intent";
+        } else if (arg == "-d" || arg == "--depth") {
+            key = "depth";
+        } else if (arg == "-q" || arg == "--quality") {
+            key = "quality";
+        } else if (arg == "--ink-limit") {
+            key = "ink-limit";
+        } else if (arg == "--delta-e") {
+            key = "delta-e";
+        } else if (arg == "-f" || arg == "--format") {
+            key = "format";
+        } else if (arg == "-P" || arg == "--preset") {
+            std::string error;
+            if (!Batch::readPreset(argv[++i], &preset, &error)) {
+                std::cerr << error << std::endl;
+                return 1;
+            }
+            options.push_back(std::make_pair("preset", Batch::presetFile(argv[i])));
+        } else if (arg == "-t" || arg == "--target") {
+            targetSpecs.push_back(argv[++i]);
+        } else if (arg == "-o" || arg == "--output") {
+            outputFolder = argv[++i];
+        } else if (arg == "-w" || arg == "--watch") {
+            watchFolder = argv[++i];
+        } else if (arg == "-e" || arg == "--error") {
+            errorFolder = argv[++i];
+        } else if (arg == "-M" || arg == "--manifest") {
+            manifestFile = argv[++i];
+        } else if (arg == "--report") {
+            reportFile = argv[++i];
+        } else if (arg == "--journal") {
+            journalFile = argv[++i];
+        } else if (arg == "--cache") {
+            cacheFolder = argv[++i];
+        } else if (arg == "--cache-size") {
+            int gib = std::atoi(argv[++i]);
+            if (gib>0) { cacheSize = static_cast<unsigned long long>(gib) * RESOURCE_BYTE; }
+        } else if (arg == "-m" || arg == "--memory") {
+            int gib = std::atoi(argv[++i]);
+            if (gib>0) {
+                Magick::ResourceLimits::memory(static_cast<unsigned long long>(gib) * RESOURCE_BYTE);
+                Batch::setMemoryBudget(static_cast<unsigned long long>(gib) * RESOURCE_BYTE);
+            }
+        } else if (arg == "--socket") {
+            socketPath = argv[++i];
+        } else if (arg == "--interval") {
+            interval = std::max(100, std::atoi(argv[++i]));
+        } else if (arg == "-j" || arg == "--jobs") {
+            int jobs = std::atoi(argv[++i]);
+            workers = jobs>0?static_cast<unsigned int>(jobs):1;
+        } else if (arg.size()>1 && arg.at(0) == '-') {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return 1;
+        } else {
+            files.push_back(arg);
+        }
+        if (!key.empty()) {
+            std::string error;
+            if (!Batch::setPresetOption(key, argv[++i], &preset, &error)) {
+                std::cerr << error << std::endl;
+                return 1;
+            }
+            options.push_back(std::make_pair(key, std::string(argv[i])));
+        }
+    }
+
+    // don't let every worker spawn a full set of magick threads
+    unsigned int magickThreads = Batch::defaultWorkers()/workers;
+    Magick::ResourceLimits::thread(magickThreads>0?magickThreads:1);
+
+    if (!cacheFolder.empty()) {
+        Batch::setResultCache(std::make_shared<FXX::ResultCache>(cacheFolder, cacheSize));
+    }
+
+    if (bridge) {
+        Bridge pixelBridge(preset, proof);
+        return pixelBridge.exec();
+    }
+
+#ifndef _WIN32
+    if (socketPath.empty()) { socketPath = Service::defaultSocket(); }
+    if (serve) {
+        std::signal(SIGINT, handleSignal);
+        std::signal(SIGTERM, handleSignal);
+        Service service(socketPath, preset, workers);
+        return service.exec();
+    }
+#else
+    if (serve || connect) {
+        std::cerr << "Service mode is not supported on this platform." << std::endl;
+        return 1;
+    }
+#endif
+
+    if (files.size()==0 && watchFolder.empty() && manifestFile.empty()) {
+        usage();
+        return 1;
+    }
+
+    std::vector<FXX::Target> targets;
+    std::vector<std::string> targetNames;
+    for (size_t i = 0; i < targetSpecs.size(); ++i) {
+        FXX::Target target;
+        std::string suffix, format, error;
+        if (!Batch::readTarget(targetSpecs.at(i), preset, &target, &suffix, &format, &error)) {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+        targets.push_back(target);
+        targetNames.push_back(suffix + "." + format);
+    }
+    if (targets.size()>0 && (connect || !watchFolder.empty() || !manifestFile.empty())) {
+        std::cerr << "Multiple targets are only supported for files." << std::endl;
+        return 1;
+    }
+    if (!journalFile.empty() && (connect || !watchFolder.empty())) {
+        std::cerr << "A journal is only supported for files and manifests." << std::endl;
+        return 1;
+    }
+
+    Journal journal(journalFile);
+    if (!journalFile.empty()) {
+        std::string error;
+        if (!journal.open(&error)) {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+    }
+
+    if (!manifestFile.empty()) {
+        Manifest manifest(preset);
+        std::string error;
+        if (!manifest.read(manifestFile, &error)) {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+        Journal *manifestJournal = journalFile.empty()?nullptr:&journal;
+        if (reportFile.empty()) { return manifest.exec(workers, std::cout, manifestJournal); }
+        std::ofstream report(reportFile.c_str());
+        if (!report) {
+            std::cerr << "Unable to write report " << reportFile << std::endl;
+            return 1;
+        }
+        return manifest.exec(workers, report, manifestJournal);
+    }
+
+    if (!connect && targetSpecs.size()==0 && preset.settings.iccOutputBuffer.size()==0) {
+        std::cerr << "Missing output profile." << std::endl;
+        return 1;
+    }
+
+    if (!watchFolder.empty()) {
+        if (outputFolder.empty() || errorFolder.empty()) {
+            std::cerr << "Watching a folder requires --output and --error." << std::endl;
+            return 1;
+        }
+        std::signal(SIGINT, handleSignal);
+        std::signal(SIGTERM, handleSignal);
+        HotFolder hotFolder(watchFolder, outputFolder, errorFolder, preset, workers);
+        return hotFolder.exec(interval);
+    }
+
+    std::shared_ptr<const FXX::Image> jobSettings = std::make_shared<const FXX::Image>(preset.settings);
+    std::vector<Batch::Job> jobs;
+    for (size_t i = 0; i < files.size(); ++i) {
+        std::string folder = outputFolder;
+        if (folder.empty()) {
+            size_t slash = files.at(i).find_last_of("/\\");
+            if (slash != std::string::npos) { folder = files.at(i).substr(0, slash); }
+        }
+        std::string base = (folder.empty()?std::string():folder + "/") + Batch::baseName(files.at(i));
+        Batch::Job job;
+        job.input = files.at(i);
+        job.output = base + "." + preset.format;
+        job.settings = jobSettings;
+        job.quality = preset.quality;
+        job.targets = targets;
+        for (size_t t = 0; t < job.targets.size(); ++t) { job.targets[t].filename = base + targetNames.at(t); }
+        jobs.push_back(job);
+    }
+#ifndef _WIN32
+    if (connect) {
+        // the service runs elsewhere, so send absolute paths
+        std::vector<Service::Request> requests;
+        for (size_t i = 0; i < jobs.size(); ++i) {
+            Service::Request request;
+            for (size_t o = 0; o < options.size(); ++o) {
+                bool isPath = options.at(o).first.find("profile") != std::string::npos ||
+                              options.at(o).first == "rgb" ||
+                              options.at(o).first == "cmyk" ||
+                              options.at(o).first == "gray" ||
+                              options.at(o).first == "preset";
+                request.push_back(std::make_pair(options.at(o).first,
+                                                 isPath?Service::absolutePath(options.at(o).second):options.at(o).second));
+            }
+            request.push_back(std::make_pair("input", Service::absolutePath(jobs.at(i).input)));
+            request.push_back(std::make_pair("output", Service::absolutePath(jobs.at(i).output)));
+            requests.push_back(request);
+        }
+        return Service::request(socketPath, requests, workers);
+    }
+#endif
+
+    if (!journalFile.empty()) {
+        std::vector<Batch::Job> pending;
+        for (size_t i = 0; i < jobs.size(); ++i) {
+            if (journal.isDone(&jobs.at(i))) {
+                std::cout << jobs.at(i).input << ": already done, skipped" << std::endl;
+                continue;
+            }
+            pending.push_back(jobs.at(i));
+        }
+        jobs.swap(pending);
+    }
+
+    Batch batch;
+    int failed = 0;
+    batch.run(jobs, workers, [&](const Batch::Result &result) {
+        if (!journalFile.empty()) { journal.record(result); }
+        if (result.success) {
+            for (size_t i = 0; i < result.outputs.size(); ++i) {
+                std::cout << result.job.input << " -> " << result.outputs.at(i).filename << std::endl;
+                printAnalysis(result.outputs.at(i));
+            }
+            std::cout << result.job.input << " -> " << (result.outputs.size()>0?std::to_string(result.outputs.size()) + " outputs":result.job.output) << " (" << result.seconds << "s)" << std::endl;
+            if (result.outputs.size()==0) { printAnalysis(result.image); }
+            if (!result.image.warning.empty()) { std::cout << result.image.warning << std::endl; }
+        } else {
+            std::cerr << result.job.input << ": " << result.image.error << std::endl;
+            failed++;
+        }
+    });
+
+    return failed>0?1:0;
+}
@@ -0,0 +1,248 @@
+/*
+# Copyright Ole-André Rodlie, INRIA.
+#
+# ole.andre.rodlie@gmail.com
+#
+# This software is governed by the CeCILL license under French law and
+# abiding by the rules of distribution of free software. You can use,
+# modify and / or redistribute the software under the terms of the CeCILL
+# license as circulated by CEA, CNRS and INRIA at the following URL
+# "https://www.cecill.info".
+#
+# As a counterpart to the access to the source code and rights to
+# modify and redistribute granted by the license, users are provided only
+# with a limited warranty and the software's author, the holder of the
+# economic rights and the subsequent licensors have only limited
+# liability.
+#
+# In this respect, the user's attention is drawn to the associated risks
+# with loading, using, modifying and / or developing or reproducing the
+# software by the user in light of its specific status of free software,
+# that can mean that it is complicated to manipulate, and that also
+# so that it is for developers and experienced
+# professionals having in-depth computer knowledge. Users are therefore
+# encouraged to test and test the software's suitability
+# Requirements in the conditions of their systems
+# data to be ensured and, more generally, to use and operate
+# same conditions as regards security.
+#
+# The fact that you are presently reading this means that you have had
+# knowledge of the CeCILL license and that you accept its terms.
+*/
+
+#include "comparedialog.h"
+#include "tileditem.h"
+#include <QHBoxLayout>
+#include <QVBoxLayout>
+#include <QGraphicsScene>
+#include <QtConcurrent>
+#include <cmath>
+
+// action data for the source variant, others are intent*2+blackpoint
+#define SOURCE_VARIANT -1
+
+CompareDialog::CompareDialog(QWidget *parent,
+                             const FXX::Image &settings,
+                             FXX::TransformCache *cache)
+    : QDialog(parent)
+    , closeButton(Q_NULLPTR)
+    , _settings(settings)
+    , _cache(cache)
+    , variantsButton(Q_NULLPTR)
+    , variantsMenu(Q_NULLPTR)
+    , statusLabel(Q_NULLPTR)
+    , viewLayout(Q_NULLPTR)
+    , pendingVariants(false)
+{
+    setWindowTitle(tr("Compare"));
+    setWindowIcon(QIcon(":/cyan.png"));
+    setAttribute(Qt::WA_DeleteOnClose, true);
+    resize(1024, 768);
+
+    QFrame *buttonFrame = new QFrame(this);
+    QFrame *viewFrame = new QFrame(this);
+
+    QVBoxLayout *mainLayout = new QVBoxLayout(this);
+    QHBoxLayout *buttonLayout = new QHBoxLayout(buttonFrame);
+    viewLayout = new QGridLayout(viewFrame);
+
+    mainLayout->setContentsMargins(0, 0, 0, 0);
+    mainLayout->setSpacing(0);
+    viewLayout->setContentsMargins(0, 0, 0, 0);
+    viewLayout->setSpacing(2);
+
+    variantsMenu = new QMenu(this);
+    variantsButton = new QPushButton(this);
+    variantsButton->setText(tr("Variants"));
+    variantsButton->setMenu(variantsMenu);
+
+    statusLabel = new QLabel(this);
+
+    closeButton = new QPushButton(this);
+    closeButton->setText(tr("Close"));
+
+    buttonLayout->addWidget(variantsButton);
+    buttonLayout->addWidget(statusLabel);
+    buttonLayout->addStretch();
+    buttonLayout->addWidget(closeButton);
+
+    mainLayout->addWidget(viewFrame, 1);
+    mainLayout->addWidget(buttonFrame);
+
+    addVariant(tr("Source"), SOURCE_VARIANT, false, true);
+    addVariant(tr("Perceptual"), FXX::PerceptualRenderingIntent, false, true);
+    addVariant(tr("Perceptual + BPC"), FXX::PerceptualRenderingIntent, true, false);
+    addVariant(tr("Relative"), FXX::RelativeRenderingIntent, false, true);
+    addVariant(tr("Relative + BPC"), FXX::RelativeRenderingIntent, true, true);
+    addVariant(tr("Saturation"), FXX::SaturationRenderingIntent, false, false);
+    addVariant(tr("Saturation + BPC"), FXX::SaturationRenderingIntent, true, false);
+    addVariant(tr("Absolute"), FXX::AbsoluteRenderingIntent, false, false);
+    addVariant(tr("Absolute + BPC"), FXX::AbsoluteRenderingIntent, true, false);
+
+    connect(closeButton, SIGNAL(released()),
+            this, SLOT(close()));
+    connect(&variantsWatcher, SIGNAL(finished()),
+            this, SLOT(handleVariantsWatcher()));
+
+    updateVariants();
+}
+
+void CompareDialog::addVariant(const QString &title,
+                               int intent,
+                               bool blackpoint,
+                               bool checked)
+{
+    QAction *action = new QAction(title, this);
+    action->setCheckable(true);
+    action->setData(intent == SOURCE_VARIANT ? SOURCE_VARIANT : intent * 2 + (blackpoint?1:0));
+    // nothing to compare against without an output profile
+    if (intent != SOURCE_VARIANT && _settings.iccOutputBuffer.size()==0) {
+        action->setDisabled(true);
+        checked = false;
+    }
+    action->setChecked(checked);
+    connect(action, SIGNAL(toggled(bool)),
+            this, SLOT(updateVariants()));
+    variantsMenu->addAction(action);
+}
+
+// all checked variants are converted in one go from the same source
+void CompareDialog::updateVariants()
+{
+    if (variantsWatcher.isRunning()) {
+        pendingVariants = true;
+        return;
+    }
+    std::vector<FXX::Target> variants;
+    variantTitles.clear();
+    QList<QAction*> actions = variantsMenu->actions();
+    for (int i = 0; i < actions.size(); ++i) {
+        if (!actions.at(i)->isChecked()) { continue; }
+        int data = actions.at(i)->data().toInt();
+        FXX::Target variant;
+        if (data == SOURCE_VARIANT) {
+            variant.intent = _settings.intent;
+            variant.blackpoint = _settings.blackpoint;
+        } else {
+            variant.profile = _settings.iccOutputBuffer;
+            variant.intent = static_cast<FXX::RenderingIntent>(data / 2);
+            variant.blackpoint = data % 2 == 1;
+        }
+        variants.push_back(variant);
+        variantTitles << actions.at(i)->text();
+    }
+    if (variants.size()==0) {
+        clearViews();
+        return;
+    }
+    statusLabel->setText(tr("Converting ..."));
+    variantsWatcher.setFuture(QtConcurrent::run(FXX::convertVariants,
+                                                _settings,
+                                                variants,
+                                                _cache));
+}
+
+void CompareDialog::handleVariantsWatcher()
+{
+    statusLabel->clear();
+    if (pendingVariants) {
+        pendingVariants = false;
+        updateVariants();
+        return;
+    }
+
+    // keep the current pan and zoom if we have one
+    bool keepView = views.size()>0 && !views.first()->fit;
+    QTransform transform;
+    QPointF center;
+    if (keepView) {
+        transform = views.first()->transform();
+        center = views.first()->visibleRect().center();
+    }
+    clearViews();
+
+    std::vector<FXX::Image> results = variantsWatcher.result();
+    int columns = static_cast<int>(std::ceil(std::sqrt(static_cast<double>(results.size()))));
+    for (int i = 0; i < static_cast<int>(results.size()) && i < variantTitles.size(); ++i) {
+        const FXX::Image &result = results.at(static_cast<size_t>(i));
+        QFrame *panel = new QFrame(this);
+        QVBoxLayout *panelLayout = new QVBoxLayout(panel);
+        panelLayout->setContentsMargins(0, 0, 0, 0);
+        panelLayout->setSpacing(0);
+
+        QLabel *title = new QLabel(panel);
+        title->setText(result.error.empty() ? variantTitles.at(i) :
+                                              QString("%1: %2").arg(variantTitles.at(i))
+                                                               .arg(QString::fromStdString(result.error)));
+        ImageView *view = new ImageView(panel);
+        QGraphicsScene *scene = new QGraphicsScene(view);
+        view->setScene(scene);
+        view->setAcceptDrops(false);
+        if (result.previewBuffer.size()>0) {
+            TiledImageItem *item = new TiledImageItem();
+            item->setImage(QImage::fromData(result.previewBuffer.data(),
+                                            static_cast<int>(result.previewBuffer.size())));
+            scene->addItem(item);
+            scene->setSceneRect(item->boundingRect());
+        }
+        view->fit = !keepView;
+
+        panelLayout->addWidget(title);
+        panelLayout->addWidget(view, 1);
+        viewLayout->addWidget(panel, i / columns, i % columns);
+
+        connect(view, SIGNAL(viewMoved(QTransform,QPointF)),
+                this, SLOT(syncViews(QTransform,QPointF)));
+        connect(view, SIGNAL(resetZoom()),
+                this, SLOT(resetViews()));
+        views << view;
+        if (keepView) { view->syncView(transform, center); }
+    }
+}
+
+void CompareDialog::clearViews()
+{
+    views.clear();
+    while (QLayoutItem *item = viewLayout->takeAt(0)) {
+        delete item->widget();
+        delete item;
+    }
+}
+
+// pan and zoom all views together
+void CompareDialog::syncViews(const QTransform &transform,
+                              const QPointF &center)
+{
+    for (int i = 0; i < views.size(); ++i) {
+        if (views.at(i) == sender()) { continue; }
+        views.at(i)->syncView(transform, center);
+    }
+}
+
+void CompareDialog::resetViews()
+{
+    ImageView *view = qobject_cast<ImageView*>(sender());
+    if (!view) { return; }
+    QPointF center = view->visibleRect().center();
+    for (int i = 0; i < views.size(); ++i) { views.at(i)->syncView(QTransform(), center); }
+}
@@ -0,0 +1,83 @@
+/*
+# Copyright Ole-André Rodlie, INRIA.
+#
+# ole.andre.rodlie@gmail.com
+#
+# This software is governed by the CeCILL license under French law and
+# abiding by the rules of distribution of free software. You can use,
+# modify and / or redistribute the software under the terms of the CeCILL
+# license as circulated by CEA, CNRS and INRIA at the following URL
+# "https://www.cecill.info".
+#
+# As a counterpart to the access to the source code and rights to
+# modify and redistribute granted by the license, users are provided only
+# with a limited warranty and the software's author, the holder of the
+# economic rights and the subsequent licensors have only limited
+# liability.
+#
+# In this respect, the user's attention is drawn to the associated risks
+# with loading, using, modifying and / or developing or reproducing the
+# software by the user in light of its specific status of free software,
+# that can mean that it is complicated to manipulate, and that also
+# so that it is for developers and experienced
+# professionals having in-depth computer knowledge. Users are therefore
+# encouraged to test and test the software's suitability
+# Requirements in the conditions of their systems
+# data to be ensured and, more generally, to use and operate
+# same conditions as regards security.
+#
+# The fact that you are presently reading this means that you have had
+# knowledge of the CeCILL license and that you accept its terms.
+*/
+
+#ifndef COMPAREDIALOG_H
+#define COMPAREDIALOG_H
+
+#include <QDialog>
+#include <QPushButton>
+#include <QLabel>
+#include <QMenu>
+#include <QAction>
+#include <QList>
+#include <QStringList>
+#include <QGridLayout>
+#include <QFutureWatcher>
+#include <QTransform>
+#include "imageview.h"
+#include "FXX.h"
+
+class CompareDialog : public QDialog
+{
+    Q_OBJECT
+
+public:
+    CompareDialog(QWidget *parent = Q_NULLPTR,
+                  const FXX::Image &settings = FXX::Image(),
+                  FXX::TransformCache *cache = Q_NULLPTR);
+    QPushButton *closeButton;
+
+private:
+    FXX::Image _settings;
+    FXX::TransformCache *_cache;
+    QPushButton *variantsButton;
+    QMenu *variantsMenu;
+    QLabel *statusLabel;
+    QGridLayout *viewLayout;
+    QList<ImageView*> views;
+    QStringList variantTitles;
+    QFutureWatcher<std::vector<FXX::Image> > variantsWatcher;
+    bool pendingVariants;
+
+private slots:
+    void addVariant(const QString &title,
+                    int intent,
+                    bool blackpoint,
+                    bool checked);
+    void updateVariants();
+    void handleVariantsWatcher();
+    void clearViews();
+    void syncViews(const QTransform &transform,
+                   const QPointF &center);
+    void resetViews();
+};
+#endif // COMPAREDIALOG_H
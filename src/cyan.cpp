@@ -53,14 +53,182 @@
 #include <QMimeData>
 #include <QMimeDatabase>
 #include <QMimeType>
+#include <QStatusBar>
+#include <QFontDatabase>
 #include <qtconcurrentrun.h>
+#include <qtconcurrentmap.h>
+#include <cmath>
 
 #include "helpdialog.h"
+#include "openlayerdialog.h"
+#include "comparedialog.h"
+
+static FXX::ProfileInfo readProfileInfo(const QString &file)
+{
+    return FXX::getProfileInfo(file.toStdString());
+}
+
+static FXX::Image convertImage(FXX::Image image,
+                               std::shared_ptr<FXX::PCSImage> pcs,
+                               FXX::TransformCache *cache,
+                               std::shared_ptr<FXX::ResultCache> results)
+{
+    if (!results) { return FXX::convertImage(image, pcs, cache, false); }
+
+    // reuse an earlier conversion of the same pixels and settings
+    unsigned long long input = FXX::hash(image.imageBuffer);
+    std::string imageKey = FXX::ResultCache::makeKey(input, image, "miff");
+    std::string previewKey = FXX::ResultCache::makeKey(input, image, "preview");
+    FXX::Image output;
+    if (results->get(imageKey, &output.imageBuffer) &&
+        results->get(previewKey, &output.previewBuffer)) { return output; }
+
+    output = FXX::convertImage(image, pcs, cache, false);
+    if (output.error.empty()) {
+        results->put(imageKey, output.imageBuffer);
+        results->put(previewKey, output.previewBuffer);
+    }
+    return output;
+}
+
+static FXX::Image convertRegion(FXX::Image image,
+                                std::shared_ptr<FXX::PCSImage> pcs,
+                                FXX::TransformCache *cache,
+                                QRect region,
+                                int step)
+{
+    return FXX::convertRegion(image, pcs, cache,
+                              static_cast<size_t>(region.x()),
+                              static_cast<size_t>(region.y()),
+                              static_cast<size_t>(region.width()),
+                              static_cast<size_t>(region.height()),
+                              static_cast<size_t>(step));
+}
+
+// starts from the previous probe, unchanged planes (and their stats)
+// are reused, so after a conversion only the output is decoded.
+// image holds the source (imageBuffer), the converted (workBuffer),
+// their profiles and the ink limit, compare adds the round trip Delta E
+static std::shared_ptr<FXX::PixelProbe> buildPixelProbe(std::shared_ptr<FXX::PixelProbe> previous,
+                                                        FXX::Image image,
+                                                        bool compare,
+                                                        FXX::TransformCache *cache)
+{
+    std::shared_ptr<FXX::PixelProbe> probe = previous ? std::make_shared<FXX::PixelProbe>(*previous) :
+                                                        std::make_shared<FXX::PixelProbe>();
+    std::string error;
+    if (!probe->setSource(image.imageBuffer, image.iccInputBuffer, &error)) {
+        qWarning() << QString::fromStdString(error);
+        return std::shared_ptr<FXX::PixelProbe>();
+    }
+    if (!probe->setOutput(image.workBuffer, image.iccOutputBuffer, &error) && image.workBuffer.size()>0) {
+        qWarning() << QString::fromStdString(error);
+    }
+    probe->setInkLimit(image.inkLimit);
+    probe->compareOutput(compare, cache);
+    return probe;
+}
+
+// red where total ink is over the limit, stronger the more it's over
+static QImage buildInkOverlay(const FXX::TACReport &report)
+{
+    if (report.heatmap.size()==0 || report.over==0) { return QImage(); }
+    QImage overlay(static_cast<int>(report.heatmapWidth),
+                   static_cast<int>(report.heatmapHeight),
+                   QImage::Format_ARGB32);
+    for (int y = 0; y < overlay.height(); ++y) {
+        QRgb *line = reinterpret_cast<QRgb*>(overlay.scanLine(y));
+        const unsigned char *heat = &report.heatmap[static_cast<size_t>(y) * report.heatmapWidth];
+        for (int x = 0; x < overlay.width(); ++x) {
+            line[x] = heat[x]>0?qRgba(255, 0, 0, 96 + heat[x]*159/255):qRgba(0, 0, 0, 0);
+        }
+    }
+    return overlay;
+}
+
+// magenta from Delta E 1 (just noticeable), fully opaque at 10
+static QImage buildDeltaEOverlay(const FXX::DeltaEReport &report)
+{
+    if (report.heatmap.size()==0) { return QImage(); }
+    QImage overlay(static_cast<int>(report.heatmapWidth),
+                   static_cast<int>(report.heatmapHeight),
+                   QImage::Format_ARGB32);
+    for (int y = 0; y < overlay.height(); ++y) {
+        QRgb *line = reinterpret_cast<QRgb*>(overlay.scanLine(y));
+        const unsigned char *heat = &report.heatmap[static_cast<size_t>(y) * report.heatmapWidth];
+        for (int x = 0; x < overlay.width(); ++x) {
+            line[x] = heat[x]>10?qRgba(255, 0, 255, 64 + qMin(90, heat[x] - 10)*191/90):qRgba(0, 0, 0, 0);
+        }
+    }
+    return overlay;
+}
+
+// 0-255 for RGB and GRAY, ink percentages and total ink for CMYK
+static QString formatPixel(const FXX::PixelValue &value)
+{
+    QStringList channels;
+    switch (value.colorspace) {
+    case FXX::CMYKColorSpace:
+    {
+        double ink = 0.0;
+        for (size_t i = 0; i < value.channels.size(); ++i) {
+            channels << QString("%1%").arg(value.channels.at(i) * 100.0, 0, 'f', 1);
+            ink += value.channels.at(i) * 100.0;
+        }
+        channels << QObject::tr("TAC %1%").arg(ink, 0, 'f', 1);
+        break;
+    }
+    default:
+        for (size_t i = 0; i < value.channels.size(); ++i) {
+            channels << QString::number(value.channels.at(i) * 255.0, 'f', 1);
+        }
+    }
+    return QObject::tr("%1 Lab %2 %3 %4")
+            .arg(channels.join(" "))
+            .arg(value.L, 0, 'f', 1)
+            .arg(value.a, 0, 'f', 1)
+            .arg(value.b, 0, 'f', 1);
+}
+
+static FXX::Image convertLayer(std::shared_ptr<FXX::LayerStore> layers,
+                               size_t index,
+                               FXX::Image settings)
+{
+    try {
+        Magick::Image layer = layers->getLayer(index);
+        if (!layer.isValid()) {
+            settings.error = "Unable to read layer.";
+            return settings;
+        }
+        Magick::Blob output;
+        layer.write(&output);
+        const unsigned char *buffer = reinterpret_cast<const unsigned char*>(output.data());
+        settings.imageBuffer.assign(buffer, buffer + output.length());
+    }
+    catch(Magick::Error &error_ ) {
+        settings.error = error_.what();
+        return settings;
+    }
+    catch(Magick::Warning &warn_ ) { qWarning() << warn_.what(); }
+
+    // keep the layer source, the converted image goes to the work buffer
+    FXX::Image result = FXX::convertImage(settings, false);
+    result.workBuffer = result.imageBuffer;
+    result.imageBuffer = settings.imageBuffer;
+    return result;
+}
+
+static int profileBucket(FXX::ColorSpace colorspace,
+                         FXX::ProfileClass profileClass)
+{
+    return (static_cast<int>(colorspace) << 8) | static_cast<int>(profileClass);
+}
 
 Cyan::Cyan(QWidget *parent)
     : QMainWindow(parent)
     , scene(Q_NULLPTR)
     , view(Q_NULLPTR)
+    , imageItem(Q_NULLPTR)
     , mainBar(Q_NULLPTR)
     , profileBar(Q_NULLPTR)
     , rgbProfile(Q_NULLPTR)
@@ -77,6 +245,7 @@ Cyan::Cyan(QWidget *parent)
     , openImageAction(Q_NULLPTR)
     , saveImageAction(Q_NULLPTR)
     , infoImageAction(Q_NULLPTR)
+    , compareImageAction(Q_NULLPTR)
     , quitAction(Q_NULLPTR)
     , exportEmbeddedProfileAction(Q_NULLPTR)
     , bitDepth(Q_NULLPTR)
@@ -88,8 +257,30 @@ Cyan::Cyan(QWidget *parent)
     , magickMemoryResourcesGroup(Q_NULLPTR)
     , memoryMenu(Q_NULLPTR)
     , activeLayer(-1)
+    , convertLayerId(-1)
+    , layerCacheBytes(0)
+    , layerCacheGeneration(0)
+    , prefetchGeneration(0)
+    , prefetchLayer(-1)
+    , layerPending(false)
     , selectedLayer(Q_NULLPTR)
     , selectedLayerLabel(Q_NULLPTR)
+    , browseLayersButton(Q_NULLPTR)
+    , profileWatcher(Q_NULLPTR)
+    , profileWatcherTimer(Q_NULLPTR)
+    , pcsCacheAction(Q_NULLPTR)
+    , resultCacheAction(Q_NULLPTR)
+    , regionStep(1)
+    , probePending(false)
+    , pixelLabel(Q_NULLPTR)
+    , statsDock(Q_NULLPTR)
+    , statsPanel(Q_NULLPTR)
+    , inkLimitMenu(Q_NULLPTR)
+    , inkLimitGroup(Q_NULLPTR)
+    , inkOverlayAction(Q_NULLPTR)
+    , tacLabel(Q_NULLPTR)
+    , deltaEAction(Q_NULLPTR)
+    , deltaELabel(Q_NULLPTR)
 {
     // get style settings
     QSettings settings;
@@ -246,14 +437,39 @@ Cyan::Cyan(QWidget *parent)
     progBar->setValue(0);
     progBar->setMaximumWidth(90);
 
+    pixelLabel = new QLabel(this);
+    pixelLabel->setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+    statusBar()->addWidget(pixelLabel, 1);
+
+    tacLabel = new QLabel(this);
+    statusBar()->addPermanentWidget(tacLabel);
+
+    deltaELabel = new QLabel(this);
+    statusBar()->addPermanentWidget(deltaELabel);
+
+    statsPanel = new StatsPanel(this);
+    statsDock = new QDockWidget(tr("Statistics"), this);
+    statsDock->setObjectName("Statistics");
+    statsDock->setWidget(statsPanel);
+    addDockWidget(Qt::RightDockWidgetArea, statsDock);
+    statsDock->hide();
+
     qualityBox = new QSpinBox(this);
     qualityBox->setRange(0, 100);
     qualityBox->setValue(100);
 
     selectedLayer = new QComboBox(this);
     selectedLayerLabel = new QLabel(tr("Layer"), this);
+    browseLayersButton = new QPushButton(tr("..."), this);
+    browseLayersButton->setToolTip(tr("Browse layers"));
+    browseLayersButton->setMaximumWidth(30);
     enableLayers(false);
 
+    profileWatcher = new QFileSystemWatcher(this);
+    profileWatcherTimer = new QTimer(this);
+    profileWatcherTimer->setSingleShot(true);
+    profileWatcherTimer->setInterval(PROFILE_WATCHER_DELAY);
+
     profileBar->addWidget(rgbLabel);
     profileBar->addWidget(rgbProfile);
     profileBar->addWidget(cmykLabel);
@@ -277,6 +493,7 @@ Cyan::Cyan(QWidget *parent)
     helpMenu = new QMenu(tr("Help"), this);
     prefsMenu = new QMenu(tr("Preferences"), this);
     memoryMenu = new QMenu(tr("Memory limit"), this);
+    inkLimitMenu = new QMenu(tr("Total Ink Limit"), this);
 
     prefsMenu->menuAction()->setMenuRole(QAction::NoRole); // QTBUG-43881
 
@@ -298,6 +515,30 @@ Cyan::Cyan(QWidget *parent)
     }
     memoryMenu->addActions(magickMemoryResourcesGroup->actions());
 
+    prefsMenu->addMenu(inkLimitMenu);
+
+    inkLimitGroup = new QActionGroup(this);
+    QList<int> inkLimits;
+    inkLimits << 0 << 240 << 260 << 280 << 300 << 320 << 340;
+    for (int i=0;i<inkLimits.size();++i) {
+        QAction *act = new QAction(this);
+        act->setCheckable(true);
+        act->setText(inkLimits.at(i)>0?QString("%1%").arg(inkLimits.at(i)):tr("Off"));
+        act->setToolTip(tr("Highest total ink allowed on CMYK output"));
+        act->setData(inkLimits.at(i));
+        connect(act, SIGNAL(triggered(bool)), this, SLOT(handleInkLimitAct(bool)));
+        inkLimitGroup->addAction(act);
+    }
+    inkLimitMenu->addActions(inkLimitGroup->actions());
+    inkLimitMenu->addSeparator();
+
+    inkOverlayAction = new QAction(tr("Show Areas Over Limit"), this);
+    inkOverlayAction->setCheckable(true);
+    inkOverlayAction->setChecked(true);
+    connect(inkOverlayAction, SIGNAL(triggered(bool)),
+            this, SLOT(updateOverlay()));
+    inkLimitMenu->addAction(inkOverlayAction);
+
     QAction *aboutAction = new QAction(tr("About %1")
                                        .arg(qApp->applicationName()), this);
     aboutAction->setIcon(QIcon(":/cyan.png"));
@@ -322,6 +563,24 @@ Cyan::Cyan(QWidget *parent)
     infoImageAction->setShortcut(QKeySequence(Qt::CTRL + Qt::Key_I));
     fileMenu->addAction(infoImageAction);
 
+    compareImageAction = new QAction(tr("Compare renderings"), this);
+    compareImageAction->setIcon(QIcon(":/cyan-display.png"));
+    compareImageAction->setShortcut(QKeySequence(Qt::CTRL + Qt::Key_R));
+    fileMenu->addAction(compareImageAction);
+
+    deltaEAction = new QAction(tr("Round Trip Delta E"), this);
+    deltaEAction->setCheckable(true);
+    deltaEAction->setShortcut(QKeySequence(Qt::CTRL + Qt::Key_D));
+    deltaEAction->setToolTip(tr("Compare output with source (CIEDE2000)"
+                                " and show where they differ the most."));
+    connect(deltaEAction, SIGNAL(triggered(bool)),
+            this, SLOT(updatePixelProbe()));
+    fileMenu->addAction(deltaEAction);
+
+    QAction *statsAction = statsDock->toggleViewAction();
+    statsAction->setShortcut(QKeySequence(Qt::CTRL + Qt::Key_T));
+    fileMenu->addAction(statsAction);
+
     exportEmbeddedProfileAction = new QAction(tr("Save embedded profile"), this);
     exportEmbeddedProfileAction->setIcon(QIcon::fromTheme("document-save", QIcon(":/cyan-save.png")));
     exportEmbeddedProfileAction->setShortcut(QKeySequence(Qt::CTRL + Qt::Key_E));
@@ -338,6 +597,23 @@ Cyan::Cyan(QWidget *parent)
             this, SLOT(handleNativeStyleChanged(bool)));
     prefsMenu->addAction(nativeAction);
 
+    pcsCacheAction = new QAction(tr("Fast Output Profile Switching"), this);
+    pcsCacheAction->setCheckable(true);
+    pcsCacheAction->setToolTip(tr("Keep the image in Lab after the first conversion,"
+                                  " only converting from Lab when changing output or monitor profile."
+                                  " Uses more memory."));
+    connect(pcsCacheAction, SIGNAL(triggered(bool)),
+            this, SLOT(handlePCSCacheChanged(bool)));
+    prefsMenu->addAction(pcsCacheAction);
+
+    resultCacheAction = new QAction(tr("Cache Converted Images"), this);
+    resultCacheAction->setCheckable(true);
+    resultCacheAction->setToolTip(tr("Store converted images on disk,"
+                                     " converting the same image with the same settings again is instant."));
+    connect(resultCacheAction, SIGNAL(triggered(bool)),
+            this, SLOT(handleResultCacheChanged(bool)));
+    prefsMenu->addAction(resultCacheAction);
+
     fileMenu->addSeparator();
 
     quitAction = new QAction(tr("Quit"),this);
@@ -350,6 +626,7 @@ Cyan::Cyan(QWidget *parent)
     mainBar->addAction(infoImageAction);
     mainBar->addWidget(selectedLayerLabel);
     mainBar->addWidget(selectedLayer);
+    mainBar->addWidget(browseLayersButton);
     mainBar->addWidget(inputLabel);
     mainBar->addWidget(inputProfile);
     mainBar->addWidget(outputLabel);
@@ -366,6 +643,12 @@ Cyan::Cyan(QWidget *parent)
             this, SLOT(handleReadWatcher()));
     connect(&convertWatcher, SIGNAL(finished()),
             this, SLOT(handleConvertWatcher()));
+    connect(&prefetchWatcher, SIGNAL(finished()),
+            this, SLOT(handlePrefetchWatcher()));
+    connect(&regionWatcher, SIGNAL(finished()),
+            this, SLOT(handleRegionWatcher()));
+    connect(&probeWatcher, SIGNAL(finished()),
+            this, SLOT(handleProbeWatcher()));
     connect(aboutAction, SIGNAL(triggered()),
             this, SLOT(aboutCyan()));
     connect(aboutQtAction, SIGNAL(triggered()),
@@ -392,6 +675,10 @@ Cyan::Cyan(QWidget *parent)
             this, SLOT(outputProfileChanged(int)));
     connect(bitDepth, SIGNAL(currentIndexChanged(int)),
             this, SLOT(bitDepthChanged(int)));
+    connect(view, SIGNAL(pixelHover(QPointF)),
+            this, SLOT(handlePixelHover(QPointF)));
+    connect(view, SIGNAL(pixelLeave()),
+            this, SLOT(handlePixelLeave()));
     connect(view, SIGNAL(resetZoom()),
             this, SLOT(resetImageZoom()));
     connect(view, SIGNAL(openImage(QString)),
@@ -406,10 +693,32 @@ Cyan::Cyan(QWidget *parent)
             this, SLOT(handlePSDConverted(bool,QString)));
     connect(infoImageAction, SIGNAL(triggered()),
             this, SLOT(handleImageInfoButton()));
+    connect(compareImageAction, SIGNAL(triggered()),
+            this, SLOT(handleCompareImage()));
     connect(this, SIGNAL(newImageInfo(QString)),
             this, SLOT(handleImageInfo(QString)));
     connect(selectedLayer, SIGNAL(currentIndexChanged(int)),
             this, SLOT(switchLayer(int)));
+    connect(browseLayersButton, SIGNAL(released()),
+            this, SLOT(handleImageHasLayers()));
+    connect(profileWatcher, SIGNAL(directoryChanged(QString)),
+            this, SLOT(handleProfilePathChanged(QString)));
+    connect(profileWatcher, SIGNAL(fileChanged(QString)),
+            this, SLOT(handleProfilePathChanged(QString)));
+    connect(rgbProfile, SIGNAL(currentIndexChanged(int)),
+            this, SLOT(watchSelectedProfiles()));
+    connect(cmykProfile, SIGNAL(currentIndexChanged(int)),
+            this, SLOT(watchSelectedProfiles()));
+    connect(grayProfile, SIGNAL(currentIndexChanged(int)),
+            this, SLOT(watchSelectedProfiles()));
+    connect(monitorProfile, SIGNAL(currentIndexChanged(int)),
+            this, SLOT(watchSelectedProfiles()));
+    connect(inputProfile, SIGNAL(currentIndexChanged(int)),
+            this, SLOT(watchSelectedProfiles()));
+    connect(outputProfile, SIGNAL(currentIndexChanged(int)),
+            this, SLOT(watchSelectedProfiles()));
+    connect(profileWatcherTimer, SIGNAL(timeout()),
+            this, SLOT(handleProfileWatcherTimeout()));
 
     clearImageBuffer();
     QTimer::singleShot(0, this,
@@ -430,6 +739,14 @@ void Cyan::readConfig()
     setDiskResource(settings.value("disk_limit", 0).toInt());
     int maxMem = settings.value("memory_limit", 2).toInt();
     setMemoryResource(maxMem);
+    pcsCacheAction->setChecked(settings.value("pcs_cache", false).toBool());
+    handlePCSCacheChanged(pcsCacheAction->isChecked());
+    resultCacheAction->setChecked(settings.value("result_cache", false).toBool());
+    handleResultCacheChanged(resultCacheAction->isChecked());
+    setInkLimit(settings.value("ink_limit", 300).toDouble());
+    inkOverlayAction->setChecked(settings.value("ink_overlay", true).toBool());
+    inkOverlayAction->setEnabled(getInkLimit()>0.0);
+    deltaEAction->setChecked(settings.value("delta_e", false).toBool());
     settings.endGroup();
     QList<QAction*> memActions = magickMemoryResourcesGroup->actions();
     bool foundAct = false;
@@ -504,6 +821,11 @@ void Cyan::writeConfig()
     settings.beginGroup("engine");
     settings.setValue("disk_limit", getDiskResource());
     settings.setValue("memory_limit", getMemoryResource());
+    settings.setValue("pcs_cache", pcsCacheAction->isChecked());
+    settings.setValue("result_cache", resultCacheAction->isChecked());
+    settings.setValue("ink_limit", getInkLimit());
+    settings.setValue("ink_overlay", inkOverlayAction->isChecked());
+    settings.setValue("delta_e", deltaEAction->isChecked());
     settings.endGroup();
 
     settings.beginGroup("color");
@@ -653,7 +975,7 @@ void Cyan::saveImageDialog()
 
 void Cyan::openImage(QString file)
 {
-    if (file.isEmpty() || readWatcher.isRunning() || convertWatcher.isRunning()) { return; }
+    if (file.isEmpty() || readWatcher.isRunning() || convertWatcher.isRunning() || regionWatcher.isRunning()) { return; }
     if (rgbProfile->itemData(rgbProfile->currentIndex()).isNull() ||
         cmykProfile->itemData(cmykProfile->currentIndex()).isNull() ||
         grayProfile->itemData(grayProfile->currentIndex()).isNull()) {
@@ -686,7 +1008,7 @@ void Cyan::openImage(QString file)
 
 void Cyan::openImage(Magick::Image image)
 {
-    if (!image.isValid() || readWatcher.isRunning() || convertWatcher.isRunning()) { return; }
+    if (!image.isValid() || readWatcher.isRunning() || convertWatcher.isRunning() || regionWatcher.isRunning()) { return; }
     if (rgbProfile->itemData(rgbProfile->currentIndex()).isNull() ||
         cmykProfile->itemData(cmykProfile->currentIndex()).isNull() ||
         grayProfile->itemData(grayProfile->currentIndex()).isNull()) {
@@ -820,6 +1142,8 @@ void Cyan::loadDefaultProfiles()
                     QString("%1/gray.icc").arg(icc));
     }
 
+    scanProfiles();
+
     getColorProfiles(FXX::RGBColorSpace, rgbProfile, false);
     getColorProfiles(FXX::CMYKColorSpace, cmykProfile, false);
     getColorProfiles(FXX::GRAYColorSpace, grayProfile, false);
@@ -916,12 +1240,21 @@ void Cyan::imageClear()
 {
     ignoreConvertAction = true;
     scene->clear();
+    imageItem = Q_NULLPTR;
+    pixelProbe.reset();
+    pixelLabel->clear();
+    tacLabel->clear();
+    deltaELabel->clear();
+    statsPanel->clear();
     resetImageZoom();
     clearImageBuffer();
+    resetPCSCache();
+    clearLayerCache();
     bitDepth->setCurrentIndex(0);
     exportEmbeddedProfileAction->setDisabled(true);
     ignoreConvertAction = false;
     activeLayer = -1;
+    layerPending = false;
     selectedLayer->clear();
     enableLayers(false);
 }
@@ -936,16 +1269,18 @@ void Cyan::resetImageZoom()
 void Cyan::setImage(QByteArray image)
 {
     if (image.length() == 0) { return; }
-    QPixmap pixmap(QPixmap::fromImage(QImage::fromData(image)));
+    QImage pixmap = QImage::fromData(image);
     if (pixmap.isNull()) { return; }
     scene->clear();
-    scene->addPixmap(pixmap);
+    imageItem = new TiledImageItem();
+    imageItem->setImage(pixmap);
+    scene->addItem(imageItem);
     scene->setSceneRect(0, 0, pixmap.width(), pixmap.height());
 }
 
 void Cyan::exportPSD(const QString &filename)
 {
-    if (ignoreConvertAction || convertWatcher.isRunning() || readWatcher.isRunning()) {
+    if (ignoreConvertAction || convertWatcher.isRunning() || regionWatcher.isRunning() || readWatcher.isRunning()) {
         return;
     }
 
@@ -1004,7 +1339,8 @@ void Cyan::convertPSD(FXX::Image image, const QString &filename)
         return;
     }
     emit finishedConvertingPSD(FXX::writePSD(image,
-                                             filename.toStdString())
+                                             filename.toStdString(),
+                                             &transformCache)
                                && QFile::exists(filename),
                                filename);
 }
@@ -1026,12 +1362,57 @@ void Cyan::handlePSDConverted(bool success, const QString &filename)
 
 void Cyan::updateImage()
 {
-    if (ignoreConvertAction || convertWatcher.isRunning() || readWatcher.isRunning()) {
+    if (ignoreConvertAction || convertWatcher.isRunning() || regionWatcher.isRunning() || readWatcher.isRunning()) {
         return;
     }
+    // imageBuffer still holds the previous layer, handlePrefetchWatcher
+    // converts once the selected layer is decoded
+    if (layerPending) { return; }
 
-    FXX::Image image;
+    FXX::Image image = getConvertSettings();
     image.imageBuffer = imageData.imageBuffer;
+
+    // check if input profile exists
+    if (image.iccInputBuffer.size()==0) { return; }
+
+    // already converted this layer with these settings?
+    convertLayerId = activeLayer;
+    convertKey = getLayerKey(activeLayer, image);
+    if (showCachedLayer(convertKey)) {
+        prefetchLayers();
+        return;
+    }
+
+    // proc
+    disableUI();
+
+    // zoomed in, convert what is visible first and the rest after
+    int step = 1;
+    QRect region = getConvertRegion(&step);
+    if (!region.isEmpty()) {
+        pendingConvert = image;
+        regionRect = region;
+        regionStep = step;
+        regionWatcher.setFuture(QtConcurrent::run(convertRegion,
+                                                  image,
+                                                  pcsImage,
+                                                  &transformCache,
+                                                  region,
+                                                  step));
+        return;
+    }
+
+    QFuture<FXX::Image> future = QtConcurrent::run(convertImage,
+                                                   image,
+                                                   pcsImage,
+                                                   &transformCache,
+                                                   resultCache);
+    convertWatcher.setFuture(future);
+}
+
+FXX::Image Cyan::getConvertSettings()
+{
+    FXX::Image image;
     QString selectedInputProfile = inputProfile->itemData(inputProfile->currentIndex())
                                    .toString();
     QString selectedOutputProfile = outputProfile->itemData(outputProfile->currentIndex())
@@ -1076,15 +1457,30 @@ void Cyan::updateImage()
         }
     }
 
-    // check if input profile exists
-    if (image.iccInputBuffer.size()==0) { return; }
+    return image;
+}
 
-    // proc
-    disableUI();
-    QFuture<FXX::Image> future = QtConcurrent::run(FXX::convertImage,
-                                                   image,
-                                                   false);
-    convertWatcher.setFuture(future);
+// visible part of the image aligned to tiles at the resolution the
+// current zoom needs, empty when most of the image is visible anyway
+QRect Cyan::getConvertRegion(int *step)
+{
+    if (!imageItem) { return QRect(); }
+    QRectF bounds = imageItem->boundingRect();
+    QRectF visible = view->visibleRect().intersected(bounds);
+    double zoom = view->zoom();
+    if (visible.isEmpty() || zoom <= 0.0 ||
+        visible.width() * visible.height() > bounds.width() * bounds.height() * 0.5) { return QRect(); }
+
+    *step = 1;
+    while (*step * 2 <= 1.0 / zoom) { *step *= 2; }
+    int tile = TILE_SIZE * *step;
+    int left = static_cast<int>(visible.left()) / tile * tile;
+    int top = static_cast<int>(visible.top()) / tile * tile;
+    int right = qMin(static_cast<int>(bounds.width()),
+                     (static_cast<int>(std::ceil(visible.right())) + tile - 1) / tile * tile);
+    int bottom = qMin(static_cast<int>(bounds.height()),
+                      (static_cast<int>(std::ceil(visible.bottom())) + tile - 1) / tile * tile);
+    return QRect(left, top, right - left, bottom - top);
 }
 
 QByteArray Cyan::getMonitorProfile()
@@ -1133,24 +1529,8 @@ void Cyan::getConvertProfiles()
     if (inputColorSpace == FXX::UnknownColorSpace) { return; }
 
     ignoreConvertAction = true;
-    QMultiMap<QString,QString> inputProfiles, outputProfiles;
-
-    switch(inputColorSpace) {
-    case FXX::RGBColorSpace:
-        outputProfiles = genProfiles(FXX::CMYKColorSpace);
-        outputProfiles.unite(genProfiles(FXX::GRAYColorSpace));
-        break;
-    case FXX::CMYKColorSpace:
-        outputProfiles = genProfiles(FXX::RGBColorSpace);
-        outputProfiles.unite(genProfiles(FXX::GRAYColorSpace));
-        break;
-    case FXX::GRAYColorSpace:
-        outputProfiles = genProfiles(FXX::RGBColorSpace);
-        outputProfiles.unite(genProfiles(FXX::CMYKColorSpace));
-        break;
-    default:;
-    }
-    inputProfiles = genProfiles(inputColorSpace);
+    QMap<QString,QString> inputProfiles = genProfiles(inputColorSpace);
+    QMap<QString,QString> outputProfiles = genOutputProfiles(inputColorSpace);
 
     QIcon itemIcon(":/cyan-wheel.png");
     QString embeddedProfile = QString::fromStdString(fx.getProfileTag(imageData
@@ -1373,7 +1753,7 @@ void Cyan::gimpPlugin()
 
 void Cyan::openProfile(QString file)
 {
-    if (file.isEmpty() || readWatcher.isRunning() || convertWatcher.isRunning()) { return; }
+    if (file.isEmpty() || readWatcher.isRunning() || convertWatcher.isRunning() || regionWatcher.isRunning()) { return; }
     ProfileDialog *dialog = new ProfileDialog(this, file);
     dialog->exec();
 }
@@ -1400,9 +1780,8 @@ void Cyan::clearImageBuffer()
     fx.clearImage(imageData);
 }
 
-QMap<QString, QString> Cyan::genProfiles(FXX::ColorSpace colorspace)
+QStringList Cyan::getProfileFolders()
 {
-    QMap<QString,QString> output;
     QStringList folders;
     folders << QDir::rootPath() + "/WINDOWS/System32/spool/drivers/color";
     folders << "/Library/ColorSync/Profiles";
@@ -1417,20 +1796,295 @@ QMap<QString, QString> Cyan::genProfiles(FXX::ColorSpace colorspace)
         folders << cyanICCPath;
     }
     for (int i = 0; i < folders.size(); ++i) {
-        QStringList filter;
-        filter << "*.icc" << "*.icm";
+        folders[i] = QDir::cleanPath(folders.at(i));
+    }
+    return folders;
+}
+
+void Cyan::scanProfiles()
+{
+    // walk all profile folders once
+    QStringList files;
+    QStringList watch;
+    QStringList folders = getProfileFolders();
+    QStringList filter;
+    filter << "*.icc" << "*.icm";
+    for (int i = 0; i < folders.size(); ++i) {
+        if (!QFileInfo(folders.at(i)).isDir()) { continue; }
+        watch << folders.at(i);
+        QDirIterator dirs(folders.at(i), QDir::Dirs | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+        while (dirs.hasNext()) { watch << dirs.next(); }
         QDirIterator it(folders.at(i), filter, QDir::Files, QDirIterator::Subdirectories);
         while (it.hasNext()) {
             QString iccFile = it.next();
-            QString profile = QString::fromStdString(fx.getProfileTag(iccFile.toStdString()));
-            if (iccFile.isEmpty() || profile.isEmpty()) { continue; }
-            if (fx.getProfileColorspace(iccFile.toStdString())!=colorspace) { continue; }
-            output[profile] = iccFile;
+            if (!iccFile.isEmpty()) { files << iccFile; }
+        }
+    }
+
+    // parse profiles on the thread pool
+    QList<FXX::ProfileInfo> profiles = QtConcurrent::blockingMapped<QList<FXX::ProfileInfo> >(files,
+                                                                                             readProfileInfo);
+    profileLibrary.clear();
+    profileStamps.clear();
+    for (int i = 0; i < files.size() && i < profiles.size(); ++i) {
+        QFileInfo info(files.at(i));
+        profileLibrary.insert(files.at(i), profiles.at(i));
+        profileStamps.insert(files.at(i), qMakePair(info.lastModified(), info.size()));
+    }
+    bucketProfiles();
+
+    // watch folders, one watch per profile runs into the inotify
+    // (or open file) limit, only the profiles in use are watched as files
+    if (!profileWatcher->directories().isEmpty()) {
+        profileWatcher->removePaths(profileWatcher->directories());
+    }
+    watchProfileFolders(watch);
+    watchSelectedProfiles();
+}
+
+void Cyan::watchProfileFolders(const QStringList &folders)
+{
+    if (folders.isEmpty()) { return; }
+    QStringList failed = profileWatcher->addPaths(folders);
+    if (!failed.isEmpty()) { qWarning() << "unable to watch" << failed.size() << "profile folders"; }
+}
+
+void Cyan::watchSelectedProfiles()
+{
+    // a profile overwritten in place sends no folder event
+    QStringList selected;
+    QList<QComboBox*> boxes;
+    boxes << rgbProfile << cmykProfile << grayProfile << monitorProfile << inputProfile << outputProfile;
+    foreach (QComboBox *box, boxes) {
+        QString file = box->itemData(box->currentIndex()).toString();
+        if (!file.isEmpty() && !selected.contains(file) && QFile::exists(file)) { selected << file; }
+    }
+    QStringList watched = profileWatcher->files();
+    QStringList unwatch;
+    foreach (QString file, watched) {
+        if (!selected.contains(file)) { unwatch << file; }
+    }
+    if (!unwatch.isEmpty()) { profileWatcher->removePaths(unwatch); }
+    QStringList watch;
+    foreach (QString file, selected) {
+        if (!watched.contains(file)) { watch << file; }
+    }
+    if (!watch.isEmpty()) { profileWatcher->addPaths(watch); }
+}
+
+void Cyan::bucketProfiles()
+{
+    // bucket by color space and device class, later folders win
+    profileBuckets.clear();
+    QStringList folders = getProfileFolders();
+    for (int i = 0; i < folders.size(); ++i) {
+        QString folder = folders.at(i) + "/";
+        QMap<QString, FXX::ProfileInfo>::const_iterator it = profileLibrary.lowerBound(folder);
+        while (it != profileLibrary.constEnd() && it.key().startsWith(folder)) {
+            const FXX::ProfileInfo &info = it.value();
+            ++it;
+            if (info.description.empty() ||
+                info.colorspace == FXX::UnknownColorSpace) { continue; }
+            profileBuckets[profileBucket(info.colorspace, info.profileClass)]
+                    .insert(QString::fromStdString(info.description),
+                            QString::fromStdString(info.filename));
+        }
+    }
+}
+
+QMap<QString, QString> Cyan::genProfiles(FXX::ColorSpace colorspace)
+{
+    // only device and color space profiles can be used in a conversion
+    QList<FXX::ProfileClass> classes;
+    classes << FXX::InputProfileClass << FXX::DisplayProfileClass;
+    classes << FXX::OutputProfileClass << FXX::ColorSpaceProfileClass;
+    QMap<QString,QString> output;
+    for (int i = 0; i < classes.size(); ++i) {
+        QMapIterator<QString, QString> profile(genProfiles(colorspace, classes.at(i)));
+        while (profile.hasNext()) {
+            profile.next();
+            output.insert(profile.key(), profile.value());
         }
     }
     return output;
 }
 
+QMap<QString, QString> Cyan::genProfiles(FXX::ColorSpace colorspace,
+                                         FXX::ProfileClass profileClass)
+{
+    return profileBuckets.value(profileBucket(colorspace, profileClass));
+}
+
+QMap<QString, QString> Cyan::genOutputProfiles(FXX::ColorSpace colorspace)
+{
+    QList<FXX::ColorSpace> colorspaces;
+    switch(colorspace) {
+    case FXX::RGBColorSpace:
+        colorspaces << FXX::CMYKColorSpace << FXX::GRAYColorSpace;
+        break;
+    case FXX::CMYKColorSpace:
+        colorspaces << FXX::RGBColorSpace << FXX::GRAYColorSpace;
+        break;
+    case FXX::GRAYColorSpace:
+        colorspaces << FXX::RGBColorSpace << FXX::CMYKColorSpace;
+        break;
+    default:;
+    }
+    QMap<QString,QString> output;
+    for (int i = 0; i < colorspaces.size(); ++i) {
+        QMapIterator<QString, QString> profile(genProfiles(colorspaces.at(i)));
+        while (profile.hasNext()) {
+            profile.next();
+            output.insert(profile.key(), profile.value());
+        }
+    }
+    return output;
+}
+
+void Cyan::handleProfilePathChanged(const QString &path)
+{
+    if (path.isEmpty()) { return; }
+    pendingProfilePaths.insert(path);
+    profileWatcherTimer->start();
+}
+
+void Cyan::handleProfileWatcherTimeout()
+{
+    QSet<QString> watched;
+    foreach (QString path, profileWatcher->directories()) { watched.insert(path); }
+
+    QStringList filter;
+    filter << "*.icc" << "*.icm";
+    QStringList watch;
+    QStringList updated;
+    QSet<QString> changedFiles;
+    foreach (QString path, pendingProfilePaths) {
+        // drop profiles that are gone
+        if (profileLibrary.contains(path) && !QFile::exists(path)) {
+            profileLibrary.remove(path);
+            profileStamps.remove(path);
+            changedFiles.insert(path);
+        }
+        QString folder = path + "/";
+        QMap<QString, FXX::ProfileInfo>::iterator it = profileLibrary.lowerBound(folder);
+        while (it != profileLibrary.end() && it.key().startsWith(folder)) {
+            if (QFile::exists(it.key())) {
+                ++it;
+                continue;
+            }
+            profileStamps.remove(it.key());
+            changedFiles.insert(it.key());
+            it = profileLibrary.erase(it);
+        }
+
+        // pick up new and modified profiles
+        QStringList candidates;
+        QFileInfo info(path);
+        if (info.isDir()) {
+            if (!watched.contains(path)) { watch << path; }
+            QDirIterator dirs(path, QDir::Dirs | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+            while (dirs.hasNext()) {
+                QString dir = dirs.next();
+                if (!watched.contains(dir)) { watch << dir; }
+            }
+            QDirIterator files(path, filter, QDir::Files, QDirIterator::Subdirectories);
+            while (files.hasNext()) { candidates << files.next(); }
+        } else if (info.isFile()) {
+            candidates << path;
+        }
+        foreach (QString file, candidates) {
+            QFileInfo fileInfo(file);
+            QPair<QDateTime, qint64> stamp = qMakePair(fileInfo.lastModified(), fileInfo.size());
+            if (profileStamps.contains(file) && profileStamps.value(file) == stamp) { continue; }
+            profileStamps.insert(file, stamp);
+            updated << file;
+        }
+    }
+    pendingProfilePaths.clear();
+
+    QList<FXX::ProfileInfo> profiles = QtConcurrent::blockingMapped<QList<FXX::ProfileInfo> >(updated,
+                                                                                             readProfileInfo);
+    for (int i = 0; i < updated.size() && i < profiles.size(); ++i) {
+        profileLibrary.insert(updated.at(i), profiles.at(i));
+        changedFiles.insert(updated.at(i));
+    }
+    watch.removeDuplicates();
+    watchProfileFolders(watch);
+    if (!changedFiles.isEmpty()) {
+        qDebug() << "profile library changed" << changedFiles.size();
+        bucketProfiles();
+        refreshProfileBoxes(changedFiles);
+    }
+    // profiles replaced by a rename drop their watch
+    watchSelectedProfiles();
+}
+
+void Cyan::refreshProfileBoxes(const QSet<QString> &changedFiles)
+{
+    syncProfileBox(rgbProfile, genProfiles(FXX::RGBColorSpace),
+                   tr("Select ..."), changedFiles);
+    syncProfileBox(cmykProfile, genProfiles(FXX::CMYKColorSpace),
+                   tr("Select ..."), changedFiles);
+    syncProfileBox(grayProfile, genProfiles(FXX::GRAYColorSpace),
+                   tr("Select ..."), changedFiles);
+
+    bool needsUpdate = syncProfileBox(monitorProfile, genProfiles(FXX::RGBColorSpace),
+                                      tr("None"), changedFiles);
+    if (imageData.iccInputBuffer.size()>0 && inputProfile->count()>0) {
+        FXX::ColorSpace inputColorSpace = fx.getProfileColorspace(imageData.iccInputBuffer);
+        if (syncProfileBox(inputProfile, genProfiles(inputColorSpace),
+                           QString(), changedFiles)) { needsUpdate = true; }
+        if (syncProfileBox(outputProfile, genOutputProfiles(inputColorSpace),
+                           QString(), changedFiles)) { needsUpdate = true; }
+    }
+    if (needsUpdate) { updateImage(); }
+}
+
+bool Cyan::syncProfileBox(QComboBox *box,
+                          const QMap<QString, QString> &profiles,
+                          const QString &emptyText,
+                          const QSet<QString> &changedFiles)
+{
+    QIcon itemIcon(":/cyan-wheel.png");
+    box->blockSignals(true);
+    if (box->count() == 0 && !emptyText.isEmpty() && profiles.size() > 0) {
+        box->addItem(itemIcon, emptyText);
+        box->insertSeparator(1);
+    }
+    QString current = box->itemData(box->currentIndex()).toString();
+
+    // remove profiles that are gone or renamed
+    for (int i = box->count()-1; i > 1; --i) {
+        QString file = box->itemData(i).toString();
+        if (file.isEmpty()) { continue; }
+        if (profiles.value(box->itemText(i)) != file) { box->removeItem(i); }
+    }
+
+    // insert new profiles, both lists are sorted by description
+    if (box->count() > 0) {
+        int pos = 2;
+        QMapIterator<QString, QString> profile(profiles);
+        while (profile.hasNext()) {
+            profile.next();
+            if (pos < box->count() && box->itemText(pos) == profile.key()) {
+                ++pos;
+                continue;
+            }
+            box->insertItem(pos, itemIcon, profile.key(), profile.value());
+            ++pos;
+        }
+    }
+
+    // keep selection if the profile still exists
+    if (!current.isEmpty()) {
+        int index = box->findData(current);
+        box->setCurrentIndex(index >= 0 ? index : 0);
+    }
+    box->blockSignals(false);
+
+    return !current.isEmpty() && changedFiles.contains(current);
+}
+
 QByteArray Cyan::getDefaultProfile(FXX::ColorSpace colorspace)
 {
     QByteArray bytes;
@@ -1468,6 +2122,14 @@ void Cyan::handleConvertWatcher()
                             static_cast<int>(image.previewBuffer.size())));
         //imageData.info = image.info;
         imageData.workBuffer = image.imageBuffer;
+        updatePixelProbe();
+        if (convertLayerId >= 0 && convertLayerId == activeLayer) {
+            FXX::Image layer;
+            layer.imageBuffer = imageData.imageBuffer;
+            layer.workBuffer = image.imageBuffer;
+            layer.previewBuffer = image.previewBuffer;
+            cacheLayer(convertKey, layer);
+        }
     } else {
         QMessageBox::warning(this, tr("Image error"),
                              QString::fromStdString(image.error));
@@ -1476,6 +2138,70 @@ void Cyan::handleConvertWatcher()
         QMessageBox::warning(this, tr("Image warning"),
                              QString::fromStdString(image.warning));
     }
+    // layer changed while converting, wait for it to be decoded
+    if (convertLayerId != activeLayer) {
+        if (!layerPending) { updateImage(); }
+    }
+    else { prefetchLayers(); }
+}
+
+void Cyan::handlePrefetchWatcher()
+{
+    FXX::Image image = prefetchWatcher.future();
+    if (prefetchGeneration == layerCacheGeneration &&
+        image.error.empty() &&
+        image.previewBuffer.size()>0 &&
+        image.workBuffer.size()>0) { cacheLayer(prefetchKey, image); }
+    if (!layerPending) {
+        prefetchLayers();
+        return;
+    }
+
+    // a prefetch was running when the layer was selected, or the
+    // layer or settings changed since, load the active layer now
+    if (prefetchLayer != activeLayer ||
+        prefetchGeneration != layerCacheGeneration ||
+        prefetchKey != getLayerKey(activeLayer, getConvertSettings())) {
+        loadActiveLayer();
+        return;
+    }
+    layerPending = false;
+    if (image.imageBuffer.size()==0) {
+        qDebug() << "can't read that layer!";
+        return;
+    }
+    imageData.imageBuffer = image.imageBuffer;
+    // a running conversion is of the previous layer,
+    // handleConvertWatcher converts this one when it is done
+    if (convertWatcher.isRunning() || regionWatcher.isRunning()) { return; }
+    if (showCachedLayer(prefetchKey)) { prefetchLayers(); }
+    else { updateImage(); }
+}
+
+void Cyan::handleRegionWatcher()
+{
+    FXX::Image region = regionWatcher.future();
+    if (imageItem &&
+        convertLayerId == activeLayer &&
+        region.error.empty() &&
+        region.previewBuffer.size()>0)
+    {
+        QImage preview = QImage::fromData(QByteArray(reinterpret_cast<char*>(region.previewBuffer.data()),
+                                                     static_cast<int>(region.previewBuffer.size())));
+        imageItem->setRegion(preview, QRectF(regionRect.x(),
+                                             regionRect.y(),
+                                             preview.width() * regionStep,
+                                             preview.height() * regionStep));
+    }
+
+    // now the full image, any errors are reported from there
+    QFuture<FXX::Image> future = QtConcurrent::run(convertImage,
+                                                   pendingConvert,
+                                                   pcsImage,
+                                                   &transformCache,
+                                                   resultCache);
+    convertWatcher.setFuture(future);
+    pendingConvert = FXX::Image();
 }
 
 void Cyan::handleReadWatcher()
@@ -1493,6 +2219,7 @@ void Cyan::handleReadWatcher()
                             static_cast<int>(image.previewBuffer.size())));
         imageData = image;
         exportEmbeddedProfileAction->setDisabled(imageData.iccInputBuffer.size()==0);
+        updatePixelProbe();
         //if (!imageData.info.empty()) { parseImageInfo(); }
         getConvertProfiles();
         QFileInfo fileinfo(QString::fromStdString(image.filename));
@@ -1506,29 +2233,169 @@ void Cyan::handleReadWatcher()
         QMessageBox::warning(this, tr("Image warning"),
                              QString::fromStdString(image.warning));
     }
-    if (image.layers.size()>1) {
+    if (image.layerStore && image.layerStore->count()>1) {
         enableLayers(true);
-        //handleImageHasLayers(image.layers);
-        //imageData.layers.clear();
     }
 }
 
-void Cyan::handleImageHasLayers(std::vector<Magick::Image> layers)
+void Cyan::handleImageHasLayers()
+{
+    if (!imageData.layerStore) { return; }
+    OpenLayerDialog *dialog = new OpenLayerDialog(this,
+                                                  imageData.layerStore,
+                                                  getConvertSettings(),
+                                                  &transformCache);
+    connect(dialog, SIGNAL(loadLayer(int)),
+            this, SLOT(handleLoadImageLayer(int)));
+    dialog->exec();
+}
+
+void Cyan::handleCompareImage()
+{
+    if (imageData.imageBuffer.size()==0) { return; }
+    FXX::Image image = getConvertSettings();
+    if (image.iccInputBuffer.size()==0) { return; }
+    image.imageBuffer = imageData.imageBuffer;
+    CompareDialog *dialog = new CompareDialog(this,
+                                              image,
+                                              &transformCache);
+    dialog->show();
+}
+
+// decode the source and converted image for the pixel readout
+void Cyan::updatePixelProbe()
+{
+    if (probeWatcher.isRunning()) {
+        probePending = true;
+        return;
+    }
+    if (imageData.imageBuffer.size()==0) {
+        pixelProbe.reset();
+        return;
+    }
+    FXX::Image image = getConvertSettings();
+    image.imageBuffer = imageData.imageBuffer;
+    image.workBuffer = imageData.workBuffer;
+    image.inkLimit = getInkLimit();
+    probeWatcher.setFuture(QtConcurrent::run(buildPixelProbe,
+                                             pixelProbe,
+                                             image,
+                                             deltaEAction->isChecked(),
+                                             &transformCache));
+}
+
+void Cyan::handleProbeWatcher()
+{
+    if (probePending) {
+        probePending = false;
+        updatePixelProbe();
+        return;
+    }
+    if (imageData.imageBuffer.size()==0) { pixelProbe.reset(); }
+    else { pixelProbe = probeWatcher.result(); }
+    if (pixelProbe) {
+        statsPanel->setStats(pixelProbe->sourceStats(), pixelProbe->outputStats());
+        statsPanel->setTAC(pixelProbe->tac());
+        statsPanel->setDeltaE(pixelProbe->deltaE());
+    }
+    else { statsPanel->clear(); }
+    updateOverlay();
+}
+
+void Cyan::handlePixelHover(const QPointF &pos)
+{
+    if (!pixelProbe || pos.x()<0 || pos.y()<0) {
+        pixelLabel->clear();
+        return;
+    }
+    size_t x = static_cast<size_t>(pos.x());
+    size_t y = static_cast<size_t>(pos.y());
+    FXX::PixelValue source = pixelProbe->source(x, y);
+    if (!source.valid) {
+        pixelLabel->clear();
+        return;
+    }
+    QString text = tr("X %1 Y %2 | Source %3").arg(x).arg(y).arg(formatPixel(source));
+    FXX::PixelValue output = pixelProbe->output(x, y);
+    if (output.valid) { text.append(tr(" | Output %1").arg(formatPixel(output))); }
+    pixelLabel->setText(text);
+}
+
+void Cyan::handlePixelLeave()
+{
+    pixelLabel->clear();
+}
+
+double Cyan::getInkLimit()
 {
-    Q_UNUSED(layers)
-    /*qDebug()  << "image has layers!" << layers.size();
-    OpenLayerDialog *dialog = new OpenLayerDialog(this, layers);
-    connect(dialog, SIGNAL(loadLayer(Magick::Image)),
-            this, SLOT(handleLoadImageLayer(Magick::Image)));
-    dialog->exec();*/
+    QAction *action = inkLimitGroup->checkedAction();
+    return action?action->data().toDouble():0.0;
 }
 
-void Cyan::handleLoadImageLayer(Magick::Image image)
+void Cyan::setInkLimit(double limit)
 {
-    Q_UNUSED(image)
-    /*if (!image.isValid()) { return; }
-    qDebug() << "handle load image layer";
-    openImage(image);*/
+    QList<QAction*> actions = inkLimitGroup->actions();
+    for (int i=0;i<actions.size();++i) {
+        if (actions.at(i)->data().toDouble() == limit) {
+            actions.at(i)->setChecked(true);
+            return;
+        }
+    }
+    actions.at(0)->setChecked(true);
+}
+
+void Cyan::handleInkLimitAct(bool triggered)
+{
+    Q_UNUSED(triggered)
+    inkOverlayAction->setEnabled(getInkLimit()>0.0);
+    updatePixelProbe();
+}
+
+// status and heatmap for the current probe,
+// the Delta E map goes over the ink map when enabled
+void Cyan::updateOverlay()
+{
+    FXX::TACReport report = pixelProbe?pixelProbe->tac():FXX::TACReport();
+    if (report.pixels>0) {
+        tacLabel->setText(tr("TAC max %1% (limit %2%)")
+                          .arg(report.max, 0, 'f', 1)
+                          .arg(report.limit, 0, 'f', 0));
+        tacLabel->setStyleSheet(report.over>0?QString("color: red;"):QString());
+    } else {
+        tacLabel->clear();
+    }
+    FXX::DeltaEReport deltaE = pixelProbe?pixelProbe->deltaE():FXX::DeltaEReport();
+    if (deltaE.pixels>0) {
+        deltaELabel->setText(tr("\u0394E00 mean %1 p95 %2 max %3")
+                             .arg(deltaE.mean, 0, 'f', 2)
+                             .arg(deltaE.p95, 0, 'f', 2)
+                             .arg(deltaE.max, 0, 'f', 2));
+    } else {
+        deltaELabel->clear();
+    }
+    if (!imageItem) { return; }
+    // cells may extend past the image edge
+    if (deltaE.heatmapWidth>0 && deltaE.heatmapHeight>0) {
+        imageItem->setOverlay(buildDeltaEOverlay(deltaE),
+                              QRectF(0, 0,
+                                     deltaE.heatmapWidth * deltaE.heatmapCell,
+                                     deltaE.heatmapHeight * deltaE.heatmapCell));
+        return;
+    }
+    if (!inkOverlayAction->isChecked() || report.heatmapWidth==0 || report.heatmapHeight==0) {
+        imageItem->setOverlay(QImage(), QRectF());
+        return;
+    }
+    imageItem->setOverlay(buildInkOverlay(report),
+                          QRectF(0, 0,
+                                 report.heatmapWidth * report.heatmapCell,
+                                 report.heatmapHeight * report.heatmapCell));
+}
+
+void Cyan::handleLoadImageLayer(int index)
+{
+    if (index<0 || index>=selectedLayer->count()) { return; }
+    selectedLayer->setCurrentIndex(index);
 }
 
 void Cyan::handleImageInfoButton()
@@ -1573,27 +2440,127 @@ void Cyan::switchLayer(int id)
         qDebug() << "id must be >= 0 !";
         return;
     }
-    if (imageData.layers.size()<static_cast<size_t>(id)) {
+    if (!imageData.layerStore || imageData.layerStore->count()<=static_cast<size_t>(id)) {
         qDebug() << "can't find that layer!";
         return;
     }
-    Magick::Blob output;
-    imageData.layers[id].write(&output);
-    unsigned char *imgBuffer = reinterpret_cast<unsigned char*>(const_cast<void*>(output.data()));
-    std::vector<unsigned char> imgData(imgBuffer, imgBuffer + output.length());
-    imageData.imageBuffer = imgData;
-    updateImage();
+    activeLayer = id;
+    resetPCSCache();
+    if (!convertWatcher.isRunning() && !regionWatcher.isRunning() &&
+        showCachedLayer(getLayerKey(id, getConvertSettings()))) {
+        layerPending = false;
+        prefetchLayers();
+        return;
+    }
+    // decode (and convert) on the prefetch worker, large PSB layers
+    // would freeze the GUI thread
+    layerPending = true;
+    loadActiveLayer();
+}
+
+// waits for a running prefetch, handlePrefetchWatcher starts it then
+void Cyan::loadActiveLayer()
+{
+    if (activeLayer<0 || !imageData.layerStore || prefetchWatcher.isRunning()) { return; }
+    FXX::Image settings = getConvertSettings();
+    prefetchKey = getLayerKey(activeLayer, settings);
+    prefetchLayer = activeLayer;
+    prefetchGeneration = layerCacheGeneration;
+    prefetchWatcher.setFuture(QtConcurrent::run(convertLayer,
+                                                imageData.layerStore,
+                                                static_cast<size_t>(activeLayer),
+                                                settings));
+}
+
+QString Cyan::getLayerKey(int layer,
+                          const FXX::Image &settings)
+{
+    if (layer<0 || settings.iccInputBuffer.size()==0) { return QString(); }
+    return QString::fromStdString(FXX::ResultCache::makeKey(static_cast<unsigned long long>(layer),
+                                                            settings,
+                                                            "layer"));
+}
+
+void Cyan::cacheLayer(const QString &key,
+                      const FXX::Image &image)
+{
+    if (key.isEmpty()) { return; }
+    if (layerCache.contains(key)) { layerCacheBytes -= layerBytes(layerCache.value(key)); }
+    layerCache[key] = image;
+    layerCacheBytes += layerBytes(image);
+    layerCacheOrder.removeAll(key);
+    layerCacheOrder.prepend(key);
+    // large PSB layers, limit by size, not by count
+    while (layerCacheBytes>LAYER_CACHE_BYTES && !layerCacheOrder.isEmpty()) {
+        layerCacheBytes -= layerBytes(layerCache.take(layerCacheOrder.takeLast()));
+    }
+}
+
+qint64 Cyan::layerBytes(const FXX::Image &image)
+{
+    return static_cast<qint64>(image.imageBuffer.size() +
+                               image.workBuffer.size() +
+                               image.previewBuffer.size());
+}
+
+bool Cyan::showCachedLayer(const QString &key)
+{
+    if (key.isEmpty() || !layerCache.contains(key)) { return false; }
+    const FXX::Image &layer = layerCache[key];
+    imageData.imageBuffer = layer.imageBuffer;
+    imageData.workBuffer = layer.workBuffer;
+    updatePixelProbe();
+    setImage(QByteArray(reinterpret_cast<const char*>(layer.previewBuffer.data()),
+                        static_cast<int>(layer.previewBuffer.size())));
+    layerCacheOrder.removeAll(key);
+    layerCacheOrder.prepend(key);
+    return true;
+}
+
+// convert the layers next to the active one in the background
+void Cyan::prefetchLayers()
+{
+    if (activeLayer<0 || prefetchWatcher.isRunning()) { return; }
+    FXX::Image settings = getConvertSettings();
+    QList<int> neighbours;
+    neighbours << activeLayer+1 << activeLayer-1;
+    for (int i = 0; i < neighbours.size(); ++i) {
+        int layer = neighbours.at(i);
+        if (layer<0 || !imageData.layerStore ||
+            static_cast<size_t>(layer)>=imageData.layerStore->count()) { continue; }
+        QString key = getLayerKey(layer, settings);
+        if (key.isEmpty() || layerCache.contains(key)) { continue; }
+        prefetchKey = key;
+        prefetchLayer = layer;
+        prefetchGeneration = layerCacheGeneration;
+        prefetchWatcher.setFuture(QtConcurrent::run(convertLayer,
+                                                    imageData.layerStore,
+                                                    static_cast<size_t>(layer),
+                                                    settings));
+        return;
+    }
+}
+
+void Cyan::clearLayerCache()
+{
+    layerCacheGeneration++;
+    layerCache.clear();
+    layerCacheOrder.clear();
+    layerCacheBytes = 0;
+    convertKey.clear();
+    prefetchKey.clear();
 }
 
 void Cyan::enableLayers(bool enable)
 {
     selectedLayer->setEnabled(enable);
     selectedLayerLabel->setEnabled(enable);
+    browseLayersButton->setEnabled(enable);
     selectedLayer->clear();
-    if (!enable) { return; }
+    if (!enable || !imageData.layerStore) { return; }
     selectedLayer->blockSignals(true);
-    for (size_t i = 0; i < imageData.layers.size(); ++i) {
-        QString label = QString::fromStdString(imageData.layers.at(i).label());
+    for (size_t i = 0; i < imageData.layerStore->count(); ++i) {
+        QString label = QString::fromStdString(imageData.layerStore->layers().at(i).name);
         if (label.isEmpty()) {
             label = tr("[%1] Layer");
         } else {
@@ -1619,6 +2586,24 @@ void Cyan::handleNativeStyleChanged(bool triggered)
                              tr("Restart Cyan to apply settings."));
 }
 
+void Cyan::handlePCSCacheChanged(bool triggered)
+{
+    if (triggered) { pcsImage = std::make_shared<FXX::PCSImage>(); }
+    else { pcsImage.reset(); }
+}
+
+void Cyan::handleResultCacheChanged(bool triggered)
+{
+    if (triggered) { resultCache = std::make_shared<FXX::ResultCache>(); }
+    else { resultCache.reset(); }
+}
+
+void Cyan::resetPCSCache()
+{
+    // running conversions keep their own reference
+    if (pcsImage) { pcsImage = std::make_shared<FXX::PCSImage>(); }
+}
+
 int Cyan::getDiskResource()
 {
     return qRound(static_cast<double>(Magick::ResourceLimits::disk()/RESOURCE_BYTE));
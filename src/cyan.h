@@ -48,7 +48,7 @@
 #include <QLabel>
 #include <QProgressBar>
 #include <QObject>
-//#include <QDockWidget>
+#include <QDockWidget>
 //#include <QTreeWidget>
 //#include <QTreeWidgetItem>
 #include <QMap>
@@ -56,12 +56,21 @@
 #include <QFutureWatcher>
 #include <QSpinBox>
 #include <QActionGroup>
+#include <QFileSystemWatcher>
+#include <QTimer>
+#include <QSet>
+#include <QPair>
+#include <QDateTime>
 
 #include "imageview.h"
+#include "tileditem.h"
+#include "statspanel.h"
 #include "profiledialog.h"
 #include "FXX.h"
 
 #define RESOURCE_BYTE 1050000000
+#define PROFILE_WATCHER_DELAY 1000
+#define LAYER_CACHE_BYTES 1073741824
 
 class Cyan : public QMainWindow
 {
@@ -78,9 +87,13 @@ signals:
 private:
     QFutureWatcher<FXX::Image> convertWatcher;
     QFutureWatcher<FXX::Image> readWatcher;
+    QFutureWatcher<FXX::Image> prefetchWatcher;
+    QFutureWatcher<FXX::Image> regionWatcher;
+    QFutureWatcher<std::shared_ptr<FXX::PixelProbe> > probeWatcher;
     FXX fx;
     QGraphicsScene *scene;
     ImageView *view;
+    TiledImageItem *imageItem;
     QToolBar *mainBar;
     QToolBar *profileBar;
     QComboBox *rgbProfile;
@@ -97,6 +110,7 @@ private:
     QAction *openImageAction;
     QAction *saveImageAction;
     QAction *infoImageAction;
+    QAction *compareImageAction;
     QAction *quitAction;
     QAction *exportEmbeddedProfileAction;
     QComboBox *bitDepth;
@@ -110,8 +124,44 @@ private:
     QActionGroup *magickMemoryResourcesGroup;
     QMenu *memoryMenu;
     int activeLayer;
+    int convertLayerId;
+    QString convertKey;
+    QMap<QString, FXX::Image> layerCache;
+    QStringList layerCacheOrder;
+    qint64 layerCacheBytes;
+    int layerCacheGeneration;
+    int prefetchGeneration;
+    QString prefetchKey;
+    int prefetchLayer;
+    bool layerPending;
     QComboBox *selectedLayer;
     QLabel *selectedLayerLabel;
+    QPushButton *browseLayersButton;
+    QMap<int, QMap<QString, QString> > profileBuckets;
+    QMap<QString, FXX::ProfileInfo> profileLibrary;
+    QMap<QString, QPair<QDateTime, qint64> > profileStamps;
+    QFileSystemWatcher *profileWatcher;
+    QTimer *profileWatcherTimer;
+    QSet<QString> pendingProfilePaths;
+    FXX::TransformCache transformCache;
+    std::shared_ptr<FXX::PCSImage> pcsImage;
+    QAction *pcsCacheAction;
+    std::shared_ptr<FXX::ResultCache> resultCache;
+    QAction *resultCacheAction;
+    FXX::Image pendingConvert;
+    QRect regionRect;
+    int regionStep;
+    std::shared_ptr<FXX::PixelProbe> pixelProbe;
+    bool probePending;
+    QLabel *pixelLabel;
+    QDockWidget *statsDock;
+    StatsPanel *statsPanel;
+    QMenu *inkLimitMenu;
+    QActionGroup *inkLimitGroup;
+    QAction *inkOverlayAction;
+    QLabel *tacLabel;
+    QAction *deltaEAction;
+    QLabel *deltaELabel;
 
 private slots:
     void readConfig();
@@ -149,6 +199,8 @@ private slots:
     void convertPSD(FXX::Image image, QString const &filename);
     void handlePSDConverted(bool success, const QString &filename);
     void updateImage();
+    FXX::Image getConvertSettings();
+    QRect getConvertRegion(int *step);
 
     QByteArray getMonitorProfile();
     QByteArray getOutputProfile();
@@ -183,23 +235,62 @@ private slots:
     int supportedDepth();
     void clearImageBuffer();
 
+    QStringList getProfileFolders();
+    void scanProfiles();
+    void bucketProfiles();
     QMap<QString,QString> genProfiles(FXX::ColorSpace colorspace);
+    QMap<QString,QString> genProfiles(FXX::ColorSpace colorspace,
+                                      FXX::ProfileClass profileClass);
+    QMap<QString,QString> genOutputProfiles(FXX::ColorSpace colorspace);
+
+    void handleProfilePathChanged(const QString &path);
+    void handleProfileWatcherTimeout();
+    void watchProfileFolders(const QStringList &folders);
+    void watchSelectedProfiles();
+    void refreshProfileBoxes(const QSet<QString> &changedFiles);
+    bool syncProfileBox(QComboBox *box,
+                        const QMap<QString,QString> &profiles,
+                        const QString &emptyText,
+                        const QSet<QString> &changedFiles);
     QByteArray getDefaultProfile(FXX::ColorSpace colorspace);
 
     void handleConvertWatcher();
     void handleReadWatcher();
+    void handlePrefetchWatcher();
+    void handleRegionWatcher();
+    void handleProbeWatcher();
 
-    void handleImageHasLayers(std::vector<Magick::Image> layers);
-    void handleLoadImageLayer(Magick::Image image);
+    void handleImageHasLayers();
+    void handleLoadImageLayer(int index);
 
     void handleImageInfoButton();
+    void handleCompareImage();
+    void updatePixelProbe();
+    void handlePixelHover(const QPointF &pos);
+    void handlePixelLeave();
+    double getInkLimit();
+    void setInkLimit(double limit);
+    void handleInkLimitAct(bool triggered);
+    void updateOverlay();
     void getImageInfo(FXX::Image image);
     void handleImageInfo(QString information);
 
     void switchLayer(int id);
     void enableLayers(bool enable);
+    QString getLayerKey(int layer,
+                        const FXX::Image &settings);
+    void cacheLayer(const QString &key,
+                    const FXX::Image &image);
+    bool showCachedLayer(const QString &key);
+    static qint64 layerBytes(const FXX::Image &image);
+    void prefetchLayers();
+    void loadActiveLayer();
+    void clearLayerCache();
 
     void handleNativeStyleChanged(bool triggered);
+    void handlePCSCacheChanged(bool triggered);
+    void handleResultCacheChanged(bool triggered);
+    void resetPCSCache();
 
     int getDiskResource();
     void setDiskResource(int gib);
@@ -0,0 +1,225 @@
+/*
+# Copyright Ole-André Rodlie, INRIA.
+#
+# ole.andre.rodlie@gmail.com
+#
+# This software is governed by the CeCILL license under French law and
+# abiding by the rules of distribution of free software. You can use,
+# modify and / or redistribute the software under the terms of the CeCILL
+# license as circulated by CEA, CNRS and INRIA at the following URL
+# "https://www.cecill.info".
+#
+# As a counterpart to the access to the source code and rights to
+# modify and redistribute granted by the license, users are provided only
+# with a limited warranty and the software's author, the holder of the
+# economic rights and the subsequent licensors have only limited
+# liability.
+#
+# In this respect, the user's attention is drawn to the associated risks
+# with loading, using, modifying and / or developing or reproducing the
+# software by the user in light of its specific status of free software,
+# that can mean that it is complicated to manipulate, and that also
+# so that it is for developers and experienced
+# professionals having in-depth computer knowledge. Users are therefore
+# encouraged to test and test the software's suitability
+# Requirements in the conditions of their systems
+# data to be ensured and, more generally, to use and operate
+# same conditions as regards security.
+#
+# The fact that you are presently reading this means that you have had
+# knowledge of the CeCILL license and that you accept its terms.
+*/
+
+#include "hotfolder.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <dirent.h>
+#include <sys/stat.h>
+
+std::atomic<bool> HotFolder::running(false);
+
+HotFolder::HotFolder(const std::string &inputFolder,
+                     const std::string &outputFolder,
+                     const std::string &errorFolder,
+                     const Batch::Preset &preset,
+                     unsigned int workers)
+    : inputFolder(inputFolder)
+    , outputFolder(outputFolder)
+    , errorFolder(errorFolder)
+    , settings(std::make_shared<const FXX::Image>(preset.settings))
+    , format(preset.format)
+    , quality(preset.quality)
+    , workers(workers)
+    , jobCount(0)
+{
+}
+
+int HotFolder::exec(int interval)
+{
+    if (!isFolder(inputFolder) || !isFolder(outputFolder) || !isFolder(errorFolder)) {
+        std::cerr << "Input, output and error folders must exist." << std::endl;
+        return 1;
+    }
+    if (settings->iccOutputBuffer.size()==0) {
+        std::cerr << "Missing output profile." << std::endl;
+        return 1;
+    }
+
+    std::cout << "Watching " << inputFolder << " ..." << std::endl;
+    running = true;
+    while (running) {
+        std::vector<std::string> files = getReadyFiles();
+        if (files.size()>0) {
+            std::vector<Batch::Job> jobs;
+            for (size_t i = 0; i < files.size(); ++i) {
+                // write to a hidden file and rename when done, the full
+                // input name and a job number keep it unique, scan.tif and
+                // scan.jpg may run at the same time
+                Batch::Job job;
+                job.input = files.at(i);
+                job.output = outputFolder + "/." + fileName(files.at(i)) + "." + std::to_string(jobCount++) + ".part." + format;
+                job.settings = settings;
+                job.quality = quality;
+                jobs.push_back(job);
+            }
+            batch.run(jobs, workers, [this](const Batch::Result &result) {
+                handleResult(result);
+            });
+            continue;
+        }
+        for (int i = 0; i < interval && running; i += 100) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }
+    std::cout << "Stopped watching " << inputFolder << std::endl;
+    return 0;
+}
+
+void HotFolder::stop()
+{
+    running = false;
+}
+
+std::vector<std::string> HotFolder::getReadyFiles()
+{
+    std::vector<std::string> result;
+    std::map<std::string, HotFolder::Stamp> current;
+
+    DIR *dir = opendir(inputFolder.c_str());
+    if (!dir) { return result; }
+    while (struct dirent *entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name.empty() || name.at(0) == '.') { continue; }
+        std::string path = inputFolder + "/" + name;
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode)) { continue; }
+
+        // only pick up files that did not change since last poll
+        HotFolder::Stamp stamp;
+        stamp.size = static_cast<long long>(info.st_size);
+        stamp.modified = static_cast<long long>(info.st_mtime);
+        std::map<std::string, HotFolder::Stamp>::const_iterator previous = stamps.find(path);
+        if (previous != stamps.end() &&
+            previous->second.size == stamp.size &&
+            previous->second.modified == stamp.modified &&
+            stamp.size>0) {
+            result.push_back(path);
+        } else {
+            current[path] = stamp;
+        }
+    }
+    closedir(dir);
+
+    stamps = current;
+    return result;
+}
+
+void HotFolder::handleResult(const Batch::Result &result)
+{
+    if (!result.success) {
+        std::remove(result.job.output.c_str());
+        handleFailed(result.job.input, result.image.error);
+        return;
+    }
+
+    std::string output = outputName(result.job.input);
+    if (!moveFile(result.job.output, output)) {
+        std::remove(result.job.output.c_str());
+        handleFailed(result.job.input, "Unable to write " + output);
+        return;
+    }
+    std::remove(result.job.input.c_str());
+    std::cout << result.job.input << " -> " << output << " (" << result.seconds << "s)" << std::endl;
+    if (!result.image.warning.empty()) { std::cout << result.image.warning << std::endl; }
+}
+
+// <name>.<format>, if taken (scan.tif and scan.jpg both give scan)
+// <name>_<suffix>.<format>, then with a number, never overwrites
+std::string HotFolder::outputName(const std::string &input)
+{
+    std::string base = outputFolder + "/" + Batch::baseName(input);
+    std::string output = base + "." + format;
+    struct stat info;
+    if (stat(output.c_str(), &info) != 0) { return output; }
+    std::string suffix = Batch::fileSuffix(input);
+    if (!suffix.empty()) { base.append("_" + suffix); }
+    output = freeName(base, "." + format);
+    std::cout << input << ": output exists, writing " << output << std::endl;
+    return output;
+}
+
+void HotFolder::handleFailed(const std::string &file,
+                             const std::string &reason)
+{
+    std::cerr << file << ": " << reason << std::endl;
+    // keep earlier failed originals of the same name
+    std::string name = fileName(file);
+    size_t dot = name.find_last_of('.');
+    if (dot == 0) { dot = std::string::npos; }
+    std::string destination = freeName(errorFolder + "/" + name.substr(0, dot),
+                                       dot == std::string::npos?"":name.substr(dot));
+    if (!moveFile(file, destination)) {
+        std::cerr << "Unable to move " << file << " to " << errorFolder << std::endl;
+        return;
+    }
+    std::ofstream log((destination + ".error.txt").c_str());
+    log << reason << std::endl;
+}
+
+bool HotFolder::isFolder(const std::string &path)
+{
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+std::string HotFolder::fileName(const std::string &path)
+{
+    size_t slash = path.find_last_of("/\\");
+    if (slash == std::string::npos) { return path; }
+    return path.substr(slash+1);
+}
+
+std::string HotFolder::freeName(const std::string &base,
+                               const std::string &extension)
+{
+    std::string name = base + extension;
+    struct stat info;
+    for (int i = 2; stat(name.c_str(), &info) == 0; ++i) {
+        name = base + "_" + std::to_string(i) + extension;
+    }
+    return name;
+}
+
+bool HotFolder::moveFile(const std::string &source,
+                         const std::string &destination)
+{
+#ifdef _WIN32
+    // rename does not replace existing files on Windows
+    std::remove(destination.c_str());
+#endif
+    return std::rename(source.c_str(), destination.c_str()) == 0;
+}
@@ -0,0 +1,91 @@
+/*
+# Copyright Ole-André Rodlie, INRIA.
+#
+# ole.andre.rodlie@gmail.com
+#
+# This software is governed by the CeCILL license under French law and
+# abiding by the rules of distribution of free software. You can use,
+# modify and / or redistribute the software under the terms of the CeCILL
+# license as circulated by CEA, CNRS and INRIA at the following URL
+# "https://www.cecill.info".
+#
+# As a counterpart to the access to the source code and rights to
+# modify and redistribute granted by the license, users are provided only
+# with a limited warranty and the software's author, the holder of the
+# economic rights and the subsequent licensors have only limited
+# liability.
+#
+# In this respect, the user's attention is drawn to the associated risks
+# with loading, using, modifying and / or developing or reproducing the
+# software by the user in light of its specific status of free software,
+# that can mean that it is complicated to manipulate, and that also
+# so that it is for developers and experienced
+# professionals having in-depth computer knowledge. Users are therefore
+# encouraged to test and test the software's suitability
+# Requirements in the conditions of their systems
+# data to be ensured and, more generally, to use and operate
+# same conditions as regards security.
+#
+# The fact that you are presently reading this means that you have had
+# knowledge of the CeCILL license and that you accept its terms.
+*/
+
+#ifndef HOTFOLDER_H
+#define HOTFOLDER_H
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "batch.h"
+
+#define HOTFOLDER_INTERVAL 1000
+
+class HotFolder
+{
+public:
+    HotFolder(const std::string &inputFolder,
+              const std::string &outputFolder,
+              const std::string &errorFolder,
+              const Batch::Preset &preset,
+              unsigned int workers = 0);
+
+    int exec(int interval = HOTFOLDER_INTERVAL);
+    static void stop();
+
+private:
+    struct Stamp
+    {
+        long long size = -1;
+        long long modified = 0;
+    };
+
+    std::string inputFolder;
+    std::string outputFolder;
+    std::string errorFolder;
+    std::shared_ptr<const FXX::Image> settings;
+    std::string format;
+    int quality;
+    unsigned int workers;
+    Batch batch;
+    unsigned long long jobCount;
+    std::map<std::string, HotFolder::Stamp> stamps;
+    static std::atomic<bool> running;
+
+    std::vector<std::string> getReadyFiles();
+    void handleResult(const Batch::Result &result);
+    void handleFailed(const std::string &file,
+                      const std::string &reason);
+
+    std::string outputName(const std::string &input);
+
+    static bool isFolder(const std::string &path);
+    static std::string fileName(const std::string &path);
+    static std::string freeName(const std::string &base,
+                                const std::string &extension);
+    static bool moveFile(const std::string &source,
+                         const std::string &destination);
+};
+
+#endif // HOTFOLDER_H
@@ -37,7 +37,8 @@
 #include <QSettings>
 
 ImageView::ImageView(QWidget* parent) : QGraphicsView(parent)
-, fit(false) {
+, fit(false)
+, syncing(false) {
     setAcceptDrops(true);
 
     // set style
@@ -49,6 +50,19 @@ ImageView::ImageView(QWidget* parent) : QGraphicsView(parent)
         setBackgroundBrush(QColor(30,30,30));
     }
     setDragMode(QGraphicsView::ScrollHandDrag);
+    viewport()->setMouseTracking(true);
+}
+
+// part of the scene inside the viewport
+QRectF ImageView::visibleRect() const
+{
+    if (!scene()) { return QRectF(); }
+    return mapToScene(viewport()->rect()).boundingRect().intersected(sceneRect());
+}
+
+double ImageView::zoom() const
+{
+    return transform().m11();
 }
 
 void ImageView::wheelEvent(QWheelEvent* event) {
@@ -62,6 +76,7 @@ void ImageView::wheelEvent(QWheelEvent* event) {
         scale(1.0 / scaleFactor, 1.0 / scaleFactor);
         emit myZoom(1.0 / scaleFactor, 1.0 / scaleFactor);
     }
+    emitViewMoved();
 }
 
 void ImageView::mousePressEvent(QMouseEvent *event)
@@ -78,6 +93,18 @@ void ImageView::mousePressEvent(QMouseEvent *event)
     }
 }
 
+void ImageView::mouseMoveEvent(QMouseEvent *event)
+{
+    emit pixelHover(mapToScene(event->pos()));
+    QGraphicsView::mouseMoveEvent(event);
+}
+
+void ImageView::leaveEvent(QEvent *event)
+{
+    emit pixelLeave();
+    QGraphicsView::leaveEvent(event);
+}
+
 void ImageView::dragEnterEvent(QDragEnterEvent *event)
 {
     event->acceptProposedAction();
@@ -113,12 +140,20 @@ void ImageView::resizeEvent(QResizeEvent */*event*/)
                   scene()->width(),
                   scene()->height(),
                   Qt::KeepAspectRatio);
+        emitViewMoved();
     }
 }
 
+void ImageView::scrollContentsBy(int dx, int dy)
+{
+    QGraphicsView::scrollContentsBy(dx, dy);
+    emitViewMoved();
+}
+
 void ImageView::doZoom(double scaleX, double scaleY)
 {
     scale(scaleX,scaleY);
+    emitViewMoved();
 }
 
 void ImageView::setFit(bool value)
@@ -129,4 +164,21 @@ void ImageView::setFit(bool value)
               scene()->width(),
               scene()->height(),
               Qt::KeepAspectRatio);
+    emitViewMoved();
+}
+
+// follow another view, used to pan and zoom views together
+void ImageView::syncView(const QTransform &transform, const QPointF &center)
+{
+    syncing = true;
+    fit = false;
+    setTransform(transform);
+    centerOn(center);
+    syncing = false;
+}
+
+void ImageView::emitViewMoved()
+{
+    if (syncing || !scene()) { return; }
+    emit viewMoved(transform(), mapToScene(viewport()->rect().center()));
 }
@@ -40,6 +40,7 @@
 #include <QDragMoveEvent>
 #include <QDragLeaveEvent>
 #include <QResizeEvent>
+#include <QTransform>
 
 class ImageView : public QGraphicsView
 {
@@ -48,6 +49,8 @@ class ImageView : public QGraphicsView
 public:
     explicit ImageView(QWidget* parent = Q_NULLPTR);
     bool fit;
+    QRectF visibleRect() const;
+    double zoom() const;
 
 signals:
     void resetZoom();
@@ -56,18 +59,29 @@ signals:
     void myFit(bool value);
     void openImage(QString file);
     void openProfile(QString file);
+    void viewMoved(const QTransform &transform, const QPointF &center);
+    void pixelHover(const QPointF &pos);
+    void pixelLeave();
 
 public slots:
     void doZoom(double scaleX, double scaleY);
     void setFit(bool value);
+    void syncView(const QTransform &transform, const QPointF &center);
 
 protected:
     void wheelEvent(QWheelEvent* event);
     void mousePressEvent(QMouseEvent *event);
+    void mouseMoveEvent(QMouseEvent *event);
+    void leaveEvent(QEvent *event);
     void dragEnterEvent(QDragEnterEvent *event);
     void dragMoveEvent(QDragMoveEvent *event);
     void dragLeaveEvent(QDragLeaveEvent *event);
     void dropEvent(QDropEvent *event);
     void resizeEvent(QResizeEvent *event);
+    void scrollContentsBy(int dx, int dy);
+
+private:
+    bool syncing;
+    void emitViewMoved();
 };
 #endif // IMAGEVIEW_H
@@ -0,0 +1,169 @@
+/*
+# Copyright Ole-André Rodlie, INRIA.
+#
+# ole.andre.rodlie@gmail.com
+#
+# This software is governed by the CeCILL license under French law and
+# abiding by the rules of distribution of free software. You can use,
+# modify and / or redistribute the software under the terms of the CeCILL
+# license as circulated by CEA, CNRS and INRIA at the following URL
+# "https://www.cecill.info".
+#
+# As a counterpart to the access to the source code and rights to
+# modify and redistribute granted by the license, users are provided only
+# with a limited warranty and the software's author, the holder of the
+# economic rights and the subsequent licensors have only limited
+# liability.
+#
+# In this respect, the user's attention is drawn to the associated risks
+# with loading, using, modifying and / or developing or reproducing the
+# software by the user in light of its specific status of free software,
+# that can mean that it is complicated to manipulate, and that also
+# so that it is for developers and experienced
+# professionals having in-depth computer knowledge. Users are therefore
+# encouraged to test and test the software's suitability
+# Requirements in the conditions of their systems
+# data to be ensured and, more generally, to use and operate
+# same conditions as regards security.
+#
+# The fact that you are presently reading this means that you have had
+# knowledge of the CeCILL license and that you accept its terms.
+*/
+
+#include "journal.h"
+
+#include <sstream>
+
+Journal::Journal(const std::string &file)
+    : file(file)
+{
+}
+
+// entries are tab separated lines:
+// input, job hash, input hash, then output and output hash for each output
+bool Journal::open(std::string *error)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::ifstream existing(file.c_str());
+    std::string line;
+    while (existing && std::getline(existing, line)) {
+        std::vector<std::string> fields;
+        std::istringstream split(line);
+        std::string field;
+        while (std::getline(split, field, '\t')) { fields.push_back(field); }
+        // a line cut short by a crash is ignored, the job is redone
+        if (fields.size()<5 || fields.size()%2 == 0) { continue; }
+        Journal::Entry entry;
+        entry.input = fields.at(2);
+        for (size_t i = 3; i+1 < fields.size(); i += 2) {
+            entry.outputs.push_back(std::make_pair(fields.at(i), fields.at(i+1)));
+        }
+        done[fields.at(0) + "\t" + fields.at(1)] = entry;
+    }
+    stream.open(file.c_str(), std::ios::out | std::ios::app);
+    if (!stream) {
+        error->append("Unable to open journal " + file);
+        return false;
+    }
+    return true;
+}
+
+bool Journal::isDone(Batch::Job *job)
+{
+    Journal::Entry entry;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::map<std::string, Journal::Entry>::const_iterator found = done.find(job->input + "\t" + hashJob(*job));
+        if (found == done.end()) { return false; }
+        entry = found->second;
+    }
+    // kept on the job, the result cache and record() use the same hash
+    if (job->inputHash == 0) { job->inputHash = FXX::hashFile(job->input); }
+    std::string input = formatHash(job->inputHash);
+    if (input.empty() || input != entry.input) { return false; }
+
+    // verify outputs, anything missing, partial or changed is redone
+    std::vector<std::string> outputs = jobOutputs(*job);
+    if (outputs.size() != entry.outputs.size()) { return false; }
+    for (size_t i = 0; i < outputs.size(); ++i) {
+        if (outputs.at(i) != entry.outputs.at(i).first ||
+            formatHash(FXX::hashFile(outputs.at(i))) != entry.outputs.at(i).second) { return false; }
+    }
+    return true;
+}
+
+void Journal::record(const Batch::Result &result)
+{
+    if (!result.success) { return; }
+    unsigned long long inputHash = result.job.inputHash;
+    if (inputHash == 0) { inputHash = FXX::hashFile(result.job.input); }
+    std::string input = formatHash(inputHash);
+    if (input.empty()) { return; }
+
+    Journal::Entry entry;
+    entry.input = input;
+    std::vector<std::string> outputs = jobOutputs(result.job);
+    for (size_t i = 0; i < outputs.size(); ++i) {
+        std::string output = formatHash(FXX::hashFile(outputs.at(i)));
+        if (output.empty()) { return; }
+        entry.outputs.push_back(std::make_pair(outputs.at(i), output));
+    }
+
+    std::string key = result.job.input + "\t" + hashJob(result.job);
+    std::lock_guard<std::mutex> lock(mutex);
+    stream << key << "\t" << entry.input;
+    for (size_t i = 0; i < entry.outputs.size(); ++i) {
+        stream << "\t" << entry.outputs.at(i).first << "\t" << entry.outputs.at(i).second;
+    }
+    stream << std::endl;
+    done[key] = entry;
+}
+
+// FXX::hashFile as journal field, empty for unreadable files
+std::string Journal::formatHash(unsigned long long hash)
+{
+    if (hash == 0) { return std::string(); }
+    std::ostringstream result;
+    result << std::hex << hash;
+    return result.str();
+}
+
+std::string Journal::hashJob(const Batch::Job &job)
+{
+    std::ostringstream params;
+    params << job.output << ":" << job.quality;
+    if (job.settings) {
+        params << ":" << FXX::hash(job.settings->iccInputBuffer)
+               << ":" << FXX::hash(job.settings->iccOutputBuffer)
+               << ":" << FXX::hash(job.settings->iccRGB)
+               << ":" << FXX::hash(job.settings->iccCMYK)
+               << ":" << FXX::hash(job.settings->iccGRAY)
+               << ":" << job.settings->intent
+               << ":" << job.settings->blackpoint
+               << ":" << job.settings->depth
+               << ":" << job.settings->inkLimit
+               << ":" << job.settings->deltaELimit;
+    }
+    for (size_t i = 0; i < job.targets.size(); ++i) {
+        params << ":" << job.targets.at(i).filename
+               << ":" << FXX::hash(job.targets.at(i).profile)
+               << ":" << job.targets.at(i).intent
+               << ":" << job.targets.at(i).blackpoint
+               << ":" << job.targets.at(i).depth
+               << ":" << job.targets.at(i).quality
+               << ":" << job.targets.at(i).inkLimit
+               << ":" << job.targets.at(i).deltaELimit;
+    }
+    std::string text = params.str();
+    std::ostringstream result;
+    result << std::hex << FXX::hash(reinterpret_cast<const unsigned char*>(text.data()), text.size());
+    return result.str();
+}
+
+std::vector<std::string> Journal::jobOutputs(const Batch::Job &job)
+{
+    std::vector<std::string> outputs;
+    for (size_t i = 0; i < job.targets.size(); ++i) { outputs.push_back(job.targets.at(i).filename); }
+    if (outputs.size()==0) { outputs.push_back(job.output); }
+    return outputs;
+}
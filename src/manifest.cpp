@@ -0,0 +1,520 @@
+/*
+# Copyright Ole-André Rodlie, INRIA.
+#
+# ole.andre.rodlie@gmail.com
+#
+# This software is governed by the CeCILL license under French law and
+# abiding by the rules of distribution of free software. You can use,
+# modify and / or redistribute the software under the terms of the CeCILL
+# license as circulated by CEA, CNRS and INRIA at the following URL
+# "https://www.cecill.info".
+#
+# As a counterpart to the access to the source code and rights to
+# modify and redistribute granted by the license, users are provided only
+# with a limited warranty and the software's author, the holder of the
+# economic rights and the subsequent licensors have only limited
+# liability.
+#
+# In this respect, the user's attention is drawn to the associated risks
+# with loading, using, modifying and / or developing or reproducing the
+# software by the user in light of its specific status of free software,
+# that can mean that it is complicated to manipulate, and that also
+# so that it is for developers and experienced
+# professionals having in-depth computer knowledge. Users are therefore
+# encouraged to test and test the software's suitability
+# Requirements in the conditions of their systems
+# data to be ensured and, more generally, to use and operate
+# same conditions as regards security.
+#
+# The fact that you are presently reading this means that you have had
+# knowledge of the CeCILL license and that you accept its terms.
+*/
+
+#include "manifest.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <sstream>
+#include <sys/stat.h>
+
+class ManifestParser
+{
+public:
+    ManifestParser(const std::string &text)
+        : text(text)
+        , pos(0)
+    {
+    }
+
+    bool parse(Manifest::Value *value,
+               std::string *error)
+    {
+        if (!parseValue(value, error)) { return false; }
+        skipSpace();
+        if (pos != text.size()) { return fail("Unexpected data", error); }
+        return true;
+    }
+
+private:
+    const std::string &text;
+    size_t pos;
+
+    bool fail(const std::string &reason,
+              std::string *error)
+    {
+        std::ostringstream message;
+        message << reason << " at offset " << pos << " in manifest.";
+        error->append(message.str());
+        return false;
+    }
+
+    void skipSpace()
+    {
+        while (pos < text.size() &&
+               (text[pos] == ' ' || text[pos] == '\t' ||
+                text[pos] == '\n' || text[pos] == '\r')) { pos++; }
+    }
+
+    bool match(const std::string &word)
+    {
+        if (text.compare(pos, word.size(), word) != 0) { return false; }
+        pos += word.size();
+        return true;
+    }
+
+    bool parseValue(Manifest::Value *value,
+                    std::string *error)
+    {
+        skipSpace();
+        if (pos >= text.size()) { return fail("Unexpected end", error); }
+        char c = text[pos];
+        if (c == '{') { return parseObject(value, error); }
+        if (c == '[') { return parseArray(value, error); }
+        if (c == '"') {
+            value->type = Manifest::Value::StringType;
+            return parseString(&value->string, error);
+        }
+        if (match("true")) {
+            value->type = Manifest::Value::BoolType;
+            value->boolean = true;
+            return true;
+        }
+        if (match("false")) {
+            value->type = Manifest::Value::BoolType;
+            value->boolean = false;
+            return true;
+        }
+        if (match("null")) {
+            value->type = Manifest::Value::NullType;
+            return true;
+        }
+        const char *start = text.c_str() + pos;
+        char *end = nullptr;
+        value->number = std::strtod(start, &end);
+        if (end == start) { return fail("Invalid value", error); }
+        value->type = Manifest::Value::NumberType;
+        pos += static_cast<size_t>(end - start);
+        return true;
+    }
+
+    bool parseArray(Manifest::Value *value,
+                    std::string *error)
+    {
+        value->type = Manifest::Value::ArrayType;
+        pos++;
+        skipSpace();
+        if (pos < text.size() && text[pos] == ']') {
+            pos++;
+            return true;
+        }
+        for (;;) {
+            Manifest::Value item;
+            if (!parseValue(&item, error)) { return false; }
+            value->array.push_back(item);
+            skipSpace();
+            if (pos < text.size() && text[pos] == ',') { pos++; continue; }
+            if (pos < text.size() && text[pos] == ']') { pos++; return true; }
+            return fail("Expected ',' or ']'", error);
+        }
+    }
+
+    bool parseObject(Manifest::Value *value,
+                     std::string *error)
+    {
+        value->type = Manifest::Value::ObjectType;
+        pos++;
+        skipSpace();
+        if (pos < text.size() && text[pos] == '}') {
+            pos++;
+            return true;
+        }
+        for (;;) {
+            skipSpace();
+            std::string key;
+            if (pos >= text.size() || text[pos] != '"') { return fail("Expected key", error); }
+            if (!parseString(&key, error)) { return false; }
+            skipSpace();
+            if (pos >= text.size() || text[pos] != ':') { return fail("Expected ':'", error); }
+            pos++;
+            Manifest::Value item;
+            if (!parseValue(&item, error)) { return false; }
+            value->object.push_back(std::make_pair(key, item));
+            skipSpace();
+            if (pos < text.size() && text[pos] == ',') { pos++; continue; }
+            if (pos < text.size() && text[pos] == '}') { pos++; return true; }
+            return fail("Expected ',' or '}'", error);
+        }
+    }
+
+    bool parseHex(unsigned int *code)
+    {
+        if (pos + 4 > text.size()) { return false; }
+        *code = 0;
+        for (size_t i = 0; i < 4; ++i) {
+            char c = text[pos++];
+            *code <<= 4;
+            if (c >= '0' && c <= '9') { *code |= static_cast<unsigned int>(c - '0'); }
+            else if (c >= 'a' && c <= 'f') { *code |= static_cast<unsigned int>(c - 'a' + 10); }
+            else if (c >= 'A' && c <= 'F') { *code |= static_cast<unsigned int>(c - 'A' + 10); }
+            else { return false; }
+        }
+        return true;
+    }
+
+    bool parseString(std::string *result,
+                     std::string *error)
+    {
+        pos++;
+        while (pos < text.size()) {
+            char c = text[pos++];
+            if (c == '"') { return true; }
+            if (c != '\\') {
+                result->push_back(c);
+                continue;
+            }
+            if (pos >= text.size()) { break; }
+            c = text[pos++];
+            switch (c) {
+            case 'b': result->push_back('\b'); break;
+            case 'f': result->push_back('\f'); break;
+            case 'n': result->push_back('\n'); break;
+            case 'r': result->push_back('\r'); break;
+            case 't': result->push_back('\t'); break;
+            case 'u':
+            {
+                unsigned int code;
+                if (!parseHex(&code)) { return fail("Invalid escape", error); }
+                if (code >= 0xD800 && code <= 0xDBFF) {
+                    unsigned int low;
+                    if (!match("\\u") || !parseHex(&low) ||
+                        low < 0xDC00 || low > 0xDFFF) { return fail("Invalid escape", error); }
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                }
+                if (code < 0x80) {
+                    result->push_back(static_cast<char>(code));
+                } else if (code < 0x800) {
+                    result->push_back(static_cast<char>(0xC0 | (code >> 6)));
+                    result->push_back(static_cast<char>(0x80 | (code & 0x3F)));
+                } else if (code < 0x10000) {
+                    result->push_back(static_cast<char>(0xE0 | (code >> 12)));
+                    result->push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+                    result->push_back(static_cast<char>(0x80 | (code & 0x3F)));
+                } else {
+                    result->push_back(static_cast<char>(0xF0 | (code >> 18)));
+                    result->push_back(static_cast<char>(0x80 | ((code >> 12) & 0x3F)));
+                    result->push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+                    result->push_back(static_cast<char>(0x80 | (code & 0x3F)));
+                }
+                break;
+            }
+            default:
+                result->push_back(c);
+            }
+        }
+        return fail("Unterminated string", error);
+    }
+};
+
+static long long fileSize(const std::string &file)
+{
+    struct stat info;
+    if (stat(file.c_str(), &info) != 0) { return -1; }
+    return static_cast<long long>(info.st_size);
+}
+
+Manifest::Manifest(const Batch::Preset &defaults)
+    : defaults(defaults)
+{
+}
+
+bool Manifest::read(const std::string &file,
+                    std::string *error)
+{
+    std::ifstream stream(file.c_str(), std::ios::binary);
+    if (!stream) {
+        error->append("Unable to open manifest " + file);
+        return false;
+    }
+    std::string text((std::istreambuf_iterator<char>(stream)),
+                     std::istreambuf_iterator<char>());
+
+    Manifest::Value root;
+    if (!parse(text, &root, error)) { return false; }
+
+    // either a list of jobs or {"defaults": {...}, "jobs": [...]}
+    Manifest::Value jobDefaults;
+    const Manifest::Value *jobs = &root;
+    if (root.type == Manifest::Value::ObjectType) {
+        jobs = nullptr;
+        for (size_t i = 0; i < root.object.size(); ++i) {
+            if (root.object.at(i).first == "defaults") { jobDefaults = root.object.at(i).second; }
+            else if (root.object.at(i).first == "jobs") { jobs = &root.object.at(i).second; }
+        }
+    }
+    if (!jobs || jobs->type != Manifest::Value::ArrayType) {
+        error->append("Manifest has no list of jobs.");
+        return false;
+    }
+    for (size_t i = 0; i < jobs->array.size(); ++i) {
+        if (!readJob(jobDefaults, jobs->array.at(i), error)) {
+            std::ostringstream message;
+            message << " (job " << i << ")";
+            error->append(message.str());
+            return false;
+        }
+    }
+    group();
+    return true;
+}
+
+int Manifest::exec(unsigned int workers,
+                   std::ostream &report,
+                   Journal *journal)
+{
+    Batch batch;
+    int failed = 0;
+    size_t skipped = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    // jobs already in the journal, with matching outputs, are skipped
+    std::vector<Batch::Job> pending;
+    std::vector<size_t> pendingIndex;
+    for (size_t i = 0; i < manifestJobs.size(); ++i) {
+        if (journal && journal->isDone(&manifestJobs.at(i))) {
+            skipped++;
+            continue;
+        }
+        pending.push_back(manifestJobs.at(i));
+        pendingIndex.push_back(i);
+    }
+
+    batch.run(pending, workers, [&](const Batch::Result &result) {
+        if (!result.success) { failed++; }
+        if (journal) { journal->record(result); }
+        report << "{\"input\":" << quote(result.job.input)
+               << ",\"output\":" << quote(result.job.output)
+               << ",\"group\":" << jobGroups.at(pendingIndex.at(result.index))
+               << ",\"success\":" << (result.success?"true":"false")
+               << ",\"seconds\":" << result.seconds
+               << ",\"input-size\":" << fileSize(result.job.input)
+               << ",\"output-size\":" << (result.success?fileSize(result.job.output):-1)
+               << ",\"width\":" << result.image.width
+               << ",\"height\":" << result.image.height;
+        if (result.image.tac.pixels>0) {
+            report << ",\"tac-max\":" << result.image.tac.max
+                   << ",\"tac-p99\":" << result.image.tac.p99
+                   << ",\"tac-over\":" << result.image.tac.over;
+        }
+        if (result.image.deltaE.pixels>0) {
+            report << ",\"delta-e-mean\":" << result.image.deltaE.mean
+                   << ",\"delta-e-p95\":" << result.image.deltaE.p95
+                   << ",\"delta-e-max\":" << result.image.deltaE.max;
+        }
+        report << ",\"warning\":" << quote(result.image.warning)
+               << ",\"error\":" << quote(result.image.error)
+               << "}" << std::endl;
+    });
+
+    report << "{\"jobs\":" << manifestJobs.size()
+           << ",\"groups\":" << groups()
+           << ",\"transforms\":" << batch.transformCache()->transformsCreated()
+           << ",\"failed\":" << failed
+           << ",\"skipped\":" << skipped
+           << ",\"seconds\":" << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()
+           << "}" << std::endl;
+
+    return failed>0?1:0;
+}
+
+const std::vector<Batch::Job> &Manifest::jobs() const
+{
+    return manifestJobs;
+}
+
+size_t Manifest::groups() const
+{
+    return groupIds.size();
+}
+
+bool Manifest::parse(const std::string &text,
+                     Manifest::Value *value,
+                     std::string *error)
+{
+    ManifestParser parser(text);
+    return parser.parse(value, error);
+}
+
+std::string Manifest::quote(const std::string &text)
+{
+    std::string result = "\"";
+    for (size_t i = 0; i < text.size(); ++i) {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        switch (c) {
+        case '"': result.append("\\\""); break;
+        case '\\': result.append("\\\\"); break;
+        case '\n': result.append("\\n"); break;
+        case '\r': result.append("\\r"); break;
+        case '\t': result.append("\\t"); break;
+        default:
+            if (c < 0x20) {
+                char escape[7];
+                std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+                result.append(escape);
+            } else {
+                result.push_back(static_cast<char>(c));
+            }
+        }
+    }
+    result.append("\"");
+    return result;
+}
+
+bool Manifest::readJob(const Manifest::Value &jobDefaults,
+                       const Manifest::Value &job,
+                       std::string *error)
+{
+    if (job.type != Manifest::Value::ObjectType) {
+        error->append("Job is not an object.");
+        return false;
+    }
+
+    Batch::Preset preset = defaults;
+    Batch::Job result;
+    std::string outputFolder;
+    const Manifest::Value *sources[] = { &jobDefaults, &job };
+    for (size_t s = 0; s < 2; ++s) {
+        for (size_t i = 0; i < sources[s]->object.size(); ++i) {
+            const std::string &key = sources[s]->object.at(i).first;
+            const Manifest::Value &value = sources[s]->object.at(i).second;
+            if (key == "input") { result.input = value.string; }
+            else if (key == "output") { result.output = value.string; }
+            else if (key == "output-folder") { outputFolder = value.string; }
+            else if (!setOption(key, value, &preset, error)) { return false; }
+        }
+    }
+
+    if (result.input.empty()) {
+        error->append("Job has no input.");
+        return false;
+    }
+    if (preset.settings.iccOutputBuffer.size()==0) {
+        error->append("Job has no output profile.");
+        return false;
+    }
+    if (result.output.empty()) {
+        if (outputFolder.empty()) {
+            size_t slash = result.input.find_last_of("/\\");
+            if (slash != std::string::npos) { outputFolder = result.input.substr(0, slash); }
+        }
+        result.output = (outputFolder.empty()?std::string():outputFolder + "/") +
+                        Batch::baseName(result.input) + "." + preset.format;
+    }
+
+    size_t group;
+    result.settings = getSettings(preset.settings, &group);
+    result.quality = preset.quality;
+    manifestJobs.push_back(result);
+    jobGroups.push_back(group);
+    return true;
+}
+
+bool Manifest::setOption(const std::string &key,
+                         const Manifest::Value &value,
+                         Batch::Preset *preset,
+                         std::string *error)
+{
+    std::string option;
+    switch (value.type) {
+    case Manifest::Value::StringType:
+        option = value.string;
+        break;
+    case Manifest::Value::NumberType:
+    {
+        // keep fractions, "delta-e": 0.5 is not 0
+        std::ostringstream number;
+        number << std::setprecision(17) << value.number;
+        option = number.str();
+        break;
+    }
+    case Manifest::Value::BoolType:
+        option = value.boolean?"true":"false";
+        break;
+    default:
+        error->append("Invalid value for " + key);
+        return false;
+    }
+
+    // read each profile once, not once per job
+    return Batch::setPresetOption(key, option, preset, error, &profiles);
+}
+
+std::shared_ptr<const FXX::Image> Manifest::getSettings(const FXX::Image &image,
+                                                        size_t *group)
+{
+    // jobs sharing input override, output profile, intent and
+    // black point compensation share the same transform
+    std::ostringstream transformKey;
+    transformKey << std::hex << FXX::hash(image.iccInputBuffer) << ":"
+                 << FXX::hash(image.iccOutputBuffer) << ":"
+                 << image.intent << ":" << image.blackpoint;
+    std::map<std::string, size_t>::const_iterator id = groupIds.find(transformKey.str());
+    if (id == groupIds.end()) {
+        id = groupIds.insert(std::make_pair(transformKey.str(), groupIds.size())).first;
+    }
+    *group = id->second;
+
+    std::ostringstream settingsKey;
+    settingsKey << transformKey.str() << ":"
+                << FXX::hash(image.iccRGB) << ":"
+                << FXX::hash(image.iccCMYK) << ":"
+                << FXX::hash(image.iccGRAY) << ":"
+                << image.depth << ":"
+                << image.inkLimit << ":"
+                << image.deltaELimit;
+    std::shared_ptr<const FXX::Image> &result = settings[settingsKey.str()];
+    if (!result) { result = std::make_shared<const FXX::Image>(image); }
+    return result;
+}
+
+void Manifest::group()
+{
+    std::vector<size_t> order(manifestJobs.size());
+    for (size_t i = 0; i < order.size(); ++i) { order[i] = i; }
+    std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+        return jobGroups.at(a) < jobGroups.at(b);
+    });
+
+    std::vector<Batch::Job> jobs;
+    std::vector<size_t> groups;
+    for (size_t i = 0; i < order.size(); ++i) {
+        jobs.push_back(manifestJobs.at(order.at(i)));
+        groups.push_back(jobGroups.at(order.at(i)));
+    }
+    manifestJobs.swap(jobs);
+    jobGroups.swap(groups);
+}
@@ -0,0 +1,102 @@
+/*
+# Copyright Ole-André Rodlie, INRIA.
+#
+# ole.andre.rodlie@gmail.com
+#
+# This software is governed by the CeCILL license under French law and
+# abiding by the rules of distribution of free software. You can use,
+# modify and / or redistribute the software under the terms of the CeCILL
+# license as circulated by CEA, CNRS and INRIA at the following URL
+# "https://www.cecill.info".
+#
+# As a counterpart to the access to the source code and rights to
+# modify and redistribute granted by the license, users are provided only
+# with a limited warranty and the software's author, the holder of the
+# economic rights and the subsequent licensors have only limited
+# liability.
+#
+# In this respect, the user's attention is drawn to the associated risks
+# with loading, using, modifying and / or developing or reproducing the
+# software by the user in light of its specific status of free software,
+# that can mean that it is complicated to manipulate, and that also
+# so that it is for developers and experienced
+# professionals having in-depth computer knowledge. Users are therefore
+# encouraged to test and test the software's suitability
+# Requirements in the conditions of their systems
+# data to be ensured and, more generally, to use and operate
+# same conditions as regards security.
+#
+# The fact that you are presently reading this means that you have had
+# knowledge of the CeCILL license and that you accept its terms.
+*/
+
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <map>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "batch.h"
+#include "journal.h"
+
+class Manifest
+{
+public:
+    struct Value
+    {
+        enum Type {
+            NullType,
+            BoolType,
+            NumberType,
+            StringType,
+            ArrayType,
+            ObjectType
+        };
+        Manifest::Value::Type type = NullType;
+        bool boolean = false;
+        double number = 0;
+        std::string string;
+        std::vector<Manifest::Value> array;
+        std::vector<std::pair<std::string, Manifest::Value> > object;
+    };
+
+    Manifest(const Batch::Preset &defaults = Batch::Preset());
+
+    bool read(const std::string &file,
+              std::string *error);
+    int exec(unsigned int workers,
+             std::ostream &report,
+             Journal *journal = nullptr);
+
+    const std::vector<Batch::Job> &jobs() const;
+    size_t groups() const;
+
+    static bool parse(const std::string &text,
+                      Manifest::Value *value,
+                      std::string *error);
+    static std::string quote(const std::string &text);
+
+private:
+    Batch::Preset defaults;
+    std::vector<Batch::Job> manifestJobs;
+    std::vector<size_t> jobGroups;
+    Batch::ProfileMap profiles;
+    std::map<std::string, std::shared_ptr<const FXX::Image> > settings;
+    std::map<std::string, size_t> groupIds;
+
+    bool readJob(const Manifest::Value &jobDefaults,
+                 const Manifest::Value &job,
+                 std::string *error);
+    bool setOption(const std::string &key,
+                   const Manifest::Value &value,
+                   Batch::Preset *preset,
+                   std::string *error);
+    std::shared_ptr<const FXX::Image> getSettings(const FXX::Image &image,
+                                                  size_t *group);
+    void group();
+};
+
+#endif // MANIFEST_H
@@ -34,17 +34,46 @@
 #include <QHBoxLayout>
 #include <QMessageBox>
 #include <QDebug>
+#include <QThread>
+#include <QtConcurrent>
 
 #define tW 320
 #define tH 256
+#define iW 48
+
+// runs on the dialog pool, thumbnails are cached by the layer store
+static QImage layerThumb(std::shared_ptr<FXX::LayerStore> layers,
+                         int index,
+                         QSize size,
+                         FXX::Image profiles,
+                         FXX::TransformCache *cache)
+{
+    QThread::currentThread()->setPriority(QThread::LowestPriority);
+    std::vector<unsigned char> thumb = layers->getThumb(static_cast<size_t>(index),
+                                                        size.width(),
+                                                        size.height(),
+                                                        profiles.iccInputBuffer,
+                                                        profiles.iccMonitorBuffer,
+                                                        cache);
+    if (thumb.size()==0) { return QImage(); }
+    return QImage::fromData(thumb.data(), static_cast<int>(thumb.size()));
+}
 
-OpenLayerDialog::OpenLayerDialog(QWidget *parent, std::vector<Magick::Image> layers)
+OpenLayerDialog::OpenLayerDialog(QWidget *parent,
+                                 std::shared_ptr<FXX::LayerStore> layers,
+                                 const FXX::Image &profiles,
+                                 FXX::TransformCache *cache)
     : QDialog(parent)
     , loadButton(Q_NULLPTR)
     , closeButton(Q_NULLPTR)
-    ,_layers(layers)
+    , _layers(layers)
+    , _profiles(profiles)
+    , _cache(cache)
     , tree(Q_NULLPTR)
     , previewLabel(Q_NULLPTR)
+    , iconIndex(0)
+    , previewIndex(-1)
+    , pendingPreview(-1)
 {
     setWindowTitle(tr("Open Image Layer?"));
     setWindowIcon(QIcon(":/cyan.png"));
@@ -52,6 +81,9 @@ OpenLayerDialog::OpenLayerDialog(QWidget *parent, std::vector<Magick::Image> lay
     setMaximumWidth(tW*2);
     setMaximumHeight(tH+100);
 
+    // one low priority worker, so the dialog never competes with the UI
+    thumbPool.setMaxThreadCount(1);
+
     QFrame *containerFrame = new QFrame(this);
     QFrame *buttonFrame = new QFrame(this);
 
@@ -82,7 +114,10 @@ OpenLayerDialog::OpenLayerDialog(QWidget *parent, std::vector<Magick::Image> lay
     mainLayout->addWidget(buttonFrame);
 
     tree = new QTreeWidget(this);
-    tree->setHeaderLabels(QStringList() << "#");
+    tree->setHeaderLabels(QStringList() << "#" << tr("Name"));
+    tree->setIconSize(QSize(iW, iW));
+    tree->setUniformRowHeights(true);
+    tree->setRootIsDecorated(false);
     tree->setMaximumWidth(tW);
     tree->setMaximumHeight(tH);
     tree->setMinimumHeight(tH);
@@ -101,16 +136,30 @@ OpenLayerDialog::OpenLayerDialog(QWidget *parent, std::vector<Magick::Image> lay
 
     connect(tree, SIGNAL(itemClicked(QTreeWidgetItem*,int)),
             this, SLOT(viewLayer(QTreeWidgetItem*,int)));
+    connect(&iconWatcher, SIGNAL(finished()),
+            this, SLOT(handleIconWatcher()));
+    connect(&previewWatcher, SIGNAL(finished()),
+            this, SLOT(handlePreviewWatcher()));
 
     populateTree();
+    generateIcons();
+}
+
+OpenLayerDialog::~OpenLayerDialog()
+{
+    // let the running thumbnail finish, queued ones are dropped
+    thumbPool.clear();
+    thumbPool.waitForDone();
 }
 
 void OpenLayerDialog::populateTree()
 {
     tree->clear();
-    for (int i=0;i<static_cast<int>(_layers.size());++i) {
+    if (!_layers) { return; }
+    for (int i=0;i<static_cast<int>(_layers->count());++i) {
         QTreeWidgetItem *item = new QTreeWidgetItem(tree);
         item->setText(0,QString::number(i));
+        item->setText(1,QString::fromStdString(_layers->layers().at(static_cast<size_t>(i)).name));
         if (i==0) {
             tree->setCurrentItem(item);
             viewLayer(item, 0);
@@ -118,12 +167,47 @@ void OpenLayerDialog::populateTree()
     }
 }
 
-void OpenLayerDialog::generateThumb(Magick::Image image)
+void OpenLayerDialog::generateThumb(int index)
+{
+    if (previewWatcher.isRunning()) {
+        pendingPreview = index;
+        return;
+    }
+    previewIndex = index;
+    previewWatcher.setFuture(QtConcurrent::run(&thumbPool, layerThumb,
+                                               _layers, index, QSize(tW, tH),
+                                               _profiles, _cache));
+}
+
+// icons are made one at a time and fill in as they finish
+void OpenLayerDialog::generateIcons()
 {
-    std::vector<unsigned char> preview = FXX::generateThumb(image, tW, tH);
-    if (preview.size()>0) {
-        previewLabel->setPixmap(QPixmap::fromImage(QImage::fromData(preview.data(),
-                                                                    static_cast<int>(preview.size()))));
+    if (!_layers || iconWatcher.isRunning() ||
+        iconIndex >= static_cast<int>(_layers->count())) { return; }
+    iconWatcher.setFuture(QtConcurrent::run(&thumbPool, layerThumb,
+                                            _layers, iconIndex, QSize(iW, iW),
+                                            _profiles, _cache));
+}
+
+void OpenLayerDialog::handleIconWatcher()
+{
+    QImage icon = iconWatcher.result();
+    QTreeWidgetItem *item = tree->topLevelItem(iconIndex);
+    if (item && !icon.isNull()) { item->setIcon(0, QIcon(QPixmap::fromImage(icon))); }
+    iconIndex++;
+    generateIcons();
+}
+
+void OpenLayerDialog::handlePreviewWatcher()
+{
+    QImage preview = previewWatcher.result();
+    if (!preview.isNull()) {
+        previewLabel->setPixmap(QPixmap::fromImage(preview));
+    }
+    if (pendingPreview >= 0 && pendingPreview != previewIndex) {
+        int index = pendingPreview;
+        pendingPreview = -1;
+        generateThumb(index);
     }
 }
 
@@ -131,14 +215,13 @@ void OpenLayerDialog::viewLayer(QTreeWidgetItem *item, int col)
 {
     Q_UNUSED(col)
     if (!item) { return; }
-    generateThumb(_layers[static_cast<unsigned long>(item->text(0).toInt())]);
+    generateThumb(item->text(0).toInt());
 }
 
 void OpenLayerDialog::handleLoadLayer()
 {
     QTreeWidgetItem *item = tree->currentItem();
     if (!item) { return; }
-    emit loadLayer(_layers[static_cast<unsigned long>(item->text(0).toInt())]);
+    emit loadLayer(item->text(0).toInt());
     close();
 }
-
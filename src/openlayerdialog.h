@@ -39,6 +39,9 @@
 #include <QTreeWidget>
 #include <QLabel>
 #include <QTreeWidgetItem>
+#include <QThreadPool>
+#include <QFutureWatcher>
+#include <QImage>
 #include "FXX.h"
 
 class OpenLayerDialog : public QDialog
@@ -47,21 +50,35 @@ class OpenLayerDialog : public QDialog
 
 public:
     OpenLayerDialog(QWidget *parent = Q_NULLPTR,
-                  std::vector<Magick::Image> layers = std::vector<Magick::Image>());
+                    std::shared_ptr<FXX::LayerStore> layers = std::shared_ptr<FXX::LayerStore>(),
+                    const FXX::Image &profiles = FXX::Image(),
+                    FXX::TransformCache *cache = Q_NULLPTR);
+    ~OpenLayerDialog();
     QPushButton *loadButton;
     QPushButton *closeButton;
 
 signals:
-    void loadLayer(Magick::Image image);
+    void loadLayer(int index);
 
 private:
-    std::vector<Magick::Image> _layers;
+    std::shared_ptr<FXX::LayerStore> _layers;
+    FXX::Image _profiles;
+    FXX::TransformCache *_cache;
     QTreeWidget *tree;
     QLabel *previewLabel;
+    QThreadPool thumbPool;
+    QFutureWatcher<QImage> iconWatcher;
+    QFutureWatcher<QImage> previewWatcher;
+    int iconIndex;
+    int previewIndex;
+    int pendingPreview;
 
 private slots:
     void populateTree();
-    void generateThumb(Magick::Image image);
+    void generateThumb(int index);
+    void generateIcons();
+    void handleIconWatcher();
+    void handlePreviewWatcher();
     void viewLayer(QTreeWidgetItem* item, int col);
     void handleLoadLayer();
 };
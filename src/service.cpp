@@ -0,0 +1,394 @@
+/*
+# Copyright Ole-André Rodlie, INRIA.
+#
+# ole.andre.rodlie@gmail.com
+#
+# This software is governed by the CeCILL license under French law and
+# abiding by the rules of distribution of free software. You can use,
+# modify and / or redistribute the software under the terms of the CeCILL
+# license as circulated by CEA, CNRS and INRIA at the following URL
+# "https://www.cecill.info".
+#
+# As a counterpart to the access to the source code and rights to
+# modify and redistribute granted by the license, users are provided only
+# with a limited warranty and the software's author, the holder of the
+# economic rights and the subsequent licensors have only limited
+# liability.
+#
+# In this respect, the user's attention is drawn to the associated risks
+# with loading, using, modifying and / or developing or reproducing the
+# software by the user in light of its specific status of free software,
+# that can mean that it is complicated to manipulate, and that also
+# so that it is for developers and experienced
+# professionals having in-depth computer knowledge. Users are therefore
+# encouraged to test and test the software's suitability
+# Requirements in the conditions of their systems
+# data to be ensured and, more generally, to use and operate
+# same conditions as regards security.
+#
+# The fact that you are presently reading this means that you have had
+# knowledge of the CeCILL license and that you accept its terms.
+*/
+
+#include "service.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define SERVICE_BACKLOG 64
+#define SERVICE_POLL 500
+
+std::atomic<bool> Service::running(false);
+
+Service::Service(const std::string &socketPath,
+                 const Batch::Preset &defaults,
+                 unsigned int workers)
+    : socketPath(socketPath)
+    , defaults(defaults)
+    , workers(workers>0?workers:Batch::defaultWorkers())
+{
+    wakeup[0] = -1;
+    wakeup[1] = -1;
+}
+
+int Service::exec()
+{
+    // refuse to steal the socket from a running service
+    int existing = connectSocket(socketPath);
+    if (existing>=0) {
+        close(existing);
+        std::cerr << "Service already running on " << socketPath << std::endl;
+        return 1;
+    }
+    unlink(socketPath.c_str());
+
+    struct sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path too long: " << socketPath << std::endl;
+        return 1;
+    }
+    std::strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path)-1);
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server<0 ||
+        bind(server, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(server, SERVICE_BACKLOG) != 0) {
+        std::cerr << "Unable to listen on " << socketPath << ": " << std::strerror(errno) << std::endl;
+        if (server>=0) { close(server); }
+        return 1;
+    }
+    chmod(socketPath.c_str(), S_IRUSR | S_IWUSR);
+    std::signal(SIGPIPE, SIG_IGN);
+    if (pipe(wakeup) != 0) {
+        std::cerr << "Unable to create pipe: " << std::strerror(errno) << std::endl;
+        close(server);
+        return 1;
+    }
+
+    // connections are polled here and only their requests go to the
+    // workers, so idle persistent clients don't hold a worker. A client
+    // is not read while its request runs, responses stay in order
+    std::cout << "Listening on " << socketPath << " ..." << std::endl;
+    running = true;
+    std::vector<std::thread> threads;
+    for (unsigned int i = 0; i < workers; ++i) {
+        threads.push_back(std::thread(&Service::handleRequests, this));
+    }
+
+    while (running) {
+        std::vector<struct pollfd> fds;
+        struct pollfd entry;
+        entry.events = POLLIN;
+        entry.revents = 0;
+        entry.fd = server;
+        fds.push_back(entry);
+        entry.fd = wakeup[0];
+        fds.push_back(entry);
+        for (std::map<int, Service::Connection>::const_iterator it = clients.begin(); it != clients.end(); ++it) {
+            if (it->second.busy) { continue; }
+            entry.fd = it->first;
+            fds.push_back(entry);
+        }
+        if (poll(fds.data(), static_cast<nfds_t>(fds.size()), SERVICE_POLL) <= 0) { continue; }
+
+        // finished requests, the client can be read again
+        if (fds[1].revents & POLLIN) {
+            char data[64];
+            if (read(wakeup[0], data, sizeof(data)) < 0) { continue; }
+            std::vector<std::pair<int, bool> > done;
+            {
+                std::lock_guard<std::mutex> lock(requestsMutex);
+                done.swap(finished);
+            }
+            for (size_t i = 0; i < done.size(); ++i) {
+                if (!done[i].second) {
+                    closeClient(done[i].first);
+                    continue;
+                }
+                clients[done[i].first].busy = false;
+                readRequests(done[i].first);
+            }
+        }
+        for (size_t i = 2; i < fds.size(); ++i) {
+            if (fds[i].revents == 0) { continue; }
+            char data[4096];
+            ssize_t length = read(fds[i].fd, data, sizeof(data));
+            if (length <= 0) {
+                closeClient(fds[i].fd);
+                continue;
+            }
+            clients[fds[i].fd].buffer.append(data, static_cast<size_t>(length));
+            readRequests(fds[i].fd);
+        }
+        if (fds[0].revents & POLLIN) {
+            int client = accept(server, nullptr, nullptr);
+            if (client>=0) { clients[client] = Service::Connection(); }
+        }
+    }
+
+    requestsCondition.notify_all();
+    for (size_t i = 0; i < threads.size(); ++i) { threads[i].join(); }
+    while (!clients.empty()) { closeClient(clients.begin()->first); }
+    close(wakeup[0]);
+    close(wakeup[1]);
+    close(server);
+    unlink(socketPath.c_str());
+    std::cout << "Stopped listening on " << socketPath << std::endl;
+    return 0;
+}
+
+void Service::stop()
+{
+    running = false;
+}
+
+std::string Service::defaultSocket()
+{
+    const char *runtime = std::getenv("XDG_RUNTIME_DIR");
+    if (runtime) { return std::string(runtime) + "/cyan.sock"; }
+    return "/tmp/cyan-" + std::to_string(getuid()) + ".sock";
+}
+
+std::string Service::absolutePath(const std::string &path)
+{
+    if (path.empty() || path.at(0) == '/') { return path; }
+    char cwd[4096];
+    if (!getcwd(cwd, sizeof(cwd))) { return path; }
+    return std::string(cwd) + "/" + path;
+}
+
+int Service::request(const std::string &socketPath,
+                     const std::vector<Service::Request> &requests,
+                     unsigned int connections)
+{
+    std::atomic<size_t> next(0);
+    std::atomic<int> failed(0);
+    std::mutex outputMutex;
+
+    auto client = [&]() {
+        int fd = -1;
+        std::string buffer;
+        for (size_t i = next++; i < requests.size(); i = next++) {
+            std::string input;
+            std::vector<std::string> lines;
+            for (size_t o = 0; o < requests[i].size(); ++o) {
+                if (requests[i][o].first == "input") { input = requests[i][o].second; }
+                lines.push_back(requests[i][o].first + "=" + requests[i][o].second);
+            }
+            lines.push_back(std::string());
+
+            if (fd<0) { fd = connectSocket(socketPath); }
+            std::string line;
+            std::vector<std::string> response;
+            if (fd>=0 && writeLines(fd, lines)) {
+                while (readLine(fd, &buffer, &line)) {
+                    response.push_back(line);
+                    if (line.compare(0, 3, "ok ") == 0 || line.compare(0, 6, "error ") == 0) { break; }
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(outputMutex);
+            if (response.empty() ||
+                response.back().compare(0, 3, "ok ") != 0) {
+                failed++;
+                std::cerr << input << ": " << (response.empty()?"No response from " + socketPath:response.back().substr(6)) << std::endl;
+                if (response.empty() && fd>=0) {
+                    close(fd);
+                    fd = -1;
+                }
+                continue;
+            }
+            for (size_t r = 0; r+1 < response.size(); ++r) { std::cout << response[r] << std::endl; }
+            std::cout << input << " (" << response.back().substr(3) << "s)" << std::endl;
+        }
+        if (fd>=0) { close(fd); }
+    };
+
+    if (connections<1) { connections = 1; }
+    if (connections>requests.size()) { connections = static_cast<unsigned int>(requests.size()); }
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < connections; ++i) { threads.push_back(std::thread(client)); }
+    client();
+    for (size_t i = 0; i < threads.size(); ++i) { threads[i].join(); }
+
+    return failed>0?1:0;
+}
+
+void Service::handleRequests()
+{
+    for (;;) {
+        std::pair<int, Service::Request> next;
+        {
+            std::unique_lock<std::mutex> lock(requestsMutex);
+            requestsCondition.wait(lock, [this]() {
+                return !running || !requests.empty();
+            });
+            if (!running) { return; }
+            next = requests.front();
+            requests.pop();
+        }
+        std::vector<std::string> response;
+        handleRequest(next.second, &response);
+        bool written = writeLines(next.first, response);
+        {
+            std::lock_guard<std::mutex> lock(requestsMutex);
+            finished.push_back(std::make_pair(next.first, written));
+        }
+        char done = 0;
+        if (write(wakeup[1], &done, 1) != 1) { std::cerr << "Unable to wake service" << std::endl; }
+    }
+}
+
+// one request is key=value lines terminated by an empty line,
+// queue the next complete request of an idle client
+void Service::readRequests(int fd)
+{
+    std::map<int, Service::Connection>::iterator client = clients.find(fd);
+    if (client == clients.end()) { return; }
+    Service::Connection &connection = client->second;
+    std::string line;
+    while (!connection.busy && readLine(-1, &connection.buffer, &line)) {
+        if (!line.empty()) {
+            size_t equal = line.find('=');
+            if (equal == std::string::npos) { connection.request.push_back(std::make_pair(line, std::string())); }
+            else { connection.request.push_back(std::make_pair(line.substr(0, equal), line.substr(equal+1))); }
+            continue;
+        }
+        connection.busy = true;
+        std::lock_guard<std::mutex> lock(requestsMutex);
+        requests.push(std::make_pair(fd, connection.request));
+        requestsCondition.notify_one();
+        connection.request.clear();
+    }
+}
+
+void Service::closeClient(int fd)
+{
+    clients.erase(fd);
+    close(fd);
+}
+
+void Service::handleRequest(const Service::Request &request,
+                            std::vector<std::string> *response)
+{
+    Batch::Preset preset = defaults;
+    Batch::Job job;
+    std::string error;
+    for (size_t i = 0; i < request.size() && error.empty(); ++i) {
+        const std::string &key = request.at(i).first;
+        const std::string &value = request.at(i).second;
+        if (key == "input") { job.input = value; }
+        else if (key == "output") { job.output = value; }
+        else if (key == "preset") { Batch::readPreset(value, &preset, &error); }
+        else {
+            std::lock_guard<std::mutex> lock(profilesMutex);
+            Batch::setPresetOption(key, value, &preset, &error, &profiles);
+        }
+    }
+    if (error.empty() && (job.input.empty() || job.output.empty())) {
+        error = "Missing input or output.";
+    }
+    if (!error.empty()) {
+        response->push_back("error " + error);
+        return;
+    }
+
+    job.settings = std::make_shared<const FXX::Image>(preset.settings);
+    job.quality = preset.quality;
+    Batch::Result result = batch.convert(job);
+
+    std::string warning = result.image.warning;
+    std::replace(warning.begin(), warning.end(), '\n', ' ');
+    if (!warning.empty()) { response->push_back("warning " + warning); }
+    if (!result.success) {
+        std::string reason = result.image.error;
+        std::replace(reason.begin(), reason.end(), '\n', ' ');
+        response->push_back("error " + reason);
+        return;
+    }
+    response->push_back("ok " + std::to_string(result.seconds));
+}
+
+int Service::connectSocket(const std::string &socketPath)
+{
+    struct sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) { return -1; }
+    std::strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path)-1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd<0) { return -1; }
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// a negative fd only takes lines already in buffer
+bool Service::readLine(int fd,
+                       std::string *buffer,
+                       std::string *line)
+{
+    for (;;) {
+        size_t newline = buffer->find('\n');
+        if (newline != std::string::npos) {
+            *line = buffer->substr(0, newline);
+            buffer->erase(0, newline+1);
+            if (!line->empty() && line->at(line->size()-1) == '\r') { line->erase(line->size()-1); }
+            return true;
+        }
+        if (fd<0) { return false; }
+        char data[4096];
+        ssize_t length = read(fd, data, sizeof(data));
+        if (length <= 0) { return false; }
+        buffer->append(data, static_cast<size_t>(length));
+    }
+}
+
+bool Service::writeLines(int fd,
+                         const std::vector<std::string> &lines)
+{
+    std::string data;
+    for (size_t i = 0; i < lines.size(); ++i) { data.append(lines.at(i) + "\n"); }
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t length = write(fd, data.data() + written, data.size() - written);
+        if (length <= 0) { return false; }
+        written += static_cast<size_t>(length);
+    }
+    return true;
+}
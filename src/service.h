@@ -0,0 +1,100 @@
+/*
+# Copyright Ole-André Rodlie, INRIA.
+#
+# ole.andre.rodlie@gmail.com
+#
+# This software is governed by the CeCILL license under French law and
+# abiding by the rules of distribution of free software. You can use,
+# modify and / or redistribute the software under the terms of the CeCILL
+# license as circulated by CEA, CNRS and INRIA at the following URL
+# "https://www.cecill.info".
+#
+# As a counterpart to the access to the source code and rights to
+# modify and redistribute granted by the license, users are provided only
+# with a limited warranty and the software's author, the holder of the
+# economic rights and the subsequent licensors have only limited
+# liability.
+#
+# In this respect, the user's attention is drawn to the associated risks
+# with loading, using, modifying and / or developing or reproducing the
+# software by the user in light of its specific status of free software,
+# that can mean that it is complicated to manipulate, and that also
+# so that it is for developers and experienced
+# professionals having in-depth computer knowledge. Users are therefore
+# encouraged to test and test the software's suitability
+# Requirements in the conditions of their systems
+# data to be ensured and, more generally, to use and operate
+# same conditions as regards security.
+#
+# The fact that you are presently reading this means that you have had
+# knowledge of the CeCILL license and that you accept its terms.
+*/
+
+#ifndef SERVICE_H
+#define SERVICE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "batch.h"
+
+class Service
+{
+public:
+    typedef std::vector<std::pair<std::string, std::string> > Request;
+
+    Service(const std::string &socketPath,
+            const Batch::Preset &defaults,
+            unsigned int workers = 0);
+
+    int exec();
+    static void stop();
+
+    static std::string defaultSocket();
+    static std::string absolutePath(const std::string &path);
+    static int request(const std::string &socketPath,
+                       const std::vector<Service::Request> &requests,
+                       unsigned int connections = 1);
+
+private:
+    std::string socketPath;
+    Batch::Preset defaults;
+    unsigned int workers;
+    Batch batch;
+    Batch::ProfileMap profiles;
+    std::mutex profilesMutex;
+    struct Connection
+    {
+        std::string buffer;
+        Service::Request request;
+        bool busy = false;
+    };
+    std::map<int, Service::Connection> clients;
+    std::queue<std::pair<int, Service::Request> > requests;
+    std::vector<std::pair<int, bool> > finished;
+    std::mutex requestsMutex;
+    std::condition_variable requestsCondition;
+    int wakeup[2];
+    static std::atomic<bool> running;
+
+    void handleRequests();
+    void readRequests(int fd);
+    void closeClient(int fd);
+    void handleRequest(const Service::Request &request,
+                       std::vector<std::string> *response);
+
+    static int connectSocket(const std::string &socketPath);
+    static bool readLine(int fd,
+                         std::string *buffer,
+                         std::string *line);
+    static bool writeLines(int fd,
+                           const std::vector<std::string> &lines);
+};
+
+#endif // SERVICE_H
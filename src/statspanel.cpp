@@ -0,0 +1,219 @@
+/*
+# Copyright Ole-André Rodlie, INRIA.
+#
+# ole.andre.rodlie@gmail.com
+#
+# This software is governed by the CeCILL license under French law and
+# abiding by the rules of distribution of free software. You can use,
+# modify and / or redistribute the software under the terms of the CeCILL
+# license as circulated by CEA, CNRS and INRIA at the following URL
+# "https://www.cecill.info".
+#
+# As a counterpart to the access to the source code and rights to
+# modify and redistribute granted by the license, users are provided only
+# with a limited warranty and the software's author, the holder of the
+# economic rights and the subsequent licensors have only limited
+# liability.
+#
+# In this respect, the user's attention is drawn to the associated risks
+# with loading, using, modifying and / or developing or reproducing the
+# software by the user in light of its specific status of free software,
+# that can mean that it is complicated to manipulate, and that also
+# so that it is for developers and experienced
+# professionals having in-depth computer knowledge. Users are therefore
+# encouraged to test and test the software's suitability
+# Requirements in the conditions of their systems
+# data to be ensured and, more generally, to use and operate
+# same conditions as regards security.
+#
+# The fact that you are presently reading this means that you have had
+# knowledge of the CeCILL license and that you accept its terms.
+*/
+
+#include "statspanel.h"
+#include <QVBoxLayout>
+#include <QPainter>
+#include <QPainterPath>
+#include <QFontDatabase>
+#include <QStringList>
+#include <QColor>
+#include <algorithm>
+
+StatsPanel::StatsPanel(QWidget *parent) :
+    QWidget(parent)
+  , sourceHistogram(Q_NULLPTR)
+  , sourceInfo(Q_NULLPTR)
+  , outputHistogram(Q_NULLPTR)
+  , outputInfo(Q_NULLPTR)
+  , tacInfo(Q_NULLPTR)
+  , deltaEInfo(Q_NULLPTR)
+{
+    QVBoxLayout *mainLayout = new QVBoxLayout(this);
+
+    QLabel *sourceLabel = new QLabel(tr("<b>Source</b>"), this);
+    QLabel *outputLabel = new QLabel(tr("<b>Output</b>"), this);
+    sourceHistogram = new QLabel(this);
+    outputHistogram = new QLabel(this);
+    sourceInfo = new QLabel(this);
+    outputInfo = new QLabel(this);
+    tacInfo = new QLabel(this);
+    deltaEInfo = new QLabel(this);
+
+    sourceHistogram->setMinimumSize(256, HISTOGRAM_HEIGHT);
+    outputHistogram->setMinimumSize(256, HISTOGRAM_HEIGHT);
+    sourceInfo->setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+    outputInfo->setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+    tacInfo->setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+    deltaEInfo->setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+    sourceInfo->setTextInteractionFlags(Qt::TextSelectableByMouse);
+    outputInfo->setTextInteractionFlags(Qt::TextSelectableByMouse);
+    tacInfo->setTextInteractionFlags(Qt::TextSelectableByMouse);
+    deltaEInfo->setTextInteractionFlags(Qt::TextSelectableByMouse);
+
+    mainLayout->addWidget(sourceLabel);
+    mainLayout->addWidget(sourceHistogram);
+    mainLayout->addWidget(sourceInfo);
+    mainLayout->addWidget(outputLabel);
+    mainLayout->addWidget(outputHistogram);
+    mainLayout->addWidget(outputInfo);
+    mainLayout->addWidget(tacInfo);
+    mainLayout->addWidget(deltaEInfo);
+    mainLayout->addStretch();
+
+    clear();
+}
+
+void StatsPanel::setStats(const FXX::ImageStats &source,
+                          const FXX::ImageStats &output)
+{
+    sourceHistogram->setPixmap(drawHistogram(source));
+    sourceInfo->setText(formatStats(source));
+    outputHistogram->setPixmap(drawHistogram(output));
+    outputInfo->setText(formatStats(output));
+}
+
+void StatsPanel::setTAC(const FXX::TACReport &report)
+{
+    tacInfo->setText(formatTAC(report));
+    tacInfo->setVisible(report.pixels>0);
+}
+
+void StatsPanel::setDeltaE(const FXX::DeltaEReport &report)
+{
+    deltaEInfo->setText(formatDeltaE(report));
+    deltaEInfo->setVisible(report.pixels>0);
+}
+
+void StatsPanel::clear()
+{
+    setStats(FXX::ImageStats(), FXX::ImageStats());
+    setTAC(FXX::TACReport());
+    setDeltaE(FXX::DeltaEReport());
+}
+
+// channels are drawn on top of each other, scaled to the highest bin
+// that is not clipped so clipping spikes don't flatten the rest
+QPixmap StatsPanel::drawHistogram(const FXX::ImageStats &stats)
+{
+    QImage image(256, HISTOGRAM_HEIGHT, QImage::Format_ARGB32_Premultiplied);
+    image.fill(QColor(30, 30, 30));
+
+    QList<QColor> colors;
+    switch (stats.colorspace) {
+    case FXX::RGBColorSpace:
+        colors << Qt::red << Qt::green << Qt::blue;
+        break;
+    case FXX::CMYKColorSpace:
+        colors << Qt::cyan << Qt::magenta << Qt::yellow << Qt::lightGray;
+        break;
+    default:
+        colors << Qt::lightGray;
+    }
+
+    QPainter painter(&image);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.setCompositionMode(QPainter::CompositionMode_Plus);
+    painter.setPen(Qt::NoPen);
+    for (int c = 0; c < static_cast<int>(stats.channels.size()) && c < colors.size(); ++c) {
+        const std::vector<unsigned long long> &histogram = stats.channels.at(static_cast<size_t>(c)).histogram;
+        if (histogram.size() != 256) { continue; }
+        unsigned long long peak = *std::max_element(histogram.begin() + 1, histogram.end() - 1);
+        if (peak == 0) { peak = *std::max_element(histogram.begin(), histogram.end()); }
+        if (peak == 0) { continue; }
+        QPainterPath path;
+        path.moveTo(0, HISTOGRAM_HEIGHT);
+        for (int bin = 0; bin < 256; ++bin) {
+            double value = std::min(1.0, static_cast<double>(histogram.at(static_cast<size_t>(bin))) / peak);
+            path.lineTo(bin, HISTOGRAM_HEIGHT - value * HISTOGRAM_HEIGHT);
+            path.lineTo(bin + 1, HISTOGRAM_HEIGHT - value * HISTOGRAM_HEIGHT);
+        }
+        path.lineTo(256, HISTOGRAM_HEIGHT);
+        path.closeSubpath();
+        QColor color = colors.at(c);
+        color.setAlpha(160);
+        painter.fillPath(path, color);
+    }
+    painter.end();
+    return QPixmap::fromImage(image);
+}
+
+// 0-255 for RGB and GRAY, percent for CMYK, clipping is the share of
+// pixels at the bottom / top of the range
+QString StatsPanel::formatStats(const FXX::ImageStats &stats)
+{
+    if (stats.pixels == 0) { return tr("No image"); }
+    QStringList names;
+    double scale = 255.0;
+    switch (stats.colorspace) {
+    case FXX::RGBColorSpace:
+        names << "R" << "G" << "B";
+        break;
+    case FXX::CMYKColorSpace:
+        names << "C" << "M" << "Y" << "K";
+        scale = 100.0;
+        break;
+    default:
+        names << "I";
+    }
+
+    QStringList lines;
+    for (int c = 0; c < static_cast<int>(stats.channels.size()) && c < names.size(); ++c) {
+        const FXX::ChannelStats &channel = stats.channels.at(static_cast<size_t>(c));
+        lines << tr("%1 min %2 max %3 mean %4 clip %5% / %6%")
+                 .arg(names.at(c))
+                 .arg(channel.min * scale, 5, 'f', 1)
+                 .arg(channel.max * scale, 5, 'f', 1)
+                 .arg(channel.mean * scale, 5, 'f', 1)
+                 .arg(100.0 * channel.clippedLow / stats.pixels, 0, 'f', 2)
+                 .arg(100.0 * channel.clippedHigh / stats.pixels, 0, 'f', 2);
+    }
+    return lines.join("\n");
+}
+
+// total ink in percent of the CMYK output
+QString StatsPanel::formatTAC(const FXX::TACReport &report)
+{
+    if (report.pixels == 0) { return QString(); }
+    QStringList lines;
+    lines << tr("TAC max %1% mean %2%")
+             .arg(report.max, 0, 'f', 1)
+             .arg(report.mean, 0, 'f', 1);
+    lines << tr("TAC p95 %1% p99 %2%")
+             .arg(report.p95, 0, 'f', 1)
+             .arg(report.p99, 0, 'f', 1);
+    lines << tr("Over %1%: %2 pixels (%3%)")
+             .arg(report.limit, 0, 'f', 0)
+             .arg(report.over)
+             .arg(100.0 * report.over / report.pixels, 0, 'f', 2);
+    return lines.join("\n");
+}
+
+// round trip difference between source and output (CIEDE2000)
+QString StatsPanel::formatDeltaE(const FXX::DeltaEReport &report)
+{
+    if (report.pixels == 0) { return QString(); }
+    return tr("\u0394E00 mean %1 p95 %2 max %3")
+           .arg(report.mean, 0, 'f', 2)
+           .arg(report.p95, 0, 'f', 2)
+           .arg(report.max, 0, 'f', 2);
+}
@@ -0,0 +1,212 @@
+/*
+# Copyright Ole-André Rodlie, INRIA.
+#
+# ole.andre.rodlie@gmail.com
+#
+# This software is governed by the CeCILL license under French law and
+# abiding by the rules of distribution of free software. You can use,
+# modify and / or redistribute the software under the terms of the CeCILL
+# license as circulated by CEA, CNRS and INRIA at the following URL
+# "https://www.cecill.info".
+#
+# As a counterpart to the access to the source code and rights to
+# modify and redistribute granted by the license, users are provided only
+# with a limited warranty and the software's author, the holder of the
+# economic rights and the subsequent licensors have only limited
+# liability.
+#
+# In this respect, the user's attention is drawn to the associated risks
+# with loading, using, modifying and / or developing or reproducing the
+# software by the user in light of its specific status of free software,
+# that can mean that it is complicated to manipulate, and that also
+# so that it is for developers and experienced
+# professionals having in-depth computer knowledge. Users are therefore
+# encouraged to test and test the software's suitability
+# Requirements in the conditions of their systems
+# data to be ensured and, more generally, to use and operate
+# same conditions as regards security.
+#
+# The fact that you are presently reading this means that you have had
+# knowledge of the CeCILL license and that you accept its terms.
+*/
+
+#include "tileditem.h"
+#include <QPainter>
+#include <QStyleOptionGraphicsItem>
+#include <QtConcurrent/QtConcurrent>
+#include <cmath>
+
+TiledImageItem::TiledImageItem(QGraphicsItem *parent) :
+    QGraphicsObject(parent)
+  , tiles(TILE_CACHE_SIZE)
+{
+    setFlag(QGraphicsItem::ItemUsesExtendedStyleOption);
+    connect(&pyramidWatcher, SIGNAL(finished()),
+            this, SLOT(handlePyramidWatcher()));
+}
+
+void TiledImageItem::setImage(const QImage &image)
+{
+    prepareGeometryChange();
+    tiles.clear();
+    levels.clear();
+    regionImage = QImage();
+    regionRect = QRectF();
+    regionSource = QRectF();
+    imageSize = image.size();
+    if (image.isNull()) { return; }
+    levels.append(image);
+    pyramidWatcher.setFuture(QtConcurrent::run(TiledImageItem::buildPyramid, image));
+    update();
+}
+
+// draw a partial update on top of the image until the next setImage,
+// image is scaled to fit rect
+void TiledImageItem::setRegion(const QImage &image,
+                               const QRectF &rect)
+{
+    regionImage = image;
+    regionRect = rect.intersected(boundingRect());
+    if (image.isNull() || rect.isEmpty()) { return; }
+    regionSource = QRectF((regionRect.x() - rect.x()) * image.width() / rect.width(),
+                          (regionRect.y() - rect.y()) * image.height() / rect.height(),
+                          regionRect.width() * image.width() / rect.width(),
+                          regionRect.height() * image.height() / rect.height());
+    update(regionRect);
+}
+
+// draw a map on top of everything, each overlay pixel covers
+// an equal part of rect, kept until replaced or cleared
+void TiledImageItem::setOverlay(const QImage &image,
+                                const QRectF &rect)
+{
+    overlayImage = image;
+    overlayRect = rect;
+    update();
+}
+
+QRectF TiledImageItem::boundingRect() const
+{
+    return QRectF(0, 0, imageSize.width(), imageSize.height());
+}
+
+void TiledImageItem::paint(QPainter *painter,
+                           const QStyleOptionGraphicsItem *option,
+                           QWidget */*widget*/)
+{
+    if (levels.isEmpty()) { return; }
+    QRectF exposed = option->exposedRect.intersected(boundingRect());
+    if (exposed.isEmpty()) { return; }
+    qreal scale = option->levelOfDetailFromTransform(painter->worldTransform());
+    int level = getLevel(scale);
+
+    // pyramid is still building, draw what we have without smoothing
+    if (level == 0 && scale < 0.5 && pyramidWatcher.isRunning()) {
+        painter->drawImage(exposed, levels.at(0), exposed);
+        paintRegion(painter, exposed);
+        paintOverlay(painter, exposed);
+        return;
+    }
+
+    painter->setRenderHint(QPainter::SmoothPixmapTransform, scale < 1.0);
+    const QImage &source = levels.at(level);
+    qreal sx = static_cast<qreal>(imageSize.width())/source.width();
+    qreal sy = static_cast<qreal>(imageSize.height())/source.height();
+    int firstColumn = qMax(0, static_cast<int>(exposed.left()/sx)/TILE_SIZE);
+    int firstRow = qMax(0, static_cast<int>(exposed.top()/sy)/TILE_SIZE);
+    int lastColumn = qMin((source.width()-1)/TILE_SIZE,
+                          static_cast<int>(std::ceil(exposed.right()/sx))/TILE_SIZE);
+    int lastRow = qMin((source.height()-1)/TILE_SIZE,
+                       static_cast<int>(std::ceil(exposed.bottom()/sy))/TILE_SIZE);
+    for (int row = firstRow; row <= lastRow; ++row) {
+        for (int column = firstColumn; column <= lastColumn; ++column) {
+            QPixmap *tile = getTile(level, column, row);
+            if (!tile) { continue; }
+            QRectF target(column*TILE_SIZE*sx,
+                          row*TILE_SIZE*sy,
+                          tile->width()*sx,
+                          tile->height()*sy);
+            painter->drawPixmap(target, *tile, QRectF(tile->rect()));
+        }
+    }
+    paintRegion(painter, exposed);
+    paintOverlay(painter, exposed);
+}
+
+void TiledImageItem::paintRegion(QPainter *painter,
+                                 const QRectF &exposed)
+{
+    if (regionImage.isNull() || !regionRect.intersects(exposed)) { return; }
+    painter->drawImage(regionRect, regionImage, regionSource);
+}
+
+// cells stay sharp at every zoom level
+void TiledImageItem::paintOverlay(QPainter *painter,
+                                  const QRectF &exposed)
+{
+    if (overlayImage.isNull() || overlayRect.isEmpty()) { return; }
+    QRectF target = overlayRect.intersected(exposed);
+    if (target.isEmpty()) { return; }
+    qreal sx = overlayImage.width() / overlayRect.width();
+    qreal sy = overlayImage.height() / overlayRect.height();
+    QRectF source((target.x() - overlayRect.x()) * sx,
+                  (target.y() - overlayRect.y()) * sy,
+                  target.width() * sx,
+                  target.height() * sy);
+    painter->save();
+    painter->setRenderHint(QPainter::SmoothPixmapTransform, false);
+    painter->drawImage(target, overlayImage, source);
+    painter->restore();
+}
+
+// level 0 is the image, each level after is half the size of the previous
+QVector<QImage> TiledImageItem::buildPyramid(QImage image)
+{
+    QVector<QImage> result;
+    image = image.convertToFormat(image.hasAlphaChannel()?
+                                  QImage::Format_ARGB32_Premultiplied :
+                                  QImage::Format_RGB32);
+    result.append(image);
+    while (image.width()>TILE_SIZE || image.height()>TILE_SIZE) {
+        image = image.scaled(qMax(1, image.width()/2),
+                             qMax(1, image.height()/2),
+                             Qt::IgnoreAspectRatio,
+                             Qt::SmoothTransformation);
+        result.append(image);
+    }
+    return result;
+}
+
+// smallest level that still has enough pixels for the current zoom
+int TiledImageItem::getLevel(qreal scale) const
+{
+    if (scale >= 1.0 || scale <= 0.0) { return 0; }
+    int level = static_cast<int>(std::floor(std::log2(1.0/scale)));
+    return qBound(0, level, levels.size()-1);
+}
+
+QPixmap *TiledImageItem::getTile(int level, int column, int row)
+{
+    quint64 key = (static_cast<quint64>(level) << 48) |
+                  (static_cast<quint64>(row) << 24) |
+                  static_cast<quint64>(column);
+    QPixmap *tile = tiles.object(key);
+    if (tile) { return tile; }
+    QRect rect = QRect(column*TILE_SIZE,
+                       row*TILE_SIZE,
+                       TILE_SIZE,
+                       TILE_SIZE).intersected(levels.at(level).rect());
+    if (rect.isEmpty()) { return Q_NULLPTR; }
+    tile = new QPixmap(QPixmap::fromImage(levels.at(level).copy(rect)));
+    tiles.insert(key, tile);
+    return tile;
+}
+
+void TiledImageItem::handlePyramidWatcher()
+{
+    QVector<QImage> pyramid = pyramidWatcher.result();
+    if (pyramid.isEmpty() || pyramid.at(0).size() != imageSize) { return; }
+    levels = pyramid;
+    tiles.clear();
+    update();
+}
@@ -0,0 +1,85 @@
+/*
+# Copyright Ole-André Rodlie, INRIA.
+#
+# ole.andre.rodlie@gmail.com
+#
+# This software is governed by the CeCILL license under French law and
+# abiding by the rules of distribution of free software. You can use,
+# modify and / or redistribute the software under the terms of the CeCILL
+# license as circulated by CEA, CNRS and INRIA at the following URL
+# "https://www.cecill.info".
+#
+# As a counterpart to the access to the source code and rights to
+# modify and redistribute granted by the license, users are provided only
+# with a limited warranty and the software's author, the holder of the
+# economic rights and the subsequent licensors have only limited
+# liability.
+#
+# In this respect, the user's attention is drawn to the associated risks
+# with loading, using, modifying and / or developing or reproducing the
+# software by the user in light of its specific status of free software,
+# that can mean that it is complicated to manipulate, and that also
+# so that it is for developers and experienced
+# professionals having in-depth computer knowledge. Users are therefore
+# encouraged to test and test the software's suitability
+# Requirements in the conditions of their systems
+# data to be ensured and, more generally, to use and operate
+# same conditions as regards security.
+#
+# The fact that you are presently reading this means that you have had
+# knowledge of the CeCILL license and that you accept its terms.
+*/
+
+#ifndef TILEDITEM_H
+#define TILEDITEM_H
+
+#include <QGraphicsObject>
+#include <QImage>
+#include <QPixmap>
+#include <QVector>
+#include <QCache>
+#include <QFutureWatcher>
+
+#define TILE_SIZE 256
+#define TILE_CACHE_SIZE 512
+
+// draws an image from a mipmap pyramid, split in tiles,
+// only the tiles visible at the current zoom level are made
+class TiledImageItem : public QGraphicsObject
+{
+    Q_OBJECT
+
+public:
+    explicit TiledImageItem(QGraphicsItem *parent = Q_NULLPTR);
+    void setImage(const QImage &image);
+    void setRegion(const QImage &image,
+                   const QRectF &rect);
+    void setOverlay(const QImage &image,
+                    const QRectF &rect);
+    QRectF boundingRect() const;
+    void paint(QPainter *painter,
+               const QStyleOptionGraphicsItem *option,
+               QWidget *widget = Q_NULLPTR);
+    static QVector<QImage> buildPyramid(QImage image);
+
+private:
+    QVector<QImage> levels;
+    QCache<quint64, QPixmap> tiles;
+    QFutureWatcher<QVector<QImage> > pyramidWatcher;
+    QSize imageSize;
+    QImage regionImage;
+    QRectF regionRect;
+    QRectF regionSource;
+    QImage overlayImage;
+    QRectF overlayRect;
+    int getLevel(qreal scale) const;
+    QPixmap *getTile(int level, int column, int row);
+    void paintRegion(QPainter *painter,
+                     const QRectF &exposed);
+    void paintOverlay(QPainter *painter,
+                      const QRectF &exposed);
+
+private slots:
+    void handlePyramidWatcher();
+};
+#endif // TILEDITEM_H
@@ -32,6 +32,7 @@
 
 #include <QtTest>
 #include <QFile>
+#include <QTemporaryDir>
 #include <QDebug>
 #include <string>
 
@@ -59,6 +60,11 @@ private slots:
     void test_case2();
     void test_case3();
     void test_case4();
+    void test_case5();
+    void test_case6();
+    void test_case7();
+    void test_case8();
+    void test_case9();
 };
 
 Cyan::Cyan()
@@ -286,6 +292,249 @@ void Cyan::test_case4()
     QVERIFY(compareImages(sampleGRAY, resultGRAY.imageBuffer));
 }
 
+void Cyan::test_case5()
+{
+    std::cout << "Checking profiles header ..." << std::endl;
+    FXX::ProfileInfo rgbInfo = FXX::getProfileInfo(image.iccRGB);
+    QVERIFY(rgbInfo.colorspace == FXX::RGBColorSpace);
+    QVERIFY(rgbInfo.pcs == FXX::XYZColorSpace);
+    QVERIFY(rgbInfo.profileClass == FXX::DisplayProfileClass);
+    QVERIFY(rgbInfo.version == 0x04300000);
+
+    FXX::ProfileInfo cmykInfo = FXX::getProfileInfo(image.iccCMYK);
+    QVERIFY(cmykInfo.colorspace == FXX::CMYKColorSpace);
+    QVERIFY(cmykInfo.pcs == FXX::LABColorSpace);
+    QVERIFY(cmykInfo.profileClass == FXX::OutputProfileClass);
+
+    FXX::ProfileInfo grayInfo = FXX::getProfileInfo(image.iccGRAY);
+    QVERIFY(grayInfo.colorspace == FXX::GRAYColorSpace);
+    QVERIFY(grayInfo.pcs == FXX::XYZColorSpace);
+    QVERIFY(grayInfo.profileClass == FXX::OutputProfileClass);
+
+    std::cout << "Checking profiles tags against LCMS ..." << std::endl;
+    std::vector<std::vector<unsigned char> > profiles;
+    profiles.push_back(image.iccRGB);
+    profiles.push_back(image.iccCMYK);
+    profiles.push_back(image.iccGRAY);
+    profiles.push_back(image.iccInputBuffer);
+    for (size_t i = 0; i < profiles.size(); ++i) {
+        FXX::ProfileInfo info = FXX::getProfileInfo(profiles.at(i));
+        cmsHPROFILE profile = cmsOpenProfileFromMem(profiles.at(i).data(),
+                                                    static_cast<cmsUInt32Number>(profiles.at(i).size()));
+        QVERIFY(profile);
+        QVERIFY(fx.getProfileTag(profile, FXX::ICCDescription) == info.description);
+        profile = cmsOpenProfileFromMem(profiles.at(i).data(),
+                                        static_cast<cmsUInt32Number>(profiles.at(i).size()));
+        QVERIFY(fx.getProfileTag(profile, FXX::ICCCopyright) == info.copyright);
+    }
+
+    std::cout << "Checking invalid profile ..." << std::endl;
+    std::vector<unsigned char> invalid(sampleGRAY.begin(), sampleGRAY.begin() + 256);
+    QVERIFY(FXX::getProfileInfo(invalid).colorspace == FXX::UnknownColorSpace);
+    QVERIFY(fx.getProfileTag(invalid).empty());
+}
+
+void Cyan::test_case6()
+{
+    std::cout << "Transforming RGB sample to CMYK using transform cache ..." << std::endl;
+    Magick::Blob blob(image.imageBuffer.data(), image.imageBuffer.size());
+    Magick::Image magickImage(blob);
+    FXX::TransformCache cache;
+    std::string error;
+    QVERIFY(FXX::transformImage(magickImage,
+                                image.iccInputBuffer,
+                                image.iccCMYK,
+                                FXX::PerceptualRenderingIntent,
+                                true,
+                                &cache,
+                                &error));
+    QVERIFY(error.empty());
+    QVERIFY(FXX::readImageColorspaceType(magickImage) == FXX::CMYKColorSpace);
+    QVERIFY(magickImage.iccColorProfile().length() == image.iccCMYK.size());
+
+    std::cout << "Checking transform cache reuse ..." << std::endl;
+    std::shared_ptr<void> transform1 = cache.getTransform(image.iccInputBuffer,
+                                                          FXX::getPixelFormat(FXX::RGBColorSpace),
+                                                          image.iccCMYK,
+                                                          FXX::getPixelFormat(FXX::CMYKColorSpace),
+                                                          FXX::PerceptualRenderingIntent,
+                                                          true);
+    std::shared_ptr<void> transform2 = cache.getTransform(image.iccInputBuffer,
+                                                          FXX::getPixelFormat(FXX::RGBColorSpace),
+                                                          image.iccCMYK,
+                                                          FXX::getPixelFormat(FXX::CMYKColorSpace),
+                                                          FXX::PerceptualRenderingIntent,
+                                                          true);
+    QVERIFY(transform1 && transform1 == transform2);
+
+    std::cout << "Checking mismatching input profile ..." << std::endl;
+    error.clear();
+    QVERIFY(!FXX::transformImage(magickImage,
+                                 image.iccRGB,
+                                 image.iccGRAY,
+                                 FXX::PerceptualRenderingIntent,
+                                 false,
+                                 &cache,
+                                 &error));
+    QVERIFY(!error.empty());
+}
+
+void Cyan::test_case7()
+{
+    std::cout << "Converting RGB sample to CMYK and GRAY in one pass ..." << std::endl;
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QString input = dir.path() + "/input.tif";
+    QFile inputFile(input);
+    QVERIFY(inputFile.open(QIODevice::WriteOnly));
+    inputFile.write(reinterpret_cast<const char*>(image.imageBuffer.data()),
+                    static_cast<qint64>(image.imageBuffer.size()));
+    inputFile.close();
+
+    std::vector<FXX::Target> targets(2);
+    targets[0].filename = QString(dir.path() + "/output-cmyk.tif").toStdString();
+    targets[0].profile = image.iccCMYK;
+    targets[1].filename = QString(dir.path() + "/output-gray.tif").toStdString();
+    targets[1].profile = image.iccGRAY;
+    targets[1].depth = 8;
+
+    FXX::TransformCache cache;
+    std::vector<FXX::Image> results = FXX::convertFile(input.toStdString(),
+                                                       targets,
+                                                       image,
+                                                       &cache);
+    QVERIFY(results.size() == 2);
+    QVERIFY(results.at(0).error.empty());
+    QVERIFY(results.at(1).error.empty());
+    QVERIFY(results.at(0).colorspace == FXX::CMYKColorSpace);
+    QVERIFY(results.at(1).colorspace == FXX::GRAYColorSpace);
+    QVERIFY(results.at(1).depth == 8);
+    QVERIFY(QFile::exists(QString::fromStdString(targets[0].filename)));
+    QVERIFY(QFile::exists(QString::fromStdString(targets[1].filename)));
+
+    std::cout << "Checking that an output failing the Delta E limit is not written ..." << std::endl;
+    std::vector<FXX::Target> gated(1, targets[1]);
+    gated[0].filename = QString(dir.path() + "/output-gated.tif").toStdString();
+    gated[0].deltaELimit = 0.01;
+    results = FXX::convertFile(input.toStdString(), gated, image, &cache);
+    QVERIFY(results.size() == 1);
+    QVERIFY(!results.at(0).error.empty());
+    QVERIFY(!QFile::exists(QString::fromStdString(gated[0].filename)));
+    QVERIFY(QDir(dir.path()).entryList(QDir::Files | QDir::Hidden).size() == 3);
+}
+
+void Cyan::test_case8()
+{
+    std::cout << "Writing layered PSD and PSB ..." << std::endl;
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    Magick::Image composite(Magick::Blob(image.imageBuffer.data(), image.imageBuffer.size()));
+    Magick::Image layer = composite;
+    layer.label("Layer 1");
+    Magick::Image faded = composite;
+    faded.label("Layer 2");
+    faded.artifact("psd:layer.opacity", QString::number(QuantumRange/2.0).toStdString());
+
+    QStringList files;
+    files << dir.path() + "/layers.psd" << dir.path() + "/layers.psb";
+    for (int i = 0; i < files.size(); ++i) {
+        std::vector<Magick::Image> layers;
+        layers.push_back(composite);
+        layers.push_back(layer);
+        layers.push_back(faded);
+        std::string error;
+        QVERIFY(FXX::writeNativePSD(layers, files.at(i).toStdString(), image.iccRGB, 8, &error));
+        QVERIFY(error.empty());
+
+        QFile file(files.at(i));
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        QByteArray header = file.read(6);
+        QVERIFY(header.startsWith("8BPS"));
+        QVERIFY(header.at(5) == (i==0?1:2));
+        file.close();
+
+        std::vector<Magick::Image> result;
+        Magick::readImages(&result, files.at(i).toStdString());
+        QVERIFY(result.size() == 3);
+        QVERIFY(result.at(0).columns() == composite.columns());
+        QVERIFY(result.at(0).rows() == composite.rows());
+        QVERIFY(result.at(1).label() == "Layer 1");
+        QVERIFY(result.at(2).label() == "Layer 2");
+
+        std::cout << "Checking layer opacity ..." << std::endl;
+        double opacity = QString::fromStdString(result.at(2).artifact("psd:layer.opacity")).toDouble();
+        QVERIFY(qAbs(opacity/QuantumRange - 128.0/255.0) < 0.01);
+    }
+
+    std::cout << "Checking for leftover temp files ..." << std::endl;
+    QVERIFY(QDir(dir.path()).entryList(QDir::Files | QDir::Hidden).size() == files.size());
+}
+
+void Cyan::test_case9()
+{
+    std::cout << "Reading pixel values ..." << std::endl;
+    Magick::Image source;
+    source.ping(Magick::Blob(image.imageBuffer.data(), image.imageBuffer.size()));
+    FXX::PixelProbe probe;
+    std::string error;
+    QVERIFY(probe.setSource(image.imageBuffer, image.iccInputBuffer, &error));
+    QVERIFY(error.empty());
+    QVERIFY(probe.width() == source.columns());
+    QVERIFY(probe.height() == source.rows());
+    QVERIFY(!probe.hasOutput());
+    QVERIFY(!probe.output(0, 0).valid);
+    QVERIFY(!probe.source(source.columns(), 0).valid);
+
+    FXX::PixelValue value = probe.source(0, 0);
+    QVERIFY(value.valid);
+    QVERIFY(value.colorspace == FXX::RGBColorSpace);
+    QVERIFY(value.channels.size() == 3);
+    QVERIFY(value.L >= 0.0 && value.L <= 100.0);
+
+    std::cout << "Checking channel statistics ..." << std::endl;
+    FXX::ImageStats stats = probe.sourceStats();
+    QVERIFY(stats.pixels == source.columns() * source.rows());
+    QVERIFY(stats.channels.size() == 3);
+    for (size_t c = 0; c < stats.channels.size(); ++c) {
+        const FXX::ChannelStats &channel = stats.channels.at(c);
+        unsigned long long total = 0;
+        for (size_t bin = 0; bin < channel.histogram.size(); ++bin) { total += channel.histogram.at(bin); }
+        QVERIFY(total == stats.pixels);
+        QVERIFY(channel.min <= channel.mean && channel.mean <= channel.max);
+    }
+
+    QVERIFY(probe.setOutput(sampleCMYK, image.iccCMYK, &error));
+    QVERIFY(probe.hasOutput());
+    value = probe.output(0, 0);
+    QVERIFY(value.valid);
+    QVERIFY(value.colorspace == FXX::CMYKColorSpace);
+    QVERIFY(value.channels.size() == 4);
+    QVERIFY(probe.outputStats().channels.size() == 4);
+
+    std::cout << "Checking total ink coverage ..." << std::endl;
+    probe.setInkLimit(100.0);
+    FXX::TACReport tac = probe.tac();
+    QVERIFY(tac.pixels == stats.pixels);
+    QVERIFY(tac.mean <= tac.max && tac.p95 <= tac.p99 && tac.p99 <= tac.max && tac.max <= 400.0);
+    QVERIFY(tac.heatmap.size() == tac.heatmapWidth * tac.heatmapHeight);
+    QVERIFY(tac.heatmapWidth <= TAC_HEATMAP_SIZE && tac.heatmapHeight <= TAC_HEATMAP_SIZE);
+    QVERIFY((tac.over > 0) == (tac.max > 100.0));
+
+    std::cout << "Checking round trip Delta E ..." << std::endl;
+    FXX::TransformCache cache;
+    probe.compareOutput(true, &cache);
+    FXX::DeltaEReport deltaE = probe.deltaE();
+    QVERIFY(deltaE.pixels == stats.pixels);
+    QVERIFY(deltaE.mean <= deltaE.max && deltaE.p95 <= deltaE.max);
+    QVERIFY(deltaE.heatmap.size() == deltaE.heatmapWidth * deltaE.heatmapHeight);
+    QVERIFY(probe.setOutput(image.imageBuffer, image.iccInputBuffer, &error));
+    probe.compareOutput(true, &cache);
+    QVERIFY(probe.deltaE().pixels == stats.pixels);
+    QVERIFY(probe.deltaE().max < 0.01);
+    probe.compareOutput(false);
+    QVERIFY(probe.deltaE().pixels == 0);
+}
+
 QTEST_APPLESS_MAIN(Cyan)
 
 #include "tst_cyan.moc"